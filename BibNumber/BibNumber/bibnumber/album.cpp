@@ -0,0 +1,194 @@
+#include <iostream>
+#include <algorithm>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "album.h"
+#include "batch.h"
+#include "prefetch.h"
+#include "resultsink.h"
+#include "deadline.h"
+
+namespace batch {
+
+AlbumProgress::AlbumProgress() :
+		index(0), done(0), total(0), failed(0), elapsedMs(0) {
+}
+
+AlbumRun::AlbumRun() :
+		deadlineMs(0), sink(NULL), callback(NULL), manifest(NULL), stats(NULL) {
+}
+
+/// <summary>
+/// Supplies the images of a source until the album is cancelled or its deadline passed.
+/// </summary>
+class AlbumProcessor::CancellableSource : public ImageSource {
+public:
+	CancellableSource(ImageSource &source, AlbumProcessor &processor,
+			double deadlineMs) :
+			source(source), processor(processor), deadlineMs(deadlineMs),
+			start(cv::getTickCount()), stopped(false) {
+	}
+
+	virtual bool next(SourceImage &image) {
+		if (processor.isCancelled()
+				|| ((deadlineMs > 0) && (latency::elapsedMs(start) >= deadlineMs))) {
+			/* a cancel after the last image was taken does not stop the album */
+			SourceImage left;
+			stopped = source.next(left);
+			return false;
+		}
+		return source.next(image);
+	}
+
+	/// <summary>
+	/// Checks whether images were left in the source.
+	/// </summary>
+	bool wasStopped() const {
+		return stopped;
+	}
+
+private:
+	ImageSource &source;
+	AlbumProcessor &processor;
+	double deadlineMs;
+	int64 start;
+	bool stopped; /* images were left, only read once the executor took its last image */
+};
+
+AlbumProcessor::AlbumProcessor(const Options &options) :
+		options(options), jobs(0), cancelled(false) {
+}
+
+int AlbumProcessor::initialize(unsigned int nPipelines) {
+	if (!options.registryFile.empty()) {
+		if (bibRegistry.load(options.registryFile) < 0)
+			return -1;
+	}
+	if (!options.ocrCacheFile.empty()) {
+		ocrCache.load(options.ocrCacheFile);
+	}
+
+	jobs = options.jobs;
+	if (jobs == 0)
+		jobs = std::max(1u, boost::thread::hardware_concurrency());
+
+	/* detection worker k and OCR worker k share pipeline k */
+	if (nPipelines == 0)
+		nPipelines = std::max(jobs,
+				std::max(options.stages.detect, options.stages.recognize));
+	for (unsigned int k = 0; k < nPipelines; k++) {
+		pipeline::Pipeline *pipeline = new pipeline::Pipeline();
+		pipeline->setOcrCache(&ocrCache);
+		pipeline->setRegistry(&bibRegistry);
+		pipeline->setLatencyBudget(options.latencyBudgetMs);
+		pipeline->setWorkingWidth(options.workingWidth);
+		pipelines.push_back(pipeline);
+		if (pipeline->loadModel(options.svmModel) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int AlbumProcessor::process(const std::vector<boost::filesystem::path> &images,
+		const AlbumRun &run) {
+	ListSource source(images);
+	return processSource(source, images.size(), run);
+}
+
+int AlbumProcessor::process(ImageSource &source, const AlbumRun &run) {
+	return processSource(source, 0, run);
+}
+
+int AlbumProcessor::processSource(ImageSource &source, size_t total,
+		const AlbumRun &run) {
+	if (pipelines.empty()) {
+		std::cerr << "ERROR: Album processor not initialized" << std::endl;
+		return -1;
+	}
+
+	boost::lock_guard<boost::mutex> album(albumMutex);
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		cancelled = false;
+	}
+
+	AlbumProgress progress;
+	progress.total = total;
+	int64 start = cv::getTickCount();
+
+	/* images read ahead are dropped on cancel */
+	PrefetchSource prefetch(source, options.prefetchImages,
+			options.prefetchMB * 1024 * 1024);
+	CancellableSource cancellable(prefetch, *this, run.deadlineMs);
+
+	/* the executor joins its workers before the source is checked */
+	{
+		StagedExecutor executor(cancellable, options, pipelines, jobs,
+				run.manifest);
+		ImageResult result;
+		for (size_t i = 0; executor.wait(i, result); i++) {
+			progress.index = i;
+			progress.done++;
+			if (result.res < 0)
+				progress.failed++;
+			progress.elapsedMs = latency::elapsedMs(start);
+
+			if (run.sink != NULL) {
+				results::ImageRecord record;
+				record.index = i;
+				record.image = result.image;
+				record.bibNumbers = result.bibNumbers;
+				record.degradation = result.degradation;
+				record.hash = result.hash;
+				run.sink->append(record);
+			}
+			if (run.callback != NULL)
+				run.callback->imageDone(progress, result);
+		}
+		if (run.stats != NULL) {
+			executor.printStats(*run.stats);
+			if (options.prefetchImages > 0)
+				prefetch.printStats(*run.stats);
+		}
+	}
+	return cancellable.wasStopped() ? -1 : 0;
+}
+
+void AlbumProcessor::cancel() {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	cancelled = true;
+}
+
+bool AlbumProcessor::isCancelled() {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	return cancelled;
+}
+
+void AlbumProcessor::finish(std::ostream &out) {
+	printCacheStats(out);
+	saveCache();
+}
+
+void AlbumProcessor::printCacheStats(std::ostream &out) {
+	out << "OCR cache: hits=" << ocrCache.hits() << " misses="
+			<< ocrCache.misses() << " evictions=" << ocrCache.evictions()
+			<< std::endl;
+}
+
+void AlbumProcessor::saveCache() {
+	if (!options.ocrCacheFile.empty()) {
+		ocrCache.save(options.ocrCacheFile);
+	}
+}
+
+size_t AlbumProcessor::pipelineCount() const {
+	return pipelines.size();
+}
+
+pipeline::Pipeline &AlbumProcessor::pipeline(size_t k) {
+	return pipelines[k];
+}
+
+} /* namespace batch */
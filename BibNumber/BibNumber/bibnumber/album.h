@@ -0,0 +1,149 @@
+#ifndef ALBUM_H
+#define ALBUM_H
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "pipeline.h"
+#include "executor.h"
+#include "imagesource.h"
+#include "ocrcache.h"
+#include "registry.h"
+
+namespace results
+{
+	class ResultSink;
+}
+
+namespace manifest
+{
+	class Manifest;
+}
+
+namespace batch
+{
+	struct Options;
+
+	/// <summary>
+	/// Progress of an album when an image completes.
+	/// </summary>
+	struct AlbumProgress {
+		AlbumProgress();
+		size_t index; /* index of the completed image in the album */
+		size_t done; /* images completed so far */
+		size_t total; /* images of the album, 0 if the source does not know */
+		size_t failed; /* images which could not be processed so far */
+		double elapsedMs;
+	};
+
+	/// <summary>
+	/// Receives the results of an album as its images complete.
+	/// </summary>
+	class AlbumCallback {
+	public:
+		virtual ~AlbumCallback() {
+		}
+
+		/// <summary>
+		/// Called once per image, in album order and one call at a time from the thread
+		/// which called AlbumProcessor::process, so the callback needs no locking of
+		/// its own. It may call AlbumProcessor::cancel.
+		/// </summary>
+		/// <param name="result">The result of the image, its bib numbers may be taken by swapping.</param>
+		virtual void imageDone(const AlbumProgress &progress,
+				ImageResult &result) = 0;
+	};
+
+	/// <summary>
+	/// Settings of one album.
+	/// </summary>
+	struct AlbumRun {
+		AlbumRun();
+		double deadlineMs; /* no image is started after this time, 0 means unlimited */
+		results::ResultSink *sink; /* receives one record per image, NULL if none */
+		AlbumCallback *callback; /* NULL if none */
+		manifest::Manifest *manifest; /* unchanged images keep their previous results, NULL if none */
+		std::ostream *stats; /* receives the executor and read-ahead statistics at the end, NULL if none */
+	};
+
+	/// <summary>
+	/// Processes whole albums with pipelines initialized once, e.g. by the job runner
+	/// or a host application, instead of a loop over Pipeline::processImage. The
+	/// images of an album are spread over options.jobs threads (one per core for 0)
+	/// by the staged executor, with the model, registry, OCR cache, latency budget
+	/// and read-ahead of the options. An album can be cancelled from any thread:
+	/// no image is started after that, images in progress are completed and
+	/// reported. The batch, shard worker and daemon modes initialize their pipelines
+	/// through it as well.
+	/// </summary>
+	class AlbumProcessor {
+	public:
+		AlbumProcessor(const Options &options);
+
+		/// <summary>
+		/// Loads the registry, the OCR cache and the model and initializes the pipelines
+		/// with the latency budget and working width of the options.
+		/// </summary>
+		/// <param name="nPipelines">Count of pipelines, 0 for one per detection and OCR worker of the executor.</param>
+		/// <returns>0 if no error occured</returns>
+		int initialize(unsigned int nPipelines = 0);
+
+		/// <summary>
+		/// Processes the images of a list, see process(ImageSource&amp;, const AlbumRun&amp;).
+		/// </summary>
+		int process(const std::vector<boost::filesystem::path> &images,
+				const AlbumRun &run);
+
+		/// <summary>
+		/// Processes the images of a source, which may hold encoded images in memory,
+		/// and waits until they are done. One album is processed at a time.
+		/// </summary>
+		/// <returns>0 if all images were taken, -1 if the album was cancelled or ran past its deadline</returns>
+		int process(ImageSource &source, const AlbumRun &run);
+
+		/// <summary>
+		/// Stops the album in progress, safe to call from any thread but not from a signal handler.
+		/// </summary>
+		void cancel();
+
+		/// <summary>
+		/// Prints the OCR cache statistics and saves the OCR cache of the options.
+		/// </summary>
+		void finish(std::ostream &out);
+
+		void printCacheStats(std::ostream &out);
+
+		/// <summary>
+		/// Saves the OCR cache to the file of the options, if any.
+		/// </summary>
+		void saveCache();
+
+		size_t pipelineCount() const;
+
+		/// <summary>
+		/// Gets a pipeline, e.g. to process single images or to lend it to requests.
+		/// </summary>
+		pipeline::Pipeline &pipeline(size_t k);
+
+	private:
+		class CancellableSource;
+
+		bool isCancelled();
+		int processSource(ImageSource &source, size_t total, const AlbumRun &run);
+
+		const Options &options;
+		ocrcache::OcrCache ocrCache;
+		registry::BibRegistry bibRegistry;
+		boost::ptr_vector<pipeline::Pipeline> pipelines;
+		unsigned int jobs; /* threads split between the stages */
+		bool cancelled;
+		boost::mutex mutex; /* guards cancelled */
+		boost::mutex albumMutex; /* held while an album is processed */
+	};
+}
+
+#endif /* #ifndef ALBUM_H */
@@ -5,21 +5,37 @@
 #include <vector>
 #include <string>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/bimap.hpp>
-#include <boost/bimap/set_of.hpp>
-#include <boost/bimap/multiset_of.hpp>
 
 #include "opencv2/objdetect/objdetect.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "batch.h"
+#include "album.h"
 #include "pipeline.h"
+#include "executor.h"
+#include "resultsink.h"
+#include "imagesource.h"
+#include "evaluation.h"
+#include "manifest.h"
+#include "shards.h"
+#include "metrics.h"
+#include "trace.h"
+#include "pack.h"
 #include "log.h"
 
-namespace bimaps = boost::bimaps;
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 namespace fs = boost::filesystem;
 
+/* the result stream is also flushed when this long passed since the last flush */
+#define STREAM_FLUSH_INTERVAL_MS (1000)
+
 class CSVRow {
 public:
 	std::string const& operator[](std::size_t index) const {
@@ -64,10 +80,27 @@ int batch(const char *path) {
 }
 #endif
 
-static int exists(std::vector<int> arr, int item) {
+static int exists(const std::vector<int> &arr, int item) {
 	return std::find(arr.begin(), arr.end(), item) != arr.end();
 }
 
+/// <summary>
+/// Gets the peak resident set size of the process in kB, 0 if unknown.
+/// </summary>
+static long peakRssKb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (long) (counters.PeakWorkingSetSize / 1024);
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return usage.ru_maxrss;
+	return 0;
+#endif
+}
+
 namespace batch {
 
 bool isImageFile(std::string name) {
@@ -102,17 +135,200 @@ std::vector<fs::path> getImageFiles(std::string dir)
 	return imgFiles;
 }
 
-int process(std::string inputName, std::string svmModel) {
-	int res;
+void readGroundTruth(const std::string &fileName, std::vector<fs::path> &paths,
+		std::vector<std::vector<int> > &groundTruth) {
+	std::ifstream file(fileName.c_str());
+	fs::path pathname(fileName);
+	fs::path dirname = pathname.parent_path();
 
-	std::string resultFileName("out.csv");
+	CSVRow row;
+	while (file >> row) {
+		std::string filename = row[0];
+		std::vector<int> groundTruthNumbers;
 
-	if (!fs::exists(inputName)) {
-		std::cerr << "ERROR: Not found: " << inputName << std::endl;
+		fs::path file(filename);
+		paths.push_back(dirname / file);
+
+		for (unsigned int i = 1; i < row.size(); i++)
+			groundTruthNumbers.push_back(atoi(row[i].c_str()));
+		groundTruth.push_back(groundTruthNumbers);
+	}
+}
+
+Score::Score() :
+		truePositives(0), falsePositives(0), relevant(0) {
+}
+
+void Score::add(const std::vector<int> &groundTruthNumbers,
+		const std::vector<int> &bibNumbers, std::ostream &out) {
+	relevant += groundTruthNumbers.size();
+
+	for (unsigned int i = 0; i < bibNumbers.size(); i++) {
+		if (exists(groundTruthNumbers, bibNumbers[i])) {
+			out << "Match " << bibNumbers[i] << std::endl;
+			truePositives++;
+		} else {
+			out << "Mismatch " << bibNumbers[i] << std::endl;
+			falsePositives++;
+		}
+	}
+
+	for (unsigned int i = 0; i < groundTruthNumbers.size(); i++) {
+		if (!exists(bibNumbers, groundTruthNumbers[i])) {
+			out << "Missed " << groundTruthNumbers[i]
+					<< std::endl;
+		}
+	}
+}
+
+void Score::print(std::ostream &out) const {
+	out.setf(std::ios_base::fixed, std::ios_base::floatfield);
+	out.precision(2);
+
+	float precision = (float) truePositives
+			/ (float) (truePositives + falsePositives);
+	float recall = (float) truePositives / (float) (relevant);
+	float fscore = 2 * precision * recall / (precision + recall);
+
+	out << "precision=" << truePositives << "/"
+			<< truePositives + falsePositives << "=" << precision
+			<< std::endl;
+	out << "recall=" << truePositives << "/" << relevant << "="
+			<< recall << std::endl;
+	out << "F-score=" << fscore << std::endl;
+}
+
+Options::Options() :
+		latencyBudgetMs(0), workingWidth(WORKING_WIDTH), jobs(1), reducedDecode(true), flushRecords(1),
+		resume(true), shards(0), isolate(false), prefetchImages(16),
+		prefetchMB(256), interactiveQueue(64), bulkQueue(256), agingMs(2000),
+		preforkWorkers(0) {
+}
+
+std::string resultVersion(const Options &options) {
+	std::ostringstream params;
+	params << "model=" << (options.svmModel.empty() ? 0 :
+			manifest::hashFile(options.svmModel)) << ";registry="
+			<< (options.registryFile.empty() ? 0 :
+					manifest::hashFile(options.registryFile))
+			<< ";budget=" << options.latencyBudgetMs << ";reduced="
+			<< options.reducedDecode;
+	/* results of runs at the default width keep their version */
+	if (options.workingWidth != WORKING_WIDTH)
+		params << ";width=" << options.workingWidth;
+	std::string text = params.str();
+	return std::string(PIPELINE_VERSION) + "/"
+			+ manifest::formatHash(manifest::hashBytes(
+					(const unsigned char *) text.data(), text.size()));
+}
+
+/// <summary>
+/// Streams the results of a directory or pack as the images finish.
+/// </summary>
+class CollectionCallback : public AlbumCallback {
+public:
+	CollectionCallback(results::ResultSink &sink, const std::string &version) :
+			sink(sink), version(version), res(0), nImages(0), nReused(0) {
+	}
+
+	virtual void imageDone(const AlbumProgress &progress, ImageResult &result) {
+		std::cout << std::endl << "[" << progress.index + 1 << "] ";
+		res = result.res;
+		if (result.reused)
+			nReused++;
+
+		results::ImageRecord record;
+		record.index = progress.index;
+		record.image = result.image;
+		record.bibNumbers.swap(result.bibNumbers);
+		record.degradation = result.degradation;
+		record.hash = result.hash;
+		record.version = version;
+		sink.append(record);
+		nImages++;
+	}
+
+	results::ResultSink &sink;
+	const std::string &version;
+	int res; /* result of the last image */
+	size_t nImages;
+	size_t nReused;
+};
+
+/// <summary>
+/// Scores the images of a ground truth file and collects their timings.
+/// </summary>
+class EvaluationCallback : public AlbumCallback {
+public:
+	EvaluationCallback(const std::vector<std::vector<int> > &groundTruth) :
+			groundTruth(groundTruth) {
+	}
+
+	virtual void imageDone(const AlbumProgress &progress, ImageResult &result) {
+		score.add(groundTruth[progress.index], result.bibNumbers, std::cout);
+		report.add(progress.index, result);
+	}
+
+	const std::vector<std::vector<int> > &groundTruth;
+	Score score;
+	EvaluationReport report;
+};
+
+/// <summary>
+/// Processes the images of a directory or pack. Results are streamed as the images
+/// finish, unchanged images keep the results of the previous run and the bib to
+/// images index is written at the end.
+/// </summary>
+static int processCollection(ImageSource &source, const fs::path &streamPath,
+		const fs::path &outPath, const Options &options,
+		AlbumProcessor &processor, size_t &nImages) {
+
+	/* the result stream of the previous run tells which images did not change */
+	std::string version = resultVersion(options);
+	manifest::Manifest manifest;
+	if (manifest.open(streamPath.string(), version, options.resume) < 0)
 		return -1;
+	if (manifest.size() > 0) {
+		std::cout << "Resuming from the results of " << manifest.size()
+				<< " images" << std::endl;
 	}
 
-	pipeline::Pipeline pipeline;
+	/* results are streamed as images finish, nothing is kept in memory */
+	results::ResultSink sink(options.flushRecords, STREAM_FLUSH_INTERVAL_MS);
+	if (sink.open(streamPath.string()) < 0)
+		return -1;
+
+	/* set log mask to minimum */
+	biblog::set_log_mask(LOG_NONE);
+
+	/* files are read ahead while the decoders work */
+	CollectionCallback callback(sink, version);
+	AlbumRun run;
+	run.callback = &callback;
+	run.manifest = &manifest;
+	run.stats = &std::cout;
+	processor.process(source, run);
+	sink.close();
+	manifest.close();
+	nImages = callback.nImages;
+
+	std::cout << "Unchanged images reused: " << callback.nReused << "/"
+			<< nImages << std::endl;
+
+	/* bib to images index, sorted externally from the stream */
+	std::cout << "Saving results to " << outPath.string() << std::endl;
+	results::writeBibIndex(streamPath.string(), outPath.string());
+
+	return callback.res;
+}
+
+static int processInput(std::string inputName, const Options &options,
+		AlbumProcessor &processor, size_t &nImages) {
+	int res = 0;
+	nImages = 0;
+
+	std::string resultFileName("out.csv");
+	std::string streamFileName("results.jsonl");
 
 	if (fs::is_regular_file(inputName)) {
 		/* convert name to lower case to make extension checks easier */
@@ -121,123 +337,108 @@ int process(std::string inputName, std::string svmModel) {
 
 		if (isImageFile(inputName)) {
 			std::vector<int> bibNumbers;
-			res = processSingleImage(inputName, svmModel, pipeline, bibNumbers);
+			res = processSingleImage(inputName, options, processor.pipeline(0),
+					bibNumbers);
+			nImages = 1;
+		} else if (isShardFile(inputName)) {
+			res = processShard(inputName, options, processor, nImages);
+		} else if (pack::isPackFile(inputName)) {
+			fs::path outPath = fs::path(inputName).replace_extension(".out.csv");
+			fs::path streamPath = fs::path(inputName).replace_extension(".results.jsonl");
+			std::cout << "Processing pack " << inputName << " into "
+					<< streamPath.string() << std::endl;
+
+			/* the images are decoded from the mapped pack */
+			pack::PackSource source;
+			if (source.open(inputName) < 0)
+				return -1;
+			res = processCollection(source, streamPath, outPath, options,
+					processor, nImages);
 		} else if (boost::algorithm::ends_with(name, ".csv")) {
 
-			int true_positives = 0;
-			int false_positives = 0;
-			int relevant = 0;
+			int64 start = cv::getTickCount();
 
 			/* set log mask to minimum */
 			biblog::set_log_mask(LOG_NONE);
 
-			std::ifstream file(inputName.c_str());
-			fs::path pathname(inputName);
-			fs::path dirname = pathname.parent_path();
-
-			CSVRow row;
-			while (file >> row) {
-				std::string filename = row[0];
-				std::vector<int> groundTruthNumbers;
-				std::vector<int> bibNumbers;
-
-				fs::path file(filename);
-				fs::path full_path = dirname / file;
-
-				processSingleImage(full_path.string(), svmModel, pipeline, bibNumbers);
-
-				for (unsigned int i = 1; i < row.size(); i++)
-					groundTruthNumbers.push_back(atoi(row[i].c_str()));
-				relevant += groundTruthNumbers.size();
-
-				for (unsigned int i = 0; i < bibNumbers.size(); i++) {
-					if (exists(groundTruthNumbers, bibNumbers[i])) {
-						std::cout << "Match " << bibNumbers[i] << std::endl;
-						true_positives++;
-					} else {
-						std::cout << "Mismatch " << bibNumbers[i] << std::endl;
-						false_positives++;
-					}
-				}
-
-				for (unsigned int i = 0; i < groundTruthNumbers.size(); i++) {
-					if (!exists(bibNumbers, groundTruthNumbers[i])) {
-						std::cout << "Missed " << groundTruthNumbers[i]
-								<< std::endl;
-					}
-				}
-
-			}
-
-			std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
-			std::cout.precision(2);
-
-			float precision = (float) true_positives
-					/ (float) (true_positives + false_positives);
-			float recall = (float) true_positives / (float) (relevant);
-			float fscore = 2 * precision * recall / (precision + recall);
-
-			std::cout << "precision=" << true_positives << "/"
-					<< true_positives + false_positives << "=" << precision
-					<< std::endl;
-			std::cout << "recall=" << true_positives << "/" << relevant << "="
-					<< recall << std::endl;
-			std::cout << "F-score=" << fscore << std::endl;
+			/* read the ground truth first, images are processed in parallel */
+			std::vector<fs::path> img_paths;
+			std::vector<std::vector<int> > groundTruth;
+			readGroundTruth(inputName, img_paths, groundTruth);
+
+			EvaluationCallback callback(groundTruth);
+			AlbumRun run;
+			run.callback = &callback;
+			std::ostringstream stats;
+			run.stats = &stats;
+			processor.process(img_paths, run);
+			nImages = img_paths.size();
+			double elapsedMs = latency::elapsedMs(start);
+
+			const Score &score = callback.score;
+			const EvaluationReport &report = callback.report;
+			score.print(std::cout);
+			report.print(std::cout, elapsedMs);
+			std::cout << stats.str();
+
+			/* machine readable report next to the ground truth */
+			fs::path reportPath = fs::path(inputName).replace_extension(".report.json");
+			std::cout << "Saving report to " << reportPath.string() << std::endl;
+			if (report.write(reportPath.string(), score, elapsedMs) < 0)
+				res = -1;
 
 		}
 	} else if (fs::is_directory(inputName)) {
 
 		fs::path outPath = inputName / fs::path(resultFileName);
+		fs::path streamPath = inputName / fs::path(streamFileName);
 		std::cout << "Processing directory " << inputName << " into "
-				<< outPath.string() << std::endl;
-
-		std::ofstream outFile;
-		outFile.open(outPath.c_str());
-
-		/* set log mask to minimum */
-		biblog::set_log_mask(LOG_NONE);
+				<< streamPath.string() << std::endl;
 
-		std::vector<fs::path> img_paths; // vector of image paths
+		/* images are processed while the directory is read */
+		DirectorySource source(inputName);
+		processCollection(source, streamPath, outPath, options, processor,
+				nImages);
 
-		typedef boost::bimap<bimaps::multiset_of<std::string>,
-				bimaps::multiset_of<int> > imgTagBimap;
+		return -1;
+	} else {
+		std::cerr << "ERROR: unknown path type " << inputName << std::endl;
+		return -1;
+	}
 
-		imgTagBimap tags;
+	return res;
+}
 
-		/* find images in directory */
-		img_paths = getImageFiles(inputName);
+int process(std::string inputName, const Options &options) {
+	int res;
 
-		/* process images */
-		for (int i = 0, j=img_paths.size(); i<j ; i++) {
-			std::vector<int> bibNumbers;
+	if (!fs::exists(inputName)) {
+		std::cerr << "ERROR: Not found: " << inputName << std::endl;
+		return -1;
+	}
 
-			std::cout << std::endl << "[" << i+1 << "/" << j << "] ";
-			res = processSingleImage(img_paths[i].string(), svmModel, pipeline, bibNumbers);
+	/* the registry, the OCR cache shared by the album and the pipelines are
+	   initialized once, a single image needs one pipeline */
+	AlbumProcessor processor(options);
+	unsigned int nPipelines =
+			(fs::is_regular_file(inputName) && isImageFile(inputName)) ? 1 : 0;
+	if (processor.initialize(nPipelines) < 0)
+		return -1;
 
-			for (unsigned int k = 0; k < bibNumbers.size(); k++) {
-				tags.insert(
-						imgTagBimap::value_type(img_paths[i].string(), bibNumbers[k]));
-			}
-		}
+	size_t nImages;
+	int64 startTicks = cv::getTickCount();
+	{
+		metrics::FileExporter exporter(options.metricsFile);
+		trace::Session session(options.traceFile);
+		res = processInput(inputName, options, processor, nImages);
+	}
+	double seconds = latency::elapsedMs(startTicks) / 1000.;
 
-		/* save results to .csv file */
-		std::cout << "Saving results to " << outPath.string() << std::endl;
-		int current_bib = 0;
-		for (imgTagBimap::right_const_iterator it = tags.right.begin(), iend =
-				tags.right.end(); it != iend; it++) {
-			if (it->first != current_bib) {
-				current_bib = it->first;
-				outFile << std::endl << current_bib << ",";
-			}
-			outFile << it->second << ",";
-		}
-		outFile.close();
+	std::cout << "Processed " << nImages << " images in " << seconds << " s ("
+			<< (seconds > 0 ? nImages / seconds : 0) << " images/s), peak RSS "
+			<< peakRssKb() / 1024 << " MB" << std::endl;
 
-		return -1;
-	} else {
-		std::cerr << "ERROR: unknown path type " << inputName << std::endl;
-		return -1;
-	}
+	processor.finish(std::cout);
 
 	return res;
 }
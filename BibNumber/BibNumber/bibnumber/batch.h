@@ -5,52 +5,145 @@
 #include <vector>
 #include <boost/filesystem.hpp>
 #include "pipeline.h"
+#include "deadline.h"
+#include "executor.h"
+#include "decode.h"
 #include "opencv2/objdetect/objdetect.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
 namespace batch
 {
+	/// <summary>
+	/// Options of batch processing.
+	/// </summary>
+	struct Options {
+		Options();
+		std::string svmModel; /* HOG+SVM model file, empty if none */
+		std::string ocrCacheFile; /* OCR cache persistence file, empty if none */
+		std::string registryFile; /* registered bib numbers of the event, empty if none */
+		double latencyBudgetMs; /* latency budget of one image, 0 means unlimited */
+		int workingWidth; /* width images are resized to for detection */
+		unsigned int jobs; /* threads split between the stages, 0 means one per core */
+		StageThreads stages; /* thread counts of the stages, 0 means balanced from jobs */
+		bool reducedDecode; /* JPEG images are decoded at reduced size close to the working width */
+		size_t flushRecords; /* the result stream is flushed after this count of images */
+		bool resume; /* unchanged images of a directory keep the results of the previous run */
+		unsigned int shards; /* worker processes of the coordinator, 0 processes in this process */
+		bool isolate; /* shard workers process images one by one to find an image they die on */
+		size_t prefetchImages; /* images read ahead of the decoders, 0 disables read-ahead */
+		size_t prefetchMB; /* megabytes of encoded images held by the read-ahead */
+		size_t interactiveQueue; /* waiting interactive requests of the daemon, 0 for unlimited */
+		size_t bulkQueue; /* waiting bulk requests of the daemon, 0 for unlimited */
+		double agingMs; /* wait after which a bulk request of the daemon goes first */
+		unsigned int preforkWorkers; /* processes forked by the daemon, 0 serves in the daemon process */
+		std::string metricsFile; /* Prometheus text file replaced during the run, empty if none */
+		std::string traceFile; /* Chrome trace-event file written at the end, empty if none */
+		std::string manifestFile; /* results of the previous run set aside by the shard coordinator, empty if none */
+	};
+
+	/// <summary>
+	/// Precision and recall of the bib numbers read against a ground truth.
+	/// </summary>
+	struct Score {
+		Score();
+
+		/// <summary>
+		/// Compares the bib numbers read in an image with its ground truth and prints
+		/// the matches, mismatches and missed bibs.
+		/// </summary>
+		void add(const std::vector<int> &groundTruthNumbers,
+			const std::vector<int> &bibNumbers, std::ostream &out);
+
+		/// <summary>
+		/// Prints precision, recall and F-score.
+		/// </summary>
+		void print(std::ostream &out) const;
+
+		int truePositives;
+		int falsePositives;
+		int relevant;
+	};
+
+	/// <summary>
+	/// Reads a ground truth file: one image per line, followed by its bib numbers,
+	/// separated by ';'. Image paths are relative to the file.
+	/// </summary>
+	void readGroundTruth(const std::string &fileName,
+		std::vector<boost::filesystem::path> &paths,
+		std::vector<std::vector<int> > &groundTruth);
+
+	/// <summary>
+	/// Gets the version of the results of a run: the pipeline version and a hash of the
+	/// options and files which change the bib numbers read in an image.
+	/// </summary>
+	std::string resultVersion(const Options &options);
+
 	bool isImageFile(std::string name);
 	std::vector<boost::filesystem::path> getImageFiles(std::string dir);
-	int process(std::string inputName, std::string svmModel);
+	int process(std::string inputName, const Options &options);
 
+	/// <summary>
+	/// Removes duplicate bib numbers of an image and prints them.
+	/// </summary>
+	/// <param name="degradation">The latency::Degradation steps taken for the image.</param>
+	static void printResult(
+		std::vector<int>& bibNumbers,
+		int degradation,
+		std::ostream &out)
+	{
+		/* remove duplicates */
+		std::sort(bibNumbers.begin(), bibNumbers.end());
+		bibNumbers.erase(std::unique(bibNumbers.begin(), bibNumbers.end()),
+			bibNumbers.end());
+
+		/* display result */
+		out << "Read: [";
+		for (std::vector<int>::iterator it = bibNumbers.begin();
+			it != bibNumbers.end(); ++it) {
+			out << " " << *it;
+		}
+		out << "]";
+		if (degradation != latency::DEGRADE_NONE) {
+			out << " degraded:" << latency::describeDegradation(degradation);
+		}
+		out << std::endl;
+	}
+
+	/// <summary>
+	/// Detects and recognizes the bib numbers of one image file.
+	/// </summary>
+	/// <param name="out">Stream for the progress and result messages, buffered by worker threads.</param>
+	/// <param name="err">Stream for the error messages.</param>
 	static int processSingleImage(
 		std::string fileName,
-		std::string svmModel,
+		const Options &options,
 		pipeline::Pipeline &pipeline,
-		std::vector<int>& bibNumbers)
+		std::vector<int>& bibNumbers,
+		std::ostream &out = std::cout,
+		std::ostream &err = std::cerr)
 	{
 		int res;
 
-		std::cout << "Processing file " << fileName << std::endl;
+		out << "Processing file " << fileName << std::endl;
 
 		/* open image */
-		cv::Mat image = cv::imread(fileName, 1);
+		double decodeScale;
+		cv::Mat image = decode::readImage(fileName,
+			options.reducedDecode ? options.workingWidth : 0, decodeScale);
 		if (image.empty()) {
-			std::cerr << "ERROR:Failed to open image file" << std::endl;
+			err << "ERROR:Failed to open image file" << std::endl;
 			return -1;
 		}
 
 		/* process image */
-		res = pipeline.processImage(image, svmModel, bibNumbers);
+		res = pipeline.processImage(image, options.svmModel, bibNumbers, decodeScale);
 		if (res < 0) {
-			std::cerr << "ERROR: Could not process image" << std::endl;
+			err << "ERROR: Could not process image" << std::endl;
 			return -1;
 		}
 
-		/* remove duplicates */
-		std::sort(bibNumbers.begin(), bibNumbers.end());
-		bibNumbers.erase(std::unique(bibNumbers.begin(), bibNumbers.end()),
-			bibNumbers.end());
-
-		/* display result */
-		std::cout << "Read: [";
-		for (std::vector<int>::iterator it = bibNumbers.begin();
-			it != bibNumbers.end(); ++it) {
-			std::cout << " " << *it;
-		}
-		std::cout << "]" << std::endl;
+		printResult(bibNumbers, pipeline.degradation(), out);
 
 		return res;
 	}
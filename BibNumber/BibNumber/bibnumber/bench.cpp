@@ -0,0 +1,690 @@
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "bench.h"
+#include "synth.h"
+#include "textdetection.h"
+#include "textrecognition.h"
+#include "deadline.h"
+#include "batch.h"
+#include "album.h"
+#include "resultsink.h"
+#include "log.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+/* seed of the first scene, each scene has its own */
+#define SCENE_SEED (1000)
+/* seed of the warm-up scenes of the scaling runs, apart from the kernel scenes */
+#define WARMUP_SEED (5000)
+/* images of the corpus the stage times of a width are measured on, untimed */
+#define STAGE_CALIBRATION_IMAGES (3)
+
+static const cv::Size sceneSizes[] = { cv::Size(640, 427), cv::Size(1200, 800),
+		cv::Size(2400, 1600) };
+static const int sceneBibs[] = { 1, 6, 16 };
+
+enum Kernel {
+	KERNEL_SMOOTHING_RGB = 0,
+	KERNEL_SEGMENTATION,
+	KERNEL_SMOOTHING,
+	KERNEL_CANNY,
+	KERNEL_GRADIENTS,
+	KERNEL_SWT,
+	KERNEL_SWT_MEDIAN,
+	KERNEL_COMPONENTS,
+	KERNEL_FILTERING,
+	KERNEL_CHAINING,
+	KERNEL_CROPS,
+	KERNEL_COUNT
+};
+
+static const char *kernelNames[] = { "EdgePreservingSmoothingRGB",
+		"ImageSegmentationFloodFill", "EdgePreservingSmoothing", "AutoCanny",
+		"gradients", "strokeWidthTransform", "SWTMedianFilter",
+		"findLegallyConnectedComponents", "filterComponents", "makeChains",
+		"prepareChainCrop (all chains)" };
+
+/// <summary>
+/// Gets the parameters of Pipeline::detect without a model for a scene.
+/// </summary>
+static struct TextDetectionParams sceneParams(const cv::Mat &scene) {
+	struct TextDetectionParams params = {
+						1, /* darkOnLight */
+						30, /* maxStrokeLength */
+						11, /* minCharacterHeight */
+						100, /* maxImgWidthToTextRatio */
+						45, /* maxAngle */
+						0, /* topBorder */
+						0, /* bottomBorder */
+						3, /* min chain len */
+						0, /* verify with SVM model up to this chain len */
+						0, /* height needs to be this large to verify with model */
+						scene.rows * 5 / 1000, /* min connected component height */
+						0, /* min SVM score of chains verified with model */
+						0, /* max chains passed to OCR, 0 means all */
+						false /* skip smoothing */
+				};
+	return params;
+}
+
+static IplImage *createSWTImage(CvSize size) {
+	IplImage *image = cvCreateImage(size, IPL_DEPTH_32F, 1);
+	cvSet(image, cvScalar(-1));
+	return image;
+}
+
+/// <summary>
+/// Times the kernels on one scene.
+/// </summary>
+/// <param name="samples">Receives the time of each run of each kernel in ms.</param>
+static void timeScene(const cv::Mat &scene, unsigned int iterations,
+		std::vector<double> *samples, size_t &nRays, size_t &nComponents,
+		size_t &nChains) {
+	struct TextDetectionParams params = sceneParams(scene);
+	CvSize size = cvSize(scene.cols, scene.rows);
+
+	/* the smoothing kernels work in place, each run gets a fresh copy */
+	cv::Mat smoothed;
+	for (unsigned int it = 0; it < iterations; it++) {
+		smoothed = scene.clone();
+		int64 start = cv::getTickCount();
+		EdgePreservingSmoothingRGB(smoothed);
+		samples[KERNEL_SMOOTHING_RGB].push_back(latency::elapsedMs(start));
+	}
+	cv::Mat segmented;
+	for (unsigned int it = 0; it < iterations; it++) {
+		segmented = smoothed.clone();
+		int64 start = cv::getTickCount();
+		ImageSegmentationFloodFill(segmented);
+		samples[KERNEL_SEGMENTATION].push_back(latency::elapsedMs(start));
+	}
+
+	IplImage segmentedIpl = segmented;
+	IplImage *grayImage = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	IplImage *edgeSmoothedImage = cvCreateImage(size, IPL_DEPTH_8U, 1);
+	cvCvtColor(&segmentedIpl, grayImage, CV_RGB2GRAY);
+	for (unsigned int it = 0; it < iterations; it++) {
+		int64 start = cv::getTickCount();
+		EdgePreservingSmoothing(grayImage, edgeSmoothedImage);
+		samples[KERNEL_SMOOTHING].push_back(latency::elapsedMs(start));
+	}
+
+	cv::Mat edgeSmoothMat(edgeSmoothedImage, false);
+	cv::Mat edge;
+	for (unsigned int it = 0; it < iterations; it++) {
+		int64 start = cv::getTickCount();
+		AutoCanny(&edgeSmoothMat, &edge);
+		samples[KERNEL_CANNY].push_back(latency::elapsedMs(start));
+	}
+	IplImage edgeIpl = edge;
+
+	/* the gradient chain of TextDetector::detect */
+	IplImage *gaussianImage = cvCreateImage(size, IPL_DEPTH_32F, 1);
+	IplImage *gradientX = cvCreateImage(size, IPL_DEPTH_32F, 1);
+	IplImage *gradientY = cvCreateImage(size, IPL_DEPTH_32F, 1);
+	for (unsigned int it = 0; it < iterations; it++) {
+		int64 start = cv::getTickCount();
+		cvConvertScale(edgeSmoothedImage, gaussianImage, 1. / 255., 0);
+		cvSmooth(gaussianImage, gaussianImage, CV_GAUSSIAN, 5, 5);
+		cvSobel(gaussianImage, gradientX, 1, 0, CV_SCHARR);
+		cvSobel(gaussianImage, gradientY, 0, 1, CV_SCHARR);
+		cvSmooth(gradientX, gradientX, 3, 3);
+		cvSmooth(gradientY, gradientY, 3, 3);
+		samples[KERNEL_GRADIENTS].push_back(latency::elapsedMs(start));
+	}
+	cvReleaseImage(&gaussianImage);
+
+	std::vector<Ray> rays;
+	IplImage *SWTImage = NULL;
+	for (unsigned int it = 0; it < iterations; it++) {
+		if (SWTImage != NULL)
+			cvReleaseImage(&SWTImage);
+		SWTImage = createSWTImage(size);
+		rays.clear();
+		int64 start = cv::getTickCount();
+		strokeWidthTransform(&edgeIpl, gradientX, gradientY, params, SWTImage, rays);
+		samples[KERNEL_SWT].push_back(latency::elapsedMs(start));
+	}
+
+	IplImage *filteredSWT = NULL;
+	std::vector<Ray> filteredRays;
+	for (unsigned int it = 0; it < iterations; it++) {
+		if (filteredSWT != NULL)
+			cvReleaseImage(&filteredSWT);
+		filteredSWT = cvCloneImage(SWTImage);
+		filteredRays = rays;
+		int64 start = cv::getTickCount();
+		SWTMedianFilter(filteredSWT, filteredRays);
+		samples[KERNEL_SWT_MEDIAN].push_back(latency::elapsedMs(start));
+	}
+	nRays = filteredRays.size();
+
+	std::vector<std::vector<Point2d> > components;
+	for (unsigned int it = 0; it < iterations; it++) {
+		int64 start = cv::getTickCount();
+		components = findLegallyConnectedComponents(filteredSWT, filteredRays,
+				edgeSmoothedImage);
+		samples[KERNEL_COMPONENTS].push_back(latency::elapsedMs(start));
+	}
+	nComponents = components.size();
+
+	std::vector<std::vector<Point2d> > validComponents;
+	std::vector<Point2dFloat> compCenters;
+	std::vector<float> compMedians;
+	std::vector<Point2d> compDimensions;
+	std::vector<std::pair<Point2d, Point2d> > compBB;
+	for (unsigned int it = 0; it < iterations; it++) {
+		std::vector<std::vector<Point2d> > input(components);
+		validComponents.clear();
+		compCenters.clear();
+		compMedians.clear();
+		compDimensions.clear();
+		compBB.clear();
+		int64 start = cv::getTickCount();
+		filterComponents(filteredSWT, input, validComponents, compCenters,
+				compMedians, compDimensions, compBB, params, edgeSmoothedImage);
+		samples[KERNEL_FILTERING].push_back(latency::elapsedMs(start));
+	}
+
+	IplImage sceneIpl = segmented;
+	for (unsigned int it = 0; it < iterations; it++) {
+		std::vector<std::vector<Point2d> > input(validComponents);
+		std::vector<Point2dFloat> centers(compCenters);
+		std::vector<float> medians(compMedians);
+		std::vector<Point2d> dimensions(compDimensions);
+		int64 start = cv::getTickCount();
+		std::vector<Chain> chains = makeChains(&sceneIpl, input, centers, medians,
+				dimensions, params);
+		samples[KERNEL_CHAINING].push_back(latency::elapsedMs(start));
+	}
+
+	cvReleaseImage(&filteredSWT);
+	cvReleaseImage(&SWTImage);
+	cvReleaseImage(&gradientX);
+	cvReleaseImage(&gradientY);
+	cvReleaseImage(&edgeSmoothedImage);
+	cvReleaseImage(&grayImage);
+
+	/* the crops are prepared from the chains and boxes found by the detector */
+	textdetection::TextDetector detector;
+	cv::Mat detected = scene.clone();
+	IplImage detectedIpl = detected;
+	std::vector<Chain> chains;
+	std::vector<std::pair<CvPoint, CvPoint> > chainBB;
+	compBB.clear();
+	detector.detect(&detectedIpl, params, chains, compBB, chainBB);
+	nChains = chains.size();
+	cv::Mat gray;
+	cv::cvtColor(detected, gray, CV_RGB2GRAY);
+	for (unsigned int it = 0; it < iterations; it++) {
+		int64 start = cv::getTickCount();
+		for (unsigned int i = 0; i < chainBB.size(); i++) {
+			cv::Mat crop;
+			textrecognition::prepareChainCrop(gray, i, params, chains, compBB,
+					chainBB, crop);
+		}
+		samples[KERNEL_CROPS].push_back(latency::elapsedMs(start));
+	}
+}
+
+/// <summary>
+/// Runs each pipeline of the processor on its own encoded synthetic scene, so
+/// Tesseract and the model are initialized and the buffers grown on every pipeline
+/// before a configuration is timed, without filling the OCR cache with crops of the
+/// corpus. The scenes differ so no pipeline is served from the cache.
+/// </summary>
+static void warmUp(batch::AlbumProcessor &processor, const batch::Options &options) {
+	for (size_t k = 0; k < processor.pipelineCount(); k++) {
+		std::vector<synth::Bib> bibs;
+		cv::Mat scene = synth::renderScene(cv::Size(1200, 800), 6,
+				WARMUP_SEED + (unsigned int) k, bibs);
+		std::vector<unsigned char> buffer;
+		cv::imencode(".jpg", scene, buffer);
+		std::vector<int> bibNumbers;
+		processor.pipeline(k).processEncodedImage(&buffer[0], buffer.size(),
+				options.svmModel, bibNumbers);
+	}
+}
+
+/// <summary>
+/// Collects the latencies and scores of the images of a configuration.
+/// </summary>
+class ScalingCallback : public batch::AlbumCallback {
+public:
+	ScalingCallback(const std::vector<std::vector<int> > &groundTruth) :
+			groundTruth(groundTruth), failed(0) {
+	}
+
+	virtual void imageDone(const batch::AlbumProgress &progress,
+			batch::ImageResult &result) {
+		latencies.push_back(result.wallMs);
+		if (result.res < 0)
+			failed++;
+		if (progress.index < groundTruth.size()) {
+			std::sort(result.bibNumbers.begin(), result.bibNumbers.end());
+			result.bibNumbers.erase(std::unique(result.bibNumbers.begin(),
+					result.bibNumbers.end()), result.bibNumbers.end());
+			std::ostringstream ignored;
+			score.add(groundTruth[progress.index], result.bibNumbers, ignored);
+		}
+	}
+
+	const std::vector<std::vector<int> > &groundTruth;
+	std::vector<double> latencies;
+	size_t failed;
+	batch::Score score;
+};
+
+/// <summary>
+/// Sums the stage times of the images of the stage calibration.
+/// </summary>
+class StageCallback : public batch::AlbumCallback {
+public:
+	StageCallback() :
+			measured(0) {
+		for (int stage = 0; stage < 3; stage++)
+			stageMs[stage] = 0;
+	}
+
+	virtual void imageDone(const batch::AlbumProgress &progress,
+			batch::ImageResult &result) {
+		if (result.res < 0)
+			return;
+		stageMs[0] += result.decodeMs;
+		stageMs[1] += result.detectMs;
+		stageMs[2] += result.recognizeMs;
+		measured++;
+	}
+
+	double stageMs[3]; /* decode, detect and recognize */
+	size_t measured;
+};
+
+/// <summary>
+/// Measurements of one configuration of a scaling run.
+/// </summary>
+struct ScalingResult {
+	unsigned int threads;
+	int width;
+	size_t images;
+	size_t failed;
+	double wallMs;
+	double cpuMs;
+	double speedup; /* images per second over those of the first thread count of the width */
+	double latencyMs[4]; /* p50, p90, p99 and max */
+	long peakRssKb;
+	double fscore; /* negative without ground truth */
+	batch::StageThreads stages; /* threads of the decode, detect and recognize stages */
+
+	double imagesPerSecond() const {
+		return (wallMs > 0) ? images * 1000 / wallMs : 0;
+	}
+
+	double cpuCores() const {
+		return (wallMs > 0) ? cpuMs / wallMs : 0;
+	}
+};
+
+static const double latencyPercentiles[] = { 50, 90, 99, 100 };
+static const char *latencyNames[] = { "p50", "p90", "p99", "max" };
+
+/// <summary>
+/// Gets the user and system CPU time of the process in ms.
+/// </summary>
+static double processCpuMs() {
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+	ULARGE_INTEGER kernelTime, userTime;
+	kernelTime.LowPart = kernel.dwLowDateTime;
+	kernelTime.HighPart = kernel.dwHighDateTime;
+	userTime.LowPart = user.dwLowDateTime;
+	userTime.HighPart = user.dwHighDateTime;
+	/* in units of 100 ns */
+	return (kernelTime.QuadPart + userTime.QuadPart) / 1e4;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3
+			+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+#endif
+}
+
+/// <summary>
+/// Resets the peak resident set size to the current one, so each configuration is
+/// measured on its own. Only Linux can, elsewhere the peak of the process so far
+/// is reported.
+/// </summary>
+static void resetPeakRss() {
+#ifdef __linux__
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5" << std::flush;
+#endif
+}
+
+/// <summary>
+/// Gets the peak resident set size in kB since the last reset, 0 if unknown.
+/// </summary>
+static long peakRssKb() {
+#ifdef __linux__
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (boost::algorithm::starts_with(line, "VmHWM:"))
+			return atol(line.c_str() + 6);
+	}
+#endif
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return (long) (counters.PeakWorkingSetSize / 1024);
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return usage.ru_maxrss;
+	return 0;
+#endif
+}
+
+/// <summary>
+/// Gets a percentile of sorted times by the nearest rank method.
+/// </summary>
+static double percentile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty())
+		return 0;
+	size_t rank = (size_t) ceil(p / 100 * sorted.size());
+	rank = std::min(std::max(rank, (size_t) 1), sorted.size());
+	return sorted[rank - 1];
+}
+
+/// <summary>
+/// Measures the stage times per image on the first images of the corpus with one
+/// thread per stage, before any configuration of a width is timed. The
+/// configurations split their threads between the stages from these times, so the
+/// executor does not calibrate inside the timed run and every configuration of a
+/// width uses the same split rule.
+/// </summary>
+/// <param name="stageMs">Set to the decode, detect and recognize times per image.</param>
+/// <returns>0 if no error occured</returns>
+static int measureStages(const std::vector<fs::path> &images,
+		const batch::Options &options, double stageMs[3]) {
+	batch::Options config(options);
+	config.jobs = 1;
+	config.stages.decode = 1;
+	config.stages.detect = 1;
+	config.stages.recognize = 1;
+	batch::AlbumProcessor processor(config);
+	if (processor.initialize() < 0)
+		return -1;
+	warmUp(processor, config);
+
+	std::vector<fs::path> first(images.begin(), images.begin()
+			+ std::min(images.size(), (size_t) STAGE_CALIBRATION_IMAGES));
+	StageCallback callback;
+	batch::AlbumRun run;
+	run.callback = &callback;
+	processor.process(first, run);
+	size_t measured = std::max(callback.measured, (size_t) 1);
+	for (int stage = 0; stage < 3; stage++)
+		stageMs[stage] = callback.stageMs[stage] / measured;
+	return 0;
+}
+
+/// <summary>
+/// Processes the corpus with one configuration.
+/// </summary>
+/// <returns>0 if no error occured</returns>
+static int runConfiguration(const std::vector<fs::path> &images,
+		const std::vector<std::vector<int> > &groundTruth,
+		const batch::Options &options, ScalingResult &result) {
+	resetPeakRss();
+	batch::AlbumProcessor processor(options);
+	if (processor.initialize() < 0)
+		return -1;
+	warmUp(processor, options);
+
+	ScalingCallback callback(groundTruth);
+	batch::AlbumRun run;
+	run.callback = &callback;
+	double cpuStart = processCpuMs();
+	int64 start = cv::getTickCount();
+	processor.process(images, run);
+	result.wallMs = latency::elapsedMs(start);
+	result.cpuMs = processCpuMs() - cpuStart;
+	result.peakRssKb = peakRssKb();
+
+	result.threads = options.jobs;
+	result.stages = options.stages;
+	result.width = options.workingWidth;
+	result.images = callback.latencies.size();
+	result.failed = callback.failed;
+	std::sort(callback.latencies.begin(), callback.latencies.end());
+	for (int p = 0; p < 4; p++)
+		result.latencyMs[p] = percentile(callback.latencies, latencyPercentiles[p]);
+	result.fscore = -1;
+	if (!groundTruth.empty()) {
+		const batch::Score &score = callback.score;
+		int found = score.truePositives + score.falsePositives;
+		double precision = found ? (double) score.truePositives / found : 0;
+		double recall = score.relevant ? (double) score.truePositives / score.relevant : 0;
+		result.fscore = (precision + recall > 0) ?
+				2 * precision * recall / (precision + recall) : 0;
+	}
+	return 0;
+}
+
+static void printScalingHeader(bool scored, std::ostream &out) {
+	out << std::setw(8) << "threads" << std::setw(7) << "width" << std::setw(10)
+			<< "images/s" << std::setw(9) << "speedup";
+	for (int p = 0; p < 4; p++)
+		out << std::setw(10) << (std::string(latencyNames[p]) + " ms");
+	out << std::setw(11) << "cpu cores" << std::setw(8) << "util %" << std::setw(14)
+			<< "peak RSS MB";
+	if (scored)
+		out << std::setw(9) << "F-score";
+	out << std::endl;
+}
+
+static void printScalingRow(const ScalingResult &result, std::ostream &out) {
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(2) << std::setw(8) << result.threads
+			<< std::setw(7) << result.width << std::setw(10)
+			<< result.imagesPerSecond() << std::setw(9) << result.speedup;
+	out << std::setprecision(1);
+	for (int p = 0; p < 4; p++)
+		out << std::setw(10) << result.latencyMs[p];
+	out << std::setprecision(2) << std::setw(11) << result.cpuCores()
+			<< std::setprecision(0) << std::setw(8)
+			<< 100 * result.cpuCores() / result.threads << std::setprecision(1)
+			<< std::setw(14) << result.peakRssKb / 1024.0;
+	if (result.fscore >= 0)
+		out << std::setprecision(3) << std::setw(9) << result.fscore;
+	if (result.failed > 0)
+		out << "  failed=" << result.failed;
+	out << std::endl;
+	out.unsetf(std::ios::fixed);
+	out.precision(precision);
+}
+
+/// <summary>
+/// Writes the configurations of a scaling run as a JSON object.
+/// </summary>
+/// <returns>0 if no error occured</returns>
+static int writeScalingJson(const std::string &fileName,
+		const std::string &corpus, size_t nImages,
+		const std::vector<ScalingResult> &results) {
+	std::ofstream file(fileName.c_str());
+	if (!file) {
+		std::cerr << "ERROR: Could not write " << fileName << std::endl;
+		return -1;
+	}
+	file << "{\"corpus\":\"" << results::escapeJson(corpus) << "\",\"images\":"
+			<< nImages << ",\"hardwareThreads\":"
+			<< boost::thread::hardware_concurrency() << ",\"configurations\":[";
+	for (size_t r = 0; r < results.size(); r++) {
+		const ScalingResult &result = results[r];
+		file << (r ? "," : "") << "\n{\"threads\":" << result.threads
+				<< ",\"width\":" << result.width << ",\"stages\":["
+				<< result.stages.decode << "," << result.stages.detect << ","
+				<< result.stages.recognize << "],\"images\":" << result.images
+				<< ",\"failed\":" << result.failed << ",\"wallMs\":"
+				<< result.wallMs << ",\"imagesPerSecond\":"
+				<< result.imagesPerSecond() << ",\"speedup\":" << result.speedup
+				<< ",\"latencyMs\":{";
+		for (int p = 0; p < 4; p++)
+			file << (p ? "," : "") << "\"" << latencyNames[p] << "\":"
+					<< result.latencyMs[p];
+		file << "},\"cpuMs\":" << result.cpuMs << ",\"cpuCores\":"
+				<< result.cpuCores() << ",\"cpuUtilization\":"
+				<< result.cpuCores() / result.threads << ",\"peakRssKb\":"
+				<< result.peakRssKb;
+		if (result.fscore >= 0)
+			file << ",\"fscore\":" << result.fscore;
+		file << "}";
+	}
+	file << "\n]}\n";
+	return file ? 0 : -1;
+}
+
+namespace bench {
+
+int runKernels(unsigned int iterations, std::ostream &out) {
+	if (iterations == 0) {
+		std::cerr << "ERROR: At least one iteration is needed" << std::endl;
+		return -1;
+	}
+	biblog::set_log_mask(LOG_NONE);
+
+	int seed = SCENE_SEED;
+	for (size_t s = 0; s < sizeof(sceneSizes) / sizeof(sceneSizes[0]); s++) {
+		for (size_t d = 0; d < sizeof(sceneBibs) / sizeof(sceneBibs[0]); d++) {
+			std::vector<synth::Bib> bibs;
+			cv::Mat scene = synth::renderScene(sceneSizes[s], sceneBibs[d], seed++,
+					bibs);
+			std::vector<double> samples[KERNEL_COUNT];
+			size_t nRays, nComponents, nChains;
+			timeScene(scene, iterations, samples, nRays, nComponents, nChains);
+
+			out << "Scene " << scene.cols << "x" << scene.rows << " bibs="
+					<< bibs.size() << ": rays=" << nRays << " components="
+					<< nComponents << " chains=" << nChains << std::endl;
+			std::streamsize precision = out.precision();
+			out << "  " << std::left << std::setw(34) << "kernel" << std::right
+					<< std::setw(12) << "min ms" << std::setw(12) << "median ms"
+					<< std::endl;
+			for (int k = 0; k < KERNEL_COUNT; k++) {
+				std::sort(samples[k].begin(), samples[k].end());
+				out << "  " << std::left << std::setw(34) << kernelNames[k]
+						<< std::right << std::fixed << std::setprecision(3)
+						<< std::setw(12) << samples[k].front() << std::setw(12)
+						<< samples[k][samples[k].size() / 2] << std::endl;
+				out.unsetf(std::ios::fixed);
+				out.precision(precision);
+			}
+		}
+	}
+	return 0;
+}
+
+int runScaling(const std::string &corpus,
+		const std::vector<unsigned int> &threads,
+		const std::vector<int> &widths, const std::string &jsonFile,
+		const batch::Options &options, std::ostream &out) {
+	std::vector<fs::path> images;
+	std::vector<std::vector<int> > groundTruth;
+	if (fs::is_directory(corpus)) {
+		images = batch::getImageFiles(corpus);
+	} else if (boost::algorithm::iends_with(corpus, ".csv")) {
+		batch::readGroundTruth(corpus, images, groundTruth);
+	} else {
+		std::cerr << "ERROR: Corpus must be a directory or a ground truth file"
+				<< std::endl;
+		return -1;
+	}
+	if (images.empty()) {
+		std::cerr << "ERROR: No images in " << corpus << std::endl;
+		return -1;
+	}
+
+	std::vector<unsigned int> threadCounts(threads);
+	if (threadCounts.empty()) {
+		unsigned int cores = std::max(1u, boost::thread::hardware_concurrency());
+		for (unsigned int n = 1; n < cores; n *= 2)
+			threadCounts.push_back(n);
+		threadCounts.push_back(cores);
+	}
+	std::vector<int> workingWidths(widths);
+	if (workingWidths.empty())
+		workingWidths.push_back(options.workingWidth);
+	biblog::set_log_mask(LOG_NONE);
+
+	out << "Scaling run over " << images.size() << " images of " << corpus
+			<< std::endl;
+	/* configurations start cold and leave no files behind */
+	batch::Options coldOptions(options);
+	coldOptions.ocrCacheFile.clear();
+	std::vector<std::vector<double> > stageMs(workingWidths.size(),
+			std::vector<double>(3));
+	for (size_t w = 0; w < workingWidths.size(); w++) {
+		coldOptions.workingWidth = workingWidths[w];
+		if (measureStages(images, coldOptions, &stageMs[w][0]) < 0)
+			return -1;
+		out << "Width " << workingWidths[w] << ": " << stageMs[w][0] << "/"
+				<< stageMs[w][1] << "/" << stageMs[w][2]
+				<< " ms per image to decode/detect/recognize" << std::endl;
+	}
+
+	printScalingHeader(!groundTruth.empty(), out);
+	std::vector<ScalingResult> results;
+	for (size_t w = 0; w < workingWidths.size(); w++) {
+		double baseline = 0;
+		for (size_t t = 0; t < threadCounts.size(); t++) {
+			/* the stage threads are set, so no calibration runs while timed */
+			batch::Options config(coldOptions);
+			config.jobs = threadCounts[t];
+			config.workingWidth = workingWidths[w];
+			config.stages = batch::StageThreads();
+			batch::balanceStages(config.stages, &stageMs[w][0], config.jobs);
+
+			ScalingResult result;
+			if (runConfiguration(images, groundTruth, config, result) < 0)
+				return -1;
+			if (t == 0)
+				baseline = result.imagesPerSecond();
+			result.speedup = (baseline > 0) ? result.imagesPerSecond() / baseline : 0;
+			printScalingRow(result, out);
+			results.push_back(result);
+		}
+	}
+
+	if (!jsonFile.empty()) {
+		if (writeScalingJson(jsonFile, corpus, images.size(), results) < 0)
+			return -1;
+		out << "Scaling report written to " << jsonFile << std::endl;
+	}
+	return 0;
+}
+
+} /* namespace bench */
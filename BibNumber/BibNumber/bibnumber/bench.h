@@ -0,0 +1,50 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace batch
+{
+	struct Options;
+}
+
+namespace bench
+{
+	/// <summary>
+	/// Times the kernels of detection and the crop preparation of recognition in
+	/// isolation on synthetic scenes (see synth::renderScene) of several resolutions
+	/// and bib densities. The input of each kernel is computed once by the preceding
+	/// kernels and copied outside of the timed section, so each row measures one
+	/// kernel only. The scenes are seeded, so results compare across machines and
+	/// commits.
+	/// </summary>
+	/// <param name="iterations">Runs of each kernel per scene, the minimum and median are reported.</param>
+	/// <returns>0 if no error occured</returns>
+	int runKernels(unsigned int iterations, std::ostream &out);
+
+	/// <summary>
+	/// Runs the full pipeline over a corpus once per configuration of a sweep of
+	/// thread counts and working widths, and reports images per second, the speedup
+	/// over the first thread count of the width, per-image latency percentiles, the
+	/// CPU cores used and peak RSS of each configuration as a table and as JSON.
+	/// Each configuration gets an AlbumProcessor of its own, initialized with the
+	/// options, and warms up each of its pipelines on a synthetic scene before it is timed.
+	/// The stage times of each width are measured on the first images beforehand, and
+	/// every configuration splits its threads between the stages from them, so the
+	/// executor does not calibrate while a configuration is timed.
+	/// A speedup well below the thread count with low CPU use points at contention.
+	/// </summary>
+	/// <param name="corpus">Directory of images, or ground truth file whose images are also scored.</param>
+	/// <param name="threads">Thread counts (options.jobs), empty for 1, 2, 4 ... up to one per core.</param>
+	/// <param name="widths">Working widths, empty for the width of the options.</param>
+	/// <param name="jsonFile">File receiving the JSON report, empty if none.</param>
+	/// <returns>0 if no error occured</returns>
+	int runScaling(const std::string &corpus,
+			const std::vector<unsigned int> &threads,
+			const std::vector<int> &widths, const std::string &jsonFile,
+			const batch::Options &options, std::ostream &out);
+}
+
+#endif /* #ifndef BENCH_H */
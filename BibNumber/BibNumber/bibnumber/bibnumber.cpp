@@ -3,20 +3,55 @@
 #include <cctype>
 #include <iostream>
 #include <iterator>
+#include <vector>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "batch.h"
+#include "bench.h"
+#include "shards.h"
+#include "pack.h"
+#include "server.h"
+#include "spool.h"
+#include "synth.h"
 #include "train.h"
 
 using namespace std;
 
+/// <summary>
+/// Parses a comma separated list of positive numbers.
+/// </summary>
+/// <returns>false if the list is empty or holds anything else</returns>
+template<typename T>
+static bool parseList(const char *text, vector<T> &values) {
+	values.clear();
+	const char *pos = text;
+	for (;;) {
+		char *end;
+		long value = strtol(pos, &end, 10);
+		if ((end == pos) || (value <= 0))
+			return false;
+		values.push_back((T) value);
+		if (*end == '\0')
+			return true;
+		if (*end != ',')
+			return false;
+		pos = end + 1;
+	}
+}
 
 
 static void help() {
 	cout << "\nThis program extracts bib numbers from images.\n"
 			"Usage:\n"
-			"./bibnumber [-train dir] [-model svmModel.xml] image_file|folder_path|csv_ground_truth_file\n\n"
+			"./bibnumber [-train dir] [-pack album.pack] [-model svmModel.xml] [-ocrcache cacheFile] [-registry bibs.csv] [-budget ms] [-width px] [-jobs N] [-stages decode,detect,ocr] [-fulldecode] [-flush N] [-force] [-shards N] [-prefetch N] [-prefetchmb MB] [-metrics file.prom] [-trace trace.json] image_file|folder_path|csv_ground_truth_file|pack_file\n"
+			"./bibnumber -daemon socket_path [-model svmModel.xml] [-ocrcache cacheFile] [-registry bibs.csv] [-budget ms] [-width px] [-jobs N] [-fulldecode] [-queues interactive,bulk] [-aging ms] [-prefork N] [-metrics file.prom] [-trace trace.json]\n"
+			"./bibnumber -spool spool_dir [-model svmModel.xml] [-ocrcache cacheFile] [-registry bibs.csv] [-budget ms] [-width px] [-jobs N] [-stages decode,detect,ocr] [-fulldecode] [-prefetch N] [-prefetchmb MB] [-metrics file.prom] [-trace trace.json]\n"
+			"./bibnumber -connect socket_path [-bulk] image_file\n"
+			"./bibnumber -bench iterations\n"
+			"./bibnumber -scaling folder_path|csv_ground_truth_file [-threads 1,2,4] [-widths 800,1200] [-json scaling.json] [-model svmModel.xml] [-registry bibs.csv] [-budget ms] [-fulldecode]\n"
+			"./bibnumber -synth output_dir [-count N] [-size 2400x1600] [-bibs 1,8] [-angle degrees] [-blur sigma] [-noise sigma] [-background textured|crowd|mixed] [-seed N]\n\n"
 			<< endl;
 }
 
@@ -30,7 +65,21 @@ static void help() {
 int main(int argc, const char** argv) {
 	string inputName;
 	string trainDir;
-	string svmModel;
+	string packName;
+	string daemonSocket;
+	string connectSocket;
+	string spoolDir;
+	int benchIterations = 0;
+	string scalingCorpus;
+	vector<unsigned int> scalingThreads;
+	vector<int> scalingWidths;
+	string jsonFile;
+	string synthDir;
+	int synthCount = 100;
+	unsigned int synthSeed = 1;
+	synth::PhotoOptions photoOptions;
+	bool bulk = false;
+	batch::Options options;
 	int train = 0;
 
 	for (int i = 1; i < argc; i++) {
@@ -45,6 +94,16 @@ int main(int argc, const char** argv) {
 			train = 1;
 			trainDir.assign(argv[++i]);
 		}
+		else if (!strcmp(argv[i],"-pack"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -pack" << endl;
+				help();
+				return -1;
+			}
+			packName.assign(argv[++i]);
+		}
 		else if (!strcmp(argv[i],"-model"))
 		{
 			if ( (i>=(argc-1)) )
@@ -53,7 +112,472 @@ int main(int argc, const char** argv) {
 				help();
 				return -1;
 			}
-			svmModel.assign(argv[++i]);
+			options.svmModel.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-ocrcache"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -ocrcache" << endl;
+				help();
+				return -1;
+			}
+			options.ocrCacheFile.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-bench"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -bench" << endl;
+				help();
+				return -1;
+			}
+			benchIterations = atoi(argv[++i]);
+			if (benchIterations <= 0)
+			{
+				cerr << "ERROR: invalid parameter for -bench" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-scaling"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -scaling" << endl;
+				help();
+				return -1;
+			}
+			scalingCorpus.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-threads"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -threads" << endl;
+				help();
+				return -1;
+			}
+			if (!parseList(argv[++i], scalingThreads))
+			{
+				cerr << "ERROR: invalid parameter for -threads" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-widths"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -widths" << endl;
+				help();
+				return -1;
+			}
+			if (!parseList(argv[++i], scalingWidths))
+			{
+				cerr << "ERROR: invalid parameter for -widths" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-json"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -json" << endl;
+				help();
+				return -1;
+			}
+			jsonFile.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-synth"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -synth" << endl;
+				help();
+				return -1;
+			}
+			synthDir.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-count"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -count" << endl;
+				help();
+				return -1;
+			}
+			synthCount = atoi(argv[++i]);
+			if (synthCount <= 0)
+			{
+				cerr << "ERROR: invalid parameter for -count" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-size"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -size" << endl;
+				help();
+				return -1;
+			}
+			if ((sscanf(argv[++i], "%dx%d", &photoOptions.size.width,
+					&photoOptions.size.height) != 2)
+					|| (photoOptions.size.width < 64)
+					|| (photoOptions.size.height < 64))
+			{
+				cerr << "ERROR: invalid parameter for -size" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-bibs"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -bibs" << endl;
+				help();
+				return -1;
+			}
+			if ((sscanf(argv[++i], "%d,%d", &photoOptions.minBibs,
+					&photoOptions.maxBibs) != 2) || (photoOptions.minBibs < 0)
+					|| (photoOptions.maxBibs < photoOptions.minBibs))
+			{
+				cerr << "ERROR: invalid parameter for -bibs" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-angle"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -angle" << endl;
+				help();
+				return -1;
+			}
+			photoOptions.maxAngle = atof(argv[++i]);
+			if ((photoOptions.maxAngle < 0)
+					|| (photoOptions.maxAngle > SYNTH_MAX_ANGLE))
+			{
+				cerr << "ERROR: invalid parameter for -angle" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-blur"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -blur" << endl;
+				help();
+				return -1;
+			}
+			photoOptions.maxBlur = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-noise"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -noise" << endl;
+				help();
+				return -1;
+			}
+			photoOptions.noise = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-background"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -background" << endl;
+				help();
+				return -1;
+			}
+			const char *background = argv[++i];
+			if (!strcmp(background, "textured"))
+				photoOptions.background = synth::BACKGROUND_TEXTURED;
+			else if (!strcmp(background, "crowd"))
+				photoOptions.background = synth::BACKGROUND_CROWD;
+			else if (!strcmp(background, "mixed"))
+				photoOptions.background = synth::BACKGROUND_MIXED;
+			else
+			{
+				cerr << "ERROR: invalid parameter for -background" << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-seed"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -seed" << endl;
+				help();
+				return -1;
+			}
+			synthSeed = (unsigned int) strtoul(argv[++i], NULL, 10);
+		}
+		else if (!strcmp(argv[i],"-metrics"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -metrics" << endl;
+				help();
+				return -1;
+			}
+			options.metricsFile.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-trace"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -trace" << endl;
+				help();
+				return -1;
+			}
+			options.traceFile.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-registry"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -registry" << endl;
+				help();
+				return -1;
+			}
+			options.registryFile.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-budget"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -budget" << endl;
+				help();
+				return -1;
+			}
+			options.latencyBudgetMs = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-width"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -width" << endl;
+				help();
+				return -1;
+			}
+			int width = atoi(argv[++i]);
+			if (width <= 0)
+			{
+				cerr << "ERROR: invalid parameter for -width" << endl;
+				help();
+				return -1;
+			}
+			options.workingWidth = width;
+		}
+		else if (!strcmp(argv[i],"-jobs"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -jobs" << endl;
+				help();
+				return -1;
+			}
+			int jobs = atoi(argv[++i]);
+			if (jobs < 0)
+			{
+				cerr << "ERROR: invalid parameter for -jobs" << endl;
+				help();
+				return -1;
+			}
+			options.jobs = jobs;
+		}
+		else if (!strcmp(argv[i],"-fulldecode"))
+		{
+			options.reducedDecode = false;
+		}
+		else if (!strcmp(argv[i],"-shards"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -shards" << endl;
+				help();
+				return -1;
+			}
+			int shards = atoi(argv[++i]);
+			if (shards < 0)
+			{
+				cerr << "ERROR: invalid parameter for -shards" << endl;
+				help();
+				return -1;
+			}
+			options.shards = shards;
+		}
+		else if (!strcmp(argv[i],"-prefetch"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -prefetch" << endl;
+				help();
+				return -1;
+			}
+			int prefetchImages = atoi(argv[++i]);
+			if (prefetchImages < 0)
+			{
+				cerr << "ERROR: invalid parameter for -prefetch" << endl;
+				help();
+				return -1;
+			}
+			options.prefetchImages = prefetchImages;
+		}
+		else if (!strcmp(argv[i],"-prefetchmb"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -prefetchmb" << endl;
+				help();
+				return -1;
+			}
+			int prefetchMB = atoi(argv[++i]);
+			if (prefetchMB < 0)
+			{
+				cerr << "ERROR: invalid parameter for -prefetchmb" << endl;
+				help();
+				return -1;
+			}
+			options.prefetchMB = prefetchMB;
+		}
+		else if (!strcmp(argv[i],"-daemon"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -daemon" << endl;
+				help();
+				return -1;
+			}
+			daemonSocket.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-spool"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -spool" << endl;
+				help();
+				return -1;
+			}
+			spoolDir.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-connect"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -connect" << endl;
+				help();
+				return -1;
+			}
+			connectSocket.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-bulk"))
+		{
+			bulk = true;
+		}
+		else if (!strcmp(argv[i],"-queues"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -queues" << endl;
+				help();
+				return -1;
+			}
+			unsigned int interactiveQueue, bulkQueue;
+			if (sscanf(argv[++i], "%u,%u", &interactiveQueue, &bulkQueue) != 2)
+			{
+				cerr << "ERROR: invalid parameter for -queues" << endl;
+				help();
+				return -1;
+			}
+			options.interactiveQueue = interactiveQueue;
+			options.bulkQueue = bulkQueue;
+		}
+		else if (!strcmp(argv[i],"-aging"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -aging" << endl;
+				help();
+				return -1;
+			}
+			options.agingMs = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-prefork"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -prefork" << endl;
+				help();
+				return -1;
+			}
+			int workers = atoi(argv[++i]);
+			if (workers < 0)
+			{
+				cerr << "ERROR: invalid parameter for -prefork" << endl;
+				help();
+				return -1;
+			}
+			options.preforkWorkers = workers;
+		}
+		else if (!strcmp(argv[i],"-isolate"))
+		{
+			options.isolate = true;
+		}
+		else if (!strcmp(argv[i],"-manifest"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -manifest" << endl;
+				help();
+				return -1;
+			}
+			options.manifestFile.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-force"))
+		{
+			options.resume = false;
+		}
+		else if (!strcmp(argv[i],"-flush"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -flush" << endl;
+				help();
+				return -1;
+			}
+			int flushRecords = atoi(argv[++i]);
+			if (flushRecords < 0)
+			{
+				cerr << "ERROR: invalid parameter for -flush" << endl;
+				help();
+				return -1;
+			}
+			options.flushRecords = flushRecords;
+		}
+		else if (!strcmp(argv[i],"-stages"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -stages" << endl;
+				help();
+				return -1;
+			}
+			if (sscanf(argv[++i], "%u,%u,%u", &options.stages.decode,
+					&options.stages.detect, &options.stages.recognize) != 3)
+			{
+				cerr << "ERROR: invalid parameter for -stages" << endl;
+				help();
+				return -1;
+			}
 		}
 		else
 		{
@@ -61,22 +585,70 @@ int main(int argc, const char** argv) {
 		}
 	}
 
+	/* the daemon serves images sent by clients */
+	if (!daemonSocket.empty())
+	{
+		return server::run(daemonSocket, options);
+	}
+
+	/* the kernels are timed on synthetic scenes, no input is needed */
+	if (benchIterations > 0)
+	{
+		return bench::runKernels(benchIterations, cout);
+	}
+
+	/* the corpus is rendered, no input is needed */
+	if (!synthDir.empty())
+	{
+		return synth::writeCorpus(synthDir, synthCount, photoOptions, synthSeed);
+	}
+
+	/* the corpus is processed once per configuration of the sweep */
+	if (!scalingCorpus.empty())
+	{
+		return bench::runScaling(scalingCorpus, scalingThreads, scalingWidths,
+				jsonFile, options, cout);
+	}
+
+	/* the job runner processes the albums dropped into the spool directory */
+	if (!spoolDir.empty())
+	{
+		return spool::run(spoolDir, options);
+	}
+
 	if ((inputName.empty()) || (!inputName.size())) {
 		cerr << "ERROR: Missing parameter" << endl;
 		help();
 		return -1;
 	}
 
+	if (!connectSocket.empty())
+	{
+		return server::request(connectSocket, inputName, bulk);
+	}
+
+	/* workers started by the coordinator run unattended */
+	bool worker = batch::isShardFile(inputName);
+
 	if (train)
 	{
 		train::process(trainDir, inputName);
 	}
+	else if (!packName.empty())
+	{
+		pack::create(inputName, packName);
+	}
+	else if ((options.shards > 0) && (!worker))
+	{
+		batch::coordinate(inputName, options, argv[0]);
+	}
 	else
 	{
-		batch::process(inputName, svmModel);
+		batch::process(inputName, options);
 	}
 
-	system("pause");
+	if (!worker)
+		system("pause");
 
 	return 0;
 }
@@ -0,0 +1,142 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "deadline.h"
+
+namespace batch
+{
+	/// <summary>
+	/// Blocking FIFO queue of limited capacity connecting two stages of the batch
+	/// executor. Producers wait while the queue is full (backpressure), consumers
+	/// wait while it is empty. The time both sides spend waiting and the depth of
+	/// the queue are recorded to help sizing the stages.
+	/// </summary>
+	template<typename T>
+	class BoundedQueue {
+	public:
+		/// <summary>
+		/// Creates an empty queue.
+		/// </summary>
+		/// <param name="capacity">Maximum count of queued items, at least 1.</param>
+		BoundedQueue(size_t capacity) :
+				maxItems(capacity > 0 ? capacity : 1), closed(false), deepest(0),
+				depthSum(0), pushes(0), pushStall(0), popStall(0) {
+		}
+
+		/// <summary>
+		/// Appends an item, waits while the queue is full.
+		/// </summary>
+		/// <returns>false if the queue was closed and the item was not queued</returns>
+		bool push(const T &item) {
+			boost::unique_lock<boost::mutex> lock(mutex);
+			if ((items.size() >= maxItems) && (!closed)) {
+				int64 start = cv::getTickCount();
+				while ((items.size() >= maxItems) && (!closed))
+					notFull.wait(lock);
+				pushStall += latency::elapsedMs(start);
+			}
+			if (closed)
+				return false;
+
+			items.push_back(item);
+			pushes++;
+			depthSum += items.size();
+			if (items.size() > deepest)
+				deepest = items.size();
+			notEmpty.notify_one();
+			return true;
+		}
+
+		/// <summary>
+		/// Removes the oldest item, waits while the queue is empty.
+		/// </summary>
+		/// <returns>false if the queue is closed and empty</returns>
+		bool pop(T &item) {
+			boost::unique_lock<boost::mutex> lock(mutex);
+			if (items.empty() && (!closed)) {
+				int64 start = cv::getTickCount();
+				while (items.empty() && (!closed))
+					notEmpty.wait(lock);
+				popStall += latency::elapsedMs(start);
+			}
+			if (items.empty())
+				return false;
+
+			item = items.front();
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		/// <summary>
+		/// Closes the queue once all producers are done. Queued items can still be popped.
+		/// </summary>
+		void close() {
+			boost::lock_guard<boost::mutex> lock(mutex);
+			closed = true;
+			notEmpty.notify_all();
+			notFull.notify_all();
+		}
+
+		size_t capacity() const {
+			return maxItems;
+		}
+
+		/// <summary>
+		/// Gets the current count of queued items.
+		/// </summary>
+		size_t size() {
+			boost::lock_guard<boost::mutex> lock(mutex);
+			return items.size();
+		}
+
+		size_t maxDepth() {
+			boost::lock_guard<boost::mutex> lock(mutex);
+			return deepest;
+		}
+
+		/// <summary>
+		/// Gets the mean depth of the queue seen by the pushed items.
+		/// </summary>
+		double meanDepth() {
+			boost::lock_guard<boost::mutex> lock(mutex);
+			return pushes ? depthSum / pushes : 0;
+		}
+
+		/// <summary>
+		/// Gets the total time producers waited for free space.
+		/// </summary>
+		double pushStallMs() {
+			boost::lock_guard<boost::mutex> lock(mutex);
+			return pushStall;
+		}
+
+		/// <summary>
+		/// Gets the total time consumers waited for items.
+		/// </summary>
+		double popStallMs() {
+			boost::lock_guard<boost::mutex> lock(mutex);
+			return popStall;
+		}
+
+	private:
+		std::deque<T> items;
+		size_t maxItems;
+		bool closed;
+		boost::mutex mutex;
+		boost::condition_variable notFull;
+		boost::condition_variable notEmpty;
+		size_t deepest;
+		double depthSum;
+		size_t pushes;
+		double pushStall;
+		double popStall;
+	};
+}
+
+#endif /* #ifndef BOUNDEDQUEUE_H */
@@ -0,0 +1,80 @@
+#include <cfloat>
+
+#include "opencv2/core/core.hpp"
+
+#include "deadline.h"
+
+namespace latency {
+
+double elapsedMs(int64 start) {
+	return (double) (cv::getTickCount() - start) * 1000.
+			/ cv::getTickFrequency();
+}
+
+Deadline::Deadline(double budgetMs) :
+		start(cv::getTickCount()), budget(budgetMs), steps(DEGRADE_NONE) {
+}
+
+bool Deadline::limited() const {
+	return budget > 0;
+}
+
+double Deadline::budgetMs() const {
+	return budget;
+}
+
+double Deadline::elapsedMs() const {
+	return latency::elapsedMs(start);
+}
+
+double Deadline::remainingMs() const {
+	if (!limited())
+		return DBL_MAX;
+	return budget - elapsedMs();
+}
+
+bool Deadline::expired() const {
+	return limited() && (elapsedMs() >= budget);
+}
+
+void Deadline::resume(double spentMs) {
+	start = cv::getTickCount()
+			- (int64) (spentMs * cv::getTickFrequency() / 1000.);
+}
+
+void Deadline::degrade(Degradation step) {
+	steps |= step;
+}
+
+bool Deadline::checkpoint() {
+	if (truncated())
+		return true;
+	if (expired()) {
+		degrade(DEGRADE_TRUNCATED);
+		return true;
+	}
+	return false;
+}
+
+bool Deadline::truncated() const {
+	return (steps & DEGRADE_TRUNCATED) != 0;
+}
+
+int Deadline::degradation() const {
+	return steps;
+}
+
+std::string describeDegradation(int steps) {
+	std::string description;
+	if (steps & DEGRADE_SKIP_SMOOTHING)
+		description += " skip-smoothing";
+	if (steps & DEGRADE_LOWER_RESOLUTION)
+		description += " lower-resolution";
+	if (steps & DEGRADE_CAP_CHAINS)
+		description += " cap-chains";
+	if (steps & DEGRADE_TRUNCATED)
+		description += " truncated";
+	return description;
+}
+
+} /* namespace latency */
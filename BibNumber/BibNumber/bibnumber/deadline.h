@@ -0,0 +1,83 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+namespace latency
+{
+	/// <summary>
+	/// Degradation steps applied when an image runs over its latency budget,
+	/// in the order in which they are applied.
+	/// </summary>
+	enum Degradation {
+		DEGRADE_NONE = 0,
+		DEGRADE_SKIP_SMOOTHING = (1<<0), /* edge preserving smoothing is skipped */
+		DEGRADE_LOWER_RESOLUTION = (1<<1), /* working resolution is lowered */
+		DEGRADE_CAP_CHAINS = (1<<2), /* only some chains are passed to OCR */
+		DEGRADE_TRUNCATED = (1<<3) /* processing stopped, results are partial */
+	};
+
+	/// <summary>
+	/// Latency budget of one image. It is checked between pipeline stages and
+	/// inside the chain/OCR loops, and records which degradation steps were taken.
+	/// </summary>
+	class Deadline {
+	public:
+		/// <summary>
+		/// Starts the clock.
+		/// </summary>
+		/// <param name="budgetMs">The latency budget in milliseconds, 0 means unlimited.</param>
+		Deadline(double budgetMs = 0);
+
+		bool limited() const;
+		double budgetMs() const;
+		double elapsedMs() const;
+
+		/// <summary>
+		/// Gets the remaining budget, a very large value if the budget is unlimited.
+		/// </summary>
+		double remainingMs() const;
+
+		bool expired() const;
+
+		/// <summary>
+		/// Restarts the clock as if spentMs of the budget had already been used, so the
+		/// time an image waited between two stages is not charged to its budget.
+		/// The degradation steps taken so far are kept.
+		/// </summary>
+		void resume(double spentMs);
+
+		/// <summary>
+		/// Records a degradation step.
+		/// </summary>
+		void degrade(Degradation step);
+
+		/// <summary>
+		/// Checks the budget and marks the results as truncated if it is exhausted.
+		/// </summary>
+		/// <returns>true if processing needs to stop</returns>
+		bool checkpoint();
+
+		bool truncated() const;
+		int degradation() const;
+
+	private:
+		int64 start;
+		double budget;
+		int steps;
+	};
+
+	/// <summary>
+	/// Gets a human readable list of degradation steps.
+	/// </summary>
+	std::string describeDegradation(int steps);
+
+	/// <summary>
+	/// Gets the time elapsed since the tick count start in milliseconds.
+	/// </summary>
+	double elapsedMs(int64 start);
+}
+
+#endif /* #ifndef DEADLINE_H */
@@ -0,0 +1,377 @@
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include "opencv2/core/version.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+#ifdef BIB_HAVE_LIBJPEG
+#include <csetjmp>
+extern "C" {
+#include <jpeglib.h>
+}
+#endif
+
+#include "decode.h"
+
+/* JPEG markers */
+#define JPEG_MARKER (0xFF)
+#define JPEG_SOI (0xD8) /* start of image */
+#define JPEG_EOI (0xD9) /* end of image */
+#define JPEG_SOS (0xDA) /* start of scan, the frame header comes before */
+#define JPEG_TEM (0x01)
+#define JPEG_RST0 (0xD0)
+#define JPEG_RST7 (0xD7)
+#define JPEG_SOF0 (0xC0)
+#define JPEG_SOF15 (0xCF)
+#define JPEG_DHT (0xC4) /* in the SOFn range but not a frame header */
+#define JPEG_JPG (0xC8)
+#define JPEG_DAC (0xCC)
+#define JPEG_APP1 (0xE1) /* holds the EXIF data */
+
+/* EXIF orientation tag of the first image file directory */
+#define EXIF_ORIENTATION (0x0112)
+
+/* OpenCV 3.1 and later rotate decoded images by their EXIF orientation */
+#if defined(CV_MAJOR_VERSION) && ((CV_MAJOR_VERSION > 3) \
+		|| ((CV_MAJOR_VERSION == 3) && (CV_MINOR_VERSION >= 1)))
+#define BIB_DECODER_APPLIES_EXIF
+#endif
+
+/// <summary>
+/// Byte source reading a JPEG header from a file.
+/// </summary>
+class FileSource {
+public:
+	FileSource(std::istream &in) :
+			in(in) {
+	}
+	int get() {
+		return in.get();
+	}
+	void skip(int count) {
+		in.seekg(count, std::ios::cur);
+	}
+private:
+	std::istream &in;
+};
+
+/// <summary>
+/// Byte source reading a JPEG header from memory.
+/// </summary>
+class MemorySource {
+public:
+	MemorySource(const unsigned char *data, size_t length) :
+			data(data), length(length), pos(0) {
+	}
+	int get() {
+		return (pos < length) ? data[pos++] : EOF;
+	}
+	void skip(int count) {
+		pos += count;
+	}
+private:
+	const unsigned char *data;
+	size_t length;
+	size_t pos;
+};
+
+/// <summary>
+/// Reads a big endian 16 bit value.
+/// </summary>
+template<typename Source>
+static bool readWord(Source &in, int &value) {
+	int high = in.get();
+	int low = in.get();
+	if ((high == EOF) || (low == EOF))
+		return false;
+	value = (high << 8) | low;
+	return true;
+}
+
+/// <summary>
+/// Reads a 16 or 32 bit value of an EXIF block in its byte order.
+/// </summary>
+static unsigned int exifValue(const std::vector<unsigned char> &exif, size_t pos,
+		int bytes, bool bigEndian) {
+	unsigned int value = 0;
+	for (int i = 0; i < bytes; i++) {
+		int shift = 8 * (bigEndian ? (bytes - 1 - i) : i);
+		value |= (unsigned int) exif[pos + i] << shift;
+	}
+	return value;
+}
+
+/// <summary>
+/// Reads the orientation from the first image file directory of an APP1 segment.
+/// </summary>
+/// <param name="length">Length of the segment after its length field.</param>
+/// <returns>the orientation, 1 if the segment holds none</returns>
+template<typename Source>
+static int readExifOrientation(Source &file, int length) {
+	std::vector<unsigned char> exif(length);
+	for (int i = 0; i < length; i++) {
+		int c = file.get();
+		if (c == EOF)
+			return 1;
+		exif[i] = (unsigned char) c;
+	}
+
+	/* "Exif\0\0", then a TIFF header: byte order, 42 and the offset of the directory */
+	const size_t tiff = 6;
+	if ((exif.size() < tiff + 8) || (memcmp(&exif[0], "Exif\0\0", 6) != 0))
+		return 1;
+	bool bigEndian = (exif[tiff] == 'M');
+	if ((exif[tiff] != exif[tiff + 1]) || (!bigEndian && (exif[tiff] != 'I'))
+			|| (exifValue(exif, tiff + 2, 2, bigEndian) != 42))
+		return 1;
+	size_t directory = tiff + exifValue(exif, tiff + 4, 4, bigEndian);
+	if (directory + 2 > exif.size())
+		return 1;
+
+	/* entries of 12 bytes: tag, type, count and the value */
+	size_t entries = exifValue(exif, directory, 2, bigEndian);
+	for (size_t e = 0; e < entries; e++) {
+		size_t entry = directory + 2 + 12 * e;
+		if (entry + 12 > exif.size())
+			break;
+		if (exifValue(exif, entry, 2, bigEndian) == EXIF_ORIENTATION) {
+			int orientation = exifValue(exif, entry + 8, 2, bigEndian);
+			return ((orientation >= 1) && (orientation <= 8)) ? orientation : 1;
+		}
+	}
+	return 1;
+}
+
+/// <summary>
+/// Finds the frame header of a JPEG stream and reads the image size and, if
+/// orientation is not NULL, the EXIF orientation, which comes before the frame.
+/// </summary>
+template<typename Source>
+static bool readJpegSize(Source &file, int &width, int &height,
+		int *orientation) {
+	if (orientation != NULL)
+		*orientation = 1;
+	int c = file.get();
+	if ((c != JPEG_MARKER) || (file.get() != JPEG_SOI))
+		return false;
+
+	for (;;) {
+		/* find the next marker, skipping fill bytes */
+		c = file.get();
+		if (c == EOF)
+			return false;
+		if (c != JPEG_MARKER)
+			continue;
+		do {
+			c = file.get();
+		} while (c == JPEG_MARKER);
+		if (c == EOF)
+			return false;
+
+		/* markers without a segment */
+		if ((c == JPEG_SOI) || (c == JPEG_TEM) || (c == 0)
+				|| ((c >= JPEG_RST0) && (c <= JPEG_RST7)))
+			continue;
+		if ((c == JPEG_EOI) || (c == JPEG_SOS))
+			return false;
+
+		int length;
+		if (!readWord(file, length) || (length < 2))
+			return false;
+
+		if ((c >= JPEG_SOF0) && (c <= JPEG_SOF15) && (c != JPEG_DHT)
+				&& (c != JPEG_JPG) && (c != JPEG_DAC)) {
+			/* frame header: precision, height, width */
+			file.get();
+			return readWord(file, height) && readWord(file, width)
+					&& (width > 0) && (height > 0);
+		}
+
+		if ((c == JPEG_APP1) && (orientation != NULL)) {
+			*orientation = readExifOrientation(file, length - 2);
+			continue;
+		}
+
+		file.skip(length - 2);
+	}
+}
+
+#ifdef BIB_HAVE_LIBJPEG
+/// <summary>
+/// libjpeg error manager, which returns to the caller instead of exiting. It also
+/// holds the decoded image: a local changed after setjmp would be indeterminate
+/// after the longjmp, the members of an object whose address libjpeg holds are not.
+/// </summary>
+struct JpegError {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+	cv::Mat image;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+	JpegError *error = (JpegError *) cinfo->err;
+	longjmp(error->jump, 1);
+}
+
+/* memory source is available since libjpeg 8 and in libjpeg-turbo */
+#if (JPEG_LIB_VERSION >= 80) || defined(LIBJPEG_TURBO_VERSION) || defined(MEM_SRCDST_SUPPORTED)
+#define BIB_HAVE_JPEG_MEM_SRC
+#endif
+
+/// <summary>
+/// Decodes a JPEG file or memory buffer scaled by 1/denominator in the DCT domain with libjpeg.
+/// </summary>
+/// <param name="file">The file to read, NULL to read the memory buffer.</param>
+static cv::Mat readJpegScaled(FILE *file, const unsigned char *data,
+		size_t length, int denominator) {
+	struct jpeg_decompress_struct cinfo;
+	JpegError error;
+	cinfo.err = jpeg_std_error(&error.pub);
+	error.pub.error_exit = jpegErrorExit;
+	if (setjmp(error.jump)) {
+		jpeg_destroy_decompress(&cinfo);
+		error.image.release();
+		return cv::Mat();
+	}
+
+	jpeg_create_decompress(&cinfo);
+	if (file != NULL) {
+		jpeg_stdio_src(&cinfo, file);
+	} else {
+#ifdef BIB_HAVE_JPEG_MEM_SRC
+		jpeg_mem_src(&cinfo, (unsigned char *) data, (unsigned long) length);
+#else
+		jpeg_destroy_decompress(&cinfo);
+		return cv::Mat();
+#endif
+	}
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denominator;
+	cinfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	error.image.create(cinfo.output_height, cinfo.output_width, CV_8UC3);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = error.image.ptr(cinfo.output_scanline);
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+
+	cv::Mat image;
+	cv::cvtColor(error.image, image, CV_RGB2BGR);
+	return image;
+}
+#endif
+
+namespace decode {
+
+bool jpegSize(const std::string &fileName, int &width, int &height,
+		int *orientation) {
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	FileSource source(file);
+	return readJpegSize(source, width, height, orientation);
+}
+
+bool jpegSize(const unsigned char *data, size_t length, int &width,
+		int &height, int *orientation) {
+	MemorySource source(data, length);
+	return readJpegSize(source, width, height, orientation);
+}
+
+int decodedWidth(int width, int height, int orientation) {
+#ifdef BIB_DECODER_APPLIES_EXIF
+	/* orientations 5 to 8 transpose the image */
+	if (orientation >= 5)
+		return height;
+#endif
+	return width;
+}
+
+int reductionFactor(int width, int targetWidth) {
+	if (targetWidth <= 0)
+		return 1;
+	for (int factor = 8; factor > 1; factor /= 2) {
+		/* decoders round the reduced size up */
+		if ((width + factor - 1) / factor >= targetWidth)
+			return factor;
+	}
+	return 1;
+}
+
+cv::Mat readImage(const std::string &fileName, int targetWidth, double &scale) {
+	cv::Mat image;
+	scale = 1;
+
+	int width, height, orientation;
+	int factor = 1;
+	if ((targetWidth > 0) && jpegSize(fileName, width, height, &orientation))
+		factor = reductionFactor(decodedWidth(width, height, orientation),
+				targetWidth);
+
+	if (factor > 1) {
+#if defined(CV_MAJOR_VERSION) && (CV_MAJOR_VERSION >= 3)
+		int flags = (factor == 8) ? cv::IMREAD_REDUCED_COLOR_8 :
+				(factor == 4) ? cv::IMREAD_REDUCED_COLOR_4 :
+						cv::IMREAD_REDUCED_COLOR_2;
+		image = cv::imread(fileName, flags);
+#elif defined(BIB_HAVE_LIBJPEG)
+		FILE *file = fopen(fileName.c_str(), "rb");
+		if (file != NULL) {
+			image = readJpegScaled(file, NULL, 0, factor);
+			fclose(file);
+		}
+#endif
+		if (!image.empty()) {
+			scale = 1. / factor;
+			return image;
+		}
+	}
+
+	/* not reducible or no reduced decoder available */
+	return cv::imread(fileName, 1);
+}
+
+cv::Mat decodeImage(const unsigned char *data, size_t length, int targetWidth,
+		double &scale) {
+	cv::Mat image;
+	scale = 1;
+	if ((data == NULL) || (length == 0))
+		return image;
+
+	/* header only, the encoded bytes are not copied */
+	cv::Mat buffer(1, (int) length, CV_8UC1, (void *) data);
+
+	int width, height, orientation;
+	int factor = 1;
+	if ((targetWidth > 0) && jpegSize(data, length, width, height, &orientation))
+		factor = reductionFactor(decodedWidth(width, height, orientation),
+				targetWidth);
+
+	if (factor > 1) {
+#if defined(CV_MAJOR_VERSION) && (CV_MAJOR_VERSION >= 3)
+		int flags = (factor == 8) ? cv::IMREAD_REDUCED_COLOR_8 :
+				(factor == 4) ? cv::IMREAD_REDUCED_COLOR_4 :
+						cv::IMREAD_REDUCED_COLOR_2;
+		image = cv::imdecode(buffer, flags);
+#elif defined(BIB_HAVE_LIBJPEG)
+		image = readJpegScaled(NULL, data, length, factor);
+#endif
+		if (!image.empty()) {
+			scale = 1. / factor;
+			return image;
+		}
+	}
+
+	return cv::imdecode(buffer, 1);
+}
+
+} /* namespace decode */
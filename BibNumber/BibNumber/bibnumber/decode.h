@@ -0,0 +1,63 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+namespace decode
+{
+	/// <summary>
+	/// Reads the image size from the frame header of a JPEG file without decoding it.
+	/// </summary>
+	/// <param name="orientation">Set to the EXIF orientation (1 to 8, 1 if none) if not NULL.</param>
+	/// <returns>false if the file is not a JPEG file or the header could not be found</returns>
+	bool jpegSize(const std::string &fileName, int &width, int &height,
+		int *orientation = NULL);
+
+	/// <summary>
+	/// Reads the image size from the frame header of JPEG data held in memory.
+	/// </summary>
+	bool jpegSize(const unsigned char *data, size_t length, int &width, int &height,
+		int *orientation = NULL);
+
+	/// <summary>
+	/// Gets the width of a JPEG image once decoded: OpenCV 3.1 and later apply the
+	/// EXIF orientation, so a portrait photo stored sideways comes out as wide as the
+	/// stored height.
+	/// </summary>
+	int decodedWidth(int width, int height, int orientation);
+
+	/// <summary>
+	/// Gets the largest JPEG DCT scaling denominator (8, 4 or 2) which keeps the
+	/// decoded image at least as wide as the target width.
+	/// </summary>
+	/// <returns>the denominator, 1 if the image cannot be reduced</returns>
+	int reductionFactor(int width, int targetWidth);
+
+	/// <summary>
+	/// Reads a color image. JPEG images wider than the target width, once the EXIF
+	/// orientation is applied, are decoded at
+	/// 1/2, 1/4 or 1/8 of their size in the DCT domain, which skips most of the
+	/// decoding work and memory of large camera photos. Other images and JPEG images
+	/// which cannot be reduced are fully decoded.
+	/// </summary>
+	/// <param name="fileName">The image file.</param>
+	/// <param name="targetWidth">The width the image is processed at, 0 decodes the full image.</param>
+	/// <param name="scale">Set to the scale of the decoded image relative to the original image.</param>
+	/// <returns>the decoded BGR image, empty if the image could not be read</returns>
+	cv::Mat readImage(const std::string &fileName, int targetWidth, double &scale);
+
+	/// <summary>
+	/// Decodes an encoded image held in memory like readImage decodes a file.
+	/// The encoded data is neither copied nor modified.
+	/// </summary>
+	/// <param name="data">The encoded image (JPEG, PNG, ...).</param>
+	/// <param name="length">Length of the encoded image in bytes.</param>
+	/// <param name="targetWidth">The width the image is processed at, 0 decodes the full image.</param>
+	/// <param name="scale">Set to the scale of the decoded image relative to the original image.</param>
+	/// <returns>the decoded BGR image, empty if the image could not be decoded</returns>
+	cv::Mat decodeImage(const unsigned char *data, size_t length, int targetWidth, double &scale);
+}
+
+#endif /* #ifndef DECODE_H */
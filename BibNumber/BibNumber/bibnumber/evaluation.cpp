@@ -0,0 +1,163 @@
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "evaluation.h"
+#include "batch.h"
+#include "resultsink.h"
+
+namespace batch {
+
+EvaluationReport::EvaluationReport(size_t slowestCount) :
+		slowestCount(slowestCount), failed(0), decodeMs(0), detectMs(0),
+		smoothingMs(0), recognizeMs(0) {
+}
+
+void EvaluationReport::add(size_t index, const ImageResult &result) {
+	wallMs.push_back(result.wallMs);
+	double service = result.decodeMs + result.detectMs + result.recognizeMs;
+	serviceMs.push_back(service);
+	if (result.res < 0)
+		failed++;
+	decodeMs += result.decodeMs;
+	detectMs += result.detectMs;
+	smoothingMs += result.smoothingMs;
+	recognizeMs += result.recognizeMs;
+
+	if (slowestCount == 0)
+		return;
+	ImageTiming timing;
+	timing.index = index;
+	timing.image = result.image;
+	timing.wallMs = result.wallMs;
+	timing.serviceMs = service;
+	timing.decodeMs = result.decodeMs;
+	timing.detectMs = result.detectMs;
+	timing.smoothingMs = result.smoothingMs;
+	timing.recognizeMs = result.recognizeMs;
+	timing.components = result.components;
+	timing.chains = result.chains;
+	timing.failed = (result.res < 0);
+
+	/* the fastest of the kept images is at the front of the heap */
+	std::greater<ImageTiming> greater;
+	if (slowest.size() < slowestCount) {
+		slowest.push_back(timing);
+		std::push_heap(slowest.begin(), slowest.end(), greater);
+	} else if (timing.serviceMs > slowest.front().serviceMs) {
+		std::pop_heap(slowest.begin(), slowest.end(), greater);
+		slowest.back() = timing;
+		std::push_heap(slowest.begin(), slowest.end(), greater);
+	}
+}
+
+/// <summary>
+/// Gets a percentile of sorted values by the nearest rank method.
+/// </summary>
+double EvaluationReport::percentile(const std::vector<double> &sorted,
+		double p) const {
+	if (sorted.empty())
+		return 0;
+	size_t rank = (size_t) ceil(p / 100 * sorted.size());
+	return sorted[std::min(std::max(rank, (size_t) 1), sorted.size()) - 1];
+}
+
+/// <summary>
+/// Gets the kept images, slowest first.
+/// </summary>
+std::vector<EvaluationReport::ImageTiming> EvaluationReport::slowestImages() const {
+	std::vector<ImageTiming> images(slowest);
+	std::sort(images.begin(), images.end(), std::greater<ImageTiming>());
+	return images;
+}
+
+void EvaluationReport::print(std::ostream &out, double elapsedMs) const {
+	std::vector<double> sorted(wallMs);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<double> sortedService(serviceMs);
+	std::sort(sortedService.begin(), sortedService.end());
+	size_t n = std::max(wallMs.size(), (size_t) 1);
+
+	out << "Images: " << wallMs.size() << " failed=" << failed << " "
+			<< (elapsedMs > 0 ? wallMs.size() * 1000. / elapsedMs : 0)
+			<< " images/s" << std::endl;
+	out << "Wall time per image: p50=" << percentile(sorted, 50) << " p90="
+			<< percentile(sorted, 90) << " p99=" << percentile(sorted, 99)
+			<< " max=" << percentile(sorted, 100) << " ms" << std::endl;
+	out << "Service time per image: p50=" << percentile(sortedService, 50)
+			<< " p90=" << percentile(sortedService, 90) << " p99="
+			<< percentile(sortedService, 99) << " max="
+			<< percentile(sortedService, 100) << " ms" << std::endl;
+	out << "Stage time per image: decode=" << decodeMs / n << " detect="
+			<< detectMs / n << " (smoothing=" << smoothingMs / n
+			<< ") recognize=" << recognizeMs / n << " ms" << std::endl;
+
+	std::vector<ImageTiming> images = slowestImages();
+	for (size_t i = 0; i < images.size(); i++) {
+		out << "Slow " << images[i].serviceMs << " ms: " << images[i].image
+				<< " components=" << images[i].components << " chains="
+				<< images[i].chains << " decode=" << images[i].decodeMs
+				<< " detect=" << images[i].detectMs << " recognize="
+				<< images[i].recognizeMs << " wall=" << images[i].wallMs
+				<< (images[i].failed ? " failed" : "") << std::endl;
+	}
+}
+
+int EvaluationReport::write(const std::string &fileName, const Score &score,
+		double elapsedMs) const {
+	std::ofstream file(fileName.c_str());
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write report " << fileName << std::endl;
+		return -1;
+	}
+
+	std::vector<double> sorted(wallMs);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<double> sortedService(serviceMs);
+	std::sort(sortedService.begin(), sortedService.end());
+	size_t n = std::max(wallMs.size(), (size_t) 1);
+	int found = score.truePositives + score.falsePositives;
+	double precision = found > 0 ? (double) score.truePositives / found : 0;
+	double recall = score.relevant > 0 ?
+			(double) score.truePositives / score.relevant : 0;
+	double fscore = (precision + recall) > 0 ?
+			2 * precision * recall / (precision + recall) : 0;
+
+	file << "{\"images\":" << wallMs.size() << ",\"failed\":" << failed
+			<< ",\"elapsedMs\":" << elapsedMs << ",\"imagesPerSecond\":"
+			<< (elapsedMs > 0 ? wallMs.size() * 1000. / elapsedMs : 0) << ",\n";
+	file << " \"accuracy\":{\"truePositives\":" << score.truePositives
+			<< ",\"falsePositives\":" << score.falsePositives
+			<< ",\"relevant\":" << score.relevant << ",\"precision\":"
+			<< precision << ",\"recall\":" << recall << ",\"fscore\":"
+			<< fscore << "},\n";
+	file << " \"wallMs\":{\"p50\":" << percentile(sorted, 50) << ",\"p90\":"
+			<< percentile(sorted, 90) << ",\"p99\":" << percentile(sorted, 99)
+			<< ",\"max\":" << percentile(sorted, 100) << "},\n";
+	file << " \"serviceMs\":{\"p50\":" << percentile(sortedService, 50)
+			<< ",\"p90\":" << percentile(sortedService, 90) << ",\"p99\":"
+			<< percentile(sortedService, 99) << ",\"max\":"
+			<< percentile(sortedService, 100) << "},\n";
+	file << " \"stageMs\":{\"decode\":" << decodeMs / n << ",\"detect\":"
+			<< detectMs / n << ",\"smoothing\":" << smoothingMs / n
+			<< ",\"recognize\":" << recognizeMs / n << "},\n";
+	file << " \"slowest\":[";
+	std::vector<ImageTiming> images = slowestImages();
+	for (size_t i = 0; i < images.size(); i++) {
+		file << (i > 0 ? ",\n  " : "\n  ") << "{\"index\":" << images[i].index
+				<< ",\"image\":\"" << results::escapeJson(images[i].image)
+				<< "\",\"wallMs\":" << images[i].wallMs << ",\"serviceMs\":"
+				<< images[i].serviceMs << ",\"decodeMs\":"
+				<< images[i].decodeMs << ",\"detectMs\":" << images[i].detectMs
+				<< ",\"smoothingMs\":" << images[i].smoothingMs
+				<< ",\"recognizeMs\":" << images[i].recognizeMs
+				<< ",\"components\":" << images[i].components << ",\"chains\":"
+				<< images[i].chains << ",\"failed\":"
+				<< (images[i].failed ? "true" : "false") << "}";
+	}
+	file << "]}" << std::endl;
+	return file.good() ? 0 : -1;
+}
+
+} /* namespace batch */
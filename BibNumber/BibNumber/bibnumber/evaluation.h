@@ -0,0 +1,83 @@
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "executor.h"
+
+/* count of slowest images listed in the evaluation report */
+#define SLOWEST_IMAGES (10)
+
+namespace batch
+{
+	struct Score;
+
+	/// <summary>
+	/// Speed of a ground truth evaluation: percentiles of the wall time and of the
+	/// service time per image, mean time per pipeline stage and the slowest images
+	/// with their component and chain counts. The wall time includes the waits in
+	/// the queues of the executor, so images are ranked by their service time, the
+	/// sum of their stage times. The report is printed after the F-score and written as JSON, so
+	/// an accuracy change comes with its throughput impact.
+	/// </summary>
+	class EvaluationReport {
+	public:
+		/// <param name="slowestCount">Count of slowest images to keep.</param>
+		EvaluationReport(size_t slowestCount = SLOWEST_IMAGES);
+
+		/// <summary>
+		/// Adds the timing of an image processed by the executor.
+		/// </summary>
+		void add(size_t index, const ImageResult &result);
+
+		/// <summary>
+		/// Prints the human readable summary.
+		/// </summary>
+		/// <param name="elapsedMs">Wall time of the whole evaluation.</param>
+		void print(std::ostream &out, double elapsedMs) const;
+
+		/// <summary>
+		/// Writes the report with the accuracy of the evaluation as JSON.
+		/// </summary>
+		/// <param name="elapsedMs">Wall time of the whole evaluation.</param>
+		/// <returns>0 if no error occured</returns>
+		int write(const std::string &fileName, const Score &score,
+				double elapsedMs) const;
+
+	private:
+		struct ImageTiming {
+			size_t index;
+			std::string image;
+			double wallMs;
+			double serviceMs; /* decode, detect and recognize time */
+			double decodeMs;
+			double detectMs;
+			double smoothingMs;
+			double recognizeMs;
+			size_t components;
+			size_t chains;
+			bool failed;
+
+			bool operator>(const ImageTiming &other) const {
+				return serviceMs > other.serviceMs;
+			}
+		};
+
+		double percentile(const std::vector<double> &sorted, double p) const;
+		std::vector<ImageTiming> slowestImages() const;
+
+		size_t slowestCount;
+		std::vector<double> wallMs; /* wall time of every image */
+		std::vector<double> serviceMs; /* service time of every image */
+		std::vector<ImageTiming> slowest; /* min-heap of the slowest images */
+		size_t failed;
+		double decodeMs;
+		double detectMs;
+		double smoothingMs;
+		double recognizeMs;
+	};
+}
+
+#endif /* #ifndef EVALUATION_H */
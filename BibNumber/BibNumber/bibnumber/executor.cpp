@@ -0,0 +1,489 @@
+#include <sstream>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "executor.h"
+#include "batch.h"
+#include "decode.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+/* count of images processed one by one to measure the stage times */
+#define CALIBRATION_IMAGES (3)
+/* queued images per consumer thread */
+#define QUEUE_DEPTH_PER_THREAD (2)
+
+namespace fs = boost::filesystem;
+
+static const char *stageNames[] = { "decode", "detect", "recognize" };
+
+namespace batch {
+
+ImageResult::ImageResult() :
+		reused(false), res(-1), degradation(latency::DEGRADE_NONE), done(false),
+		wallMs(0), decodeMs(0), detectMs(0), smoothingMs(0), recognizeMs(0),
+		components(0), chains(0) {
+}
+
+StageThreads::StageThreads() :
+		decode(0), detect(0), recognize(0) {
+}
+
+void balanceStages(StageThreads &threads, const double stageMs[3],
+		unsigned int totalThreads) {
+	unsigned int *stageThreads[3] = { &threads.decode, &threads.detect,
+			&threads.recognize };
+	double totalMs = 0;
+	for (int stage = 0; stage < 3; stage++) {
+		if (*stageThreads[stage] == 0)
+			totalMs += stageMs[stage];
+	}
+	for (int stage = 0; stage < 3; stage++) {
+		if (*stageThreads[stage] != 0)
+			continue;
+		double share = (totalMs > 0) ? (stageMs[stage] / totalMs) : (1. / 3);
+		*stageThreads[stage] = std::max(1, cvRound(share * totalThreads));
+	}
+}
+
+/// <summary>
+/// Image passed between the stages.
+/// </summary>
+struct StagedExecutor::Job {
+	Job() :
+			index(0), start(0), decodeScale(1) {
+	}
+	size_t index;
+	int64 start; /* ticks when the image was taken from the source */
+	SourceImage source; /* the image, in memory if the source holds it */
+	cv::Mat image; /* decoded image, released after detection */
+	double decodeScale; /* scale of the decoded image relative to the photo */
+	pipeline::Detection detection; /* released after recognition */
+	std::ostringstream out;
+	std::ostringstream err;
+	ImageResult result;
+};
+
+StagedExecutor::StagedExecutor(ImageSource &source,
+		const Options &options,
+		boost::ptr_vector<pipeline::Pipeline> &pipelines,
+		unsigned int totalThreads,
+		manifest::Manifest *manifest) :
+		source(source), manifest(manifest), svmModel(options.svmModel),
+		decodeWidth(options.reducedDecode ? options.workingWidth : 0),
+		next(0), sourceDone(false), nReused(0) {
+	for (int stage = 0; stage < STAGE_COUNT; stage++) {
+		nThreads[stage] = 0;
+		running[stage] = 0;
+		busyMs[stage] = 0;
+		processed[stage] = 0;
+	}
+	if (pipelines.empty()) {
+		sourceDone = true;
+		return;
+	}
+
+	StageThreads stageThreads(options.stages);
+	if ((!stageThreads.decode) || (!stageThreads.detect)
+			|| (!stageThreads.recognize)) {
+		calibrate(CALIBRATION_IMAGES, pipelines[0], stageThreads, totalThreads);
+		if (sourceDone)
+			return;
+	}
+
+	/* detection worker k and OCR worker k share pipeline k */
+	nThreads[STAGE_DECODE] = stageThreads.decode;
+	nThreads[STAGE_DETECT] = std::min(stageThreads.detect, (unsigned int) pipelines.size());
+	nThreads[STAGE_RECOGNIZE] = std::min(stageThreads.recognize, (unsigned int) pipelines.size());
+	for (int stage = 0; stage < STAGE_COUNT; stage++)
+		running[stage] = nThreads[stage];
+
+	detectQueue.reset(new BoundedQueue<JobPtr>(
+			QUEUE_DEPTH_PER_THREAD * nThreads[STAGE_DETECT]));
+	recognizeQueue.reset(new BoundedQueue<JobPtr>(
+			QUEUE_DEPTH_PER_THREAD * nThreads[STAGE_RECOGNIZE]));
+
+	for (unsigned int k = 0; k < nThreads[STAGE_RECOGNIZE]; k++) {
+		workers.create_thread(
+				boost::bind(&StagedExecutor::recognizeWorker, this, &pipelines[k]));
+	}
+	for (unsigned int k = 0; k < nThreads[STAGE_DETECT]; k++) {
+		workers.create_thread(
+				boost::bind(&StagedExecutor::detectWorker, this, &pipelines[k]));
+	}
+	for (unsigned int k = 0; k < nThreads[STAGE_DECODE]; k++) {
+		workers.create_thread(boost::bind(&StagedExecutor::decodeWorker, this));
+	}
+}
+
+StagedExecutor::~StagedExecutor() {
+	workers.join_all();
+}
+
+/// <summary>
+/// Takes the next image of the source.
+/// </summary>
+/// <returns>false if the source has no more images</returns>
+bool StagedExecutor::nextJob(Job &job) {
+	{
+		/* the source may wait for a read, which must not block finishing images */
+		boost::lock_guard<boost::mutex> sourceLock(sourceMutex);
+		bool done;
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			done = sourceDone;
+		}
+		if (!done) {
+			done = !source.next(job.source);
+			boost::lock_guard<boost::mutex> lock(mutex);
+			sourceDone = done;
+			if (!done) {
+				job.index = next++;
+				job.start = cv::getTickCount();
+				return true;
+			}
+		}
+	}
+
+	/* waiters for images past the end can return */
+	finished.notify_all();
+	return false;
+}
+
+/// <summary>
+/// Processes the first images one by one and splits the threads between the stages
+/// which are not set in proportion to the measured stage times. Images reused from
+/// the previous run count toward the images of the calibration, so an unchanged
+/// album is not read and hashed one image at a time; when none of them was
+/// processed, the threads are split evenly.
+/// </summary>
+void StagedExecutor::calibrate(size_t count, pipeline::Pipeline &pipeline,
+		StageThreads &threads, unsigned int totalThreads) {
+	double stageMs[STAGE_COUNT] = { 0, 0, 0 };
+	size_t measured = 0;
+	for (size_t taken = 0; taken < count; taken++) {
+		Job job;
+		if (!nextJob(job))
+			break;
+
+		int64 start = cv::getTickCount();
+		bool ok;
+		{
+			trace::Span span("decode", "image", job.index);
+			ok = decode(job);
+		}
+		if (job.result.reused) {
+			finish(job);
+			continue;
+		}
+		measured++;
+		job.result.decodeMs = recordBusy(STAGE_DECODE, start);
+		stageMs[STAGE_DECODE] += job.result.decodeMs;
+		if (ok) {
+			start = cv::getTickCount();
+			trace::Span span("detect", "image", job.index);
+			ok = detect(job, pipeline);
+			job.result.detectMs = recordBusy(STAGE_DETECT, start);
+			stageMs[STAGE_DETECT] += job.result.detectMs;
+		}
+		if (ok) {
+			start = cv::getTickCount();
+			trace::Span span("recognize", "image", job.index);
+			recognize(job, pipeline);
+			job.result.recognizeMs = recordBusy(STAGE_RECOGNIZE, start);
+			stageMs[STAGE_RECOGNIZE] += job.result.recognizeMs;
+		}
+		finish(job);
+	}
+	balanceStages(threads, stageMs, totalThreads);
+
+	std::cout << "Stage threads: decode=" << threads.decode << " detect="
+			<< threads.detect << " recognize=" << threads.recognize;
+	if (measured == 0) {
+		std::cout << " (no image processed, split evenly)" << std::endl;
+		return;
+	}
+	std::cout << " (measured " << stageMs[STAGE_DECODE] / measured << "/"
+			<< stageMs[STAGE_DETECT] / measured << "/"
+			<< stageMs[STAGE_RECOGNIZE] / measured << " ms per image)" << std::endl;
+}
+
+/// <summary>
+/// Adds the time since start to the busy time of the stage.
+/// </summary>
+/// <returns>the time since start</returns>
+double StagedExecutor::recordBusy(Stage stage, int64 start) {
+	double ms = latency::elapsedMs(start);
+	/* detection and recognition are recorded by the pipeline */
+	if (stage == STAGE_DECODE)
+		metrics::observe(metrics::STAGE_DECODE, ms);
+	boost::lock_guard<boost::mutex> lock(mutex);
+	busyMs[stage] += ms;
+	processed[stage]++;
+	return ms;
+}
+
+/// <summary>
+/// Copies the results of the previous run if the image did not change.
+/// </summary>
+/// <returns>true if the results were reused</returns>
+bool StagedExecutor::reuse(Job &job) {
+	results::ImageRecord previous;
+	if (!manifest->lookup(job.result.image, job.result.hash, previous))
+		return false;
+
+	job.result.reused = true;
+	job.result.res = 0;
+	job.result.bibNumbers.swap(previous.bibNumbers);
+	job.result.degradation = previous.degradation;
+	job.out << "Unchanged since the last run" << std::endl;
+	printResult(job.result.bibNumbers, job.result.degradation, job.out);
+	return true;
+}
+
+/// <summary>
+/// Reads and decodes the image of the job. With a manifest, the image is hashed and
+/// the results of the previous run are reused if it did not change.
+/// </summary>
+/// <returns>false if the image could not be opened or was reused, the job is then finished</returns>
+bool StagedExecutor::decode(Job &job) {
+	std::string fileName = job.source.path.string();
+	job.result.image = fileName;
+	job.out << "Processing file " << fileName << std::endl;
+
+	try {
+		/* images of a pack are in memory, files are read once for hashing and decoding */
+		std::vector<unsigned char> data;
+		const unsigned char *encoded = job.source.data;
+		size_t length = job.source.length;
+		if ((encoded == NULL) && (manifest != NULL)
+				&& manifest::readFile(fileName, data) && !data.empty()) {
+			encoded = &data[0];
+			length = data.size();
+		}
+
+		if ((manifest != NULL) && (encoded != NULL)) {
+			job.result.hash = job.source.hash;
+			if (job.result.hash.empty()) {
+				job.result.hash = manifest::formatHash(
+						manifest::hashBytes(encoded, length));
+			}
+			if (reuse(job))
+				return false;
+		}
+
+		if (encoded != NULL) {
+			job.image = decode::decodeImage(encoded, length, decodeWidth,
+					job.decodeScale);
+		} else if (manifest == NULL) {
+			job.image = decode::readImage(fileName, decodeWidth, job.decodeScale);
+		}
+	} catch (std::exception &e) {
+		job.err << "ERROR: " << e.what() << std::endl;
+	}
+
+	/* encoded data read ahead is not needed once decoded */
+	job.source.buffer.reset();
+	job.source.data = NULL;
+
+	if (job.image.empty()) {
+		job.err << "ERROR:Failed to open image file" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Detects text chains in the decoded image of the job.
+/// </summary>
+/// <returns>false if detection failed, the job is then finished</returns>
+bool StagedExecutor::detect(Job &job, pipeline::Pipeline &pipeline) {
+	int res = -1;
+	try {
+		res = pipeline.detect(job.image, svmModel, job.detection, job.decodeScale);
+	} catch (std::exception &e) {
+		job.err << "ERROR: " << e.what() << std::endl;
+	}
+	job.image.release();
+	job.result.smoothingMs = job.detection.stats.smoothingMs;
+	job.result.components = job.detection.stats.components;
+	job.result.chains = job.detection.chains.size();
+	if (res < 0) {
+		job.err << "ERROR: Could not process image" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Recognizes the bib numbers of the detected chains of the job.
+/// </summary>
+void StagedExecutor::recognize(Job &job, pipeline::Pipeline &pipeline) {
+	int res = -1;
+	try {
+		res = pipeline.recognize(job.detection, svmModel, job.result.bibNumbers);
+	} catch (std::exception &e) {
+		job.err << "ERROR: " << e.what() << std::endl;
+	}
+	if (res < 0) {
+		job.err << "ERROR: Could not process image" << std::endl;
+	} else {
+		job.result.degradation = job.detection.deadline.degradation();
+		printResult(job.result.bibNumbers, job.result.degradation, job.out);
+	}
+	job.result.res = res;
+	job.detection = pipeline::Detection();
+}
+
+/// <summary>
+/// Publishes the result of the job.
+/// </summary>
+void StagedExecutor::finish(Job &job) {
+	job.result.output = job.out.str();
+	job.result.errors = job.err.str();
+	job.result.done = true;
+	job.result.wallMs = latency::elapsedMs(job.start);
+	metrics::observe(metrics::STAGE_IMAGE, job.result.wallMs);
+	metrics::increment(metrics::COUNTER_IMAGES);
+	if (job.result.res < 0)
+		metrics::increment(metrics::COUNTER_IMAGE_ERRORS);
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		if (job.result.reused)
+			nReused++;
+		std::swap(results[job.index], job.result);
+	}
+	finished.notify_all();
+}
+
+void StagedExecutor::decodeWorker() {
+	for (;;) {
+		JobPtr job(new Job());
+		if (!nextJob(*job))
+			break;
+
+		int64 start = cv::getTickCount();
+		bool ok;
+		{
+			trace::Span span("decode", "image", job->index);
+			biblog::Scope imageScope(biblog::FIELD_IMAGE, job->index);
+			biblog::Scope stageScope("decode");
+			ok = decode(*job);
+		}
+		biblog::flush();
+		job->result.decodeMs = recordBusy(STAGE_DECODE, start);
+		if (!ok || !detectQueue->push(job))
+			finish(*job);
+		metrics::set(metrics::GAUGE_DETECT_QUEUE, detectQueue->size());
+	}
+
+	/* the last decoder closes the queue of the detection stage */
+	bool last;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		last = (--running[STAGE_DECODE] == 0);
+	}
+	if (last)
+		detectQueue->close();
+}
+
+void StagedExecutor::detectWorker(pipeline::Pipeline *pipeline) {
+	JobPtr job;
+	while (detectQueue->pop(job)) {
+		metrics::set(metrics::GAUGE_DETECT_QUEUE, detectQueue->size());
+		int64 start = cv::getTickCount();
+		bool ok;
+		{
+			trace::Span span("detect", "image", job->index);
+			biblog::Scope imageScope(biblog::FIELD_IMAGE, job->index);
+			biblog::Scope stageScope("detect");
+			ok = detect(*job, *pipeline);
+		}
+		biblog::flush();
+		job->result.detectMs = recordBusy(STAGE_DETECT, start);
+		if (!ok || !recognizeQueue->push(job))
+			finish(*job);
+		metrics::set(metrics::GAUGE_RECOGNIZE_QUEUE, recognizeQueue->size());
+		job.reset();
+	}
+
+	/* the last detection worker closes the queue of the OCR stage */
+	bool last;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		last = (--running[STAGE_DETECT] == 0);
+	}
+	if (last)
+		recognizeQueue->close();
+}
+
+void StagedExecutor::recognizeWorker(pipeline::Pipeline *pipeline) {
+	JobPtr job;
+	while (recognizeQueue->pop(job)) {
+		metrics::set(metrics::GAUGE_RECOGNIZE_QUEUE, recognizeQueue->size());
+		int64 start = cv::getTickCount();
+		{
+			trace::Span span("recognize", "image", job->index);
+			biblog::Scope imageScope(biblog::FIELD_IMAGE, job->index);
+			biblog::Scope stageScope("recognize");
+			recognize(*job, *pipeline);
+		}
+		biblog::flush();
+		job->result.recognizeMs = recordBusy(STAGE_RECOGNIZE, start);
+		finish(*job);
+		job.reset();
+	}
+}
+
+bool StagedExecutor::wait(size_t index, ImageResult &result) {
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		std::map<size_t, ImageResult>::iterator it;
+		while ((it = results.find(index)) == results.end()) {
+			if (sourceDone && (index >= next))
+				return false;
+			finished.wait(lock);
+		}
+		std::swap(result, it->second);
+		results.erase(it);
+	}
+
+	std::cout << result.output;
+	std::cerr << result.errors;
+	std::string().swap(result.output);
+	std::string().swap(result.errors);
+	return true;
+}
+
+size_t StagedExecutor::reused() {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	return nReused;
+}
+
+void StagedExecutor::printStats(std::ostream &out) {
+	workers.join_all();
+
+	for (int stage = 0; stage < STAGE_COUNT; stage++) {
+		out << "Stage " << stageNames[stage] << ": threads=" << nThreads[stage]
+				<< " images=" << processed[stage] << " busy=" << busyMs[stage]
+				<< " ms" << std::endl;
+	}
+
+	BoundedQueue<JobPtr> *queues[] = { detectQueue.get(), recognizeQueue.get() };
+	for (int q = 0; q < 2; q++) {
+		if (queues[q] == NULL)
+			continue;
+		out << "Queue " << stageNames[q + 1] << ": capacity="
+				<< queues[q]->capacity() << " max depth="
+				<< queues[q]->maxDepth() << " mean depth="
+				<< queues[q]->meanDepth() << " producer stall="
+				<< queues[q]->pushStallMs() << " ms consumer stall="
+				<< queues[q]->popStallMs() << " ms" << std::endl;
+	}
+}
+
+} /* namespace batch */
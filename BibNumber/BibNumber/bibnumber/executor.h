@@ -0,0 +1,167 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "pipeline.h"
+#include "boundedqueue.h"
+#include "imagesource.h"
+#include "manifest.h"
+
+namespace batch
+{
+	struct Options;
+
+	/// <summary>
+	/// Result of one image processed by the executor.
+	/// </summary>
+	struct ImageResult {
+		ImageResult();
+		std::string image; /* path of the image */
+		std::string hash; /* content hash of the image, empty without manifest */
+		bool reused; /* results were copied from the previous run */
+		int res;
+		std::vector<int> bibNumbers;
+		int degradation; /* latency::Degradation steps taken for the image */
+		std::string output; /* buffered standard output of the image */
+		std::string errors; /* buffered error output of the image */
+		bool done;
+		double wallMs; /* from taking the image from the source to its result */
+		double decodeMs;
+		double detectMs;
+		double smoothingMs; /* part of detectMs */
+		double recognizeMs;
+		size_t components; /* connected components found by the detection */
+		size_t chains; /* text chains found by the detection */
+	};
+
+	/// <summary>
+	/// Thread counts of the executor stages, 0 means balanced automatically.
+	/// </summary>
+	struct StageThreads {
+		StageThreads();
+		unsigned int decode; /* image reading and JPEG decoding */
+		unsigned int detect; /* text detection */
+		unsigned int recognize; /* OCR */
+	};
+
+	/// <summary>
+	/// Splits threads between the stages whose count is not set, in proportion to
+	/// their times per image. Each of these stages gets at least one thread.
+	/// </summary>
+	/// <param name="threads">The thread counts, the ones which are 0 are set.</param>
+	/// <param name="stageMs">Times of the decode, detect and recognize stages per image.</param>
+	/// <param name="totalThreads">Count of threads split between the stages which are not set.</param>
+	void balanceStages(StageThreads &threads, const double stageMs[3],
+			unsigned int totalThreads);
+
+	/// <summary>
+	/// Processes a list of images in three stages: decoder threads read and decode the
+	/// images, detection workers find text chains and OCR workers run Tesseract. The
+	/// stages are connected by bounded queues, so a fast stage waits for a slow one
+	/// instead of piling up decoded images. Decoders take the next image from the source
+	/// when they are done with the previous one and results are collected in input
+	/// order, which keeps the output deterministic. Results are released once collected,
+	/// so memory does not grow with the count of images.
+	/// </summary>
+	class StagedExecutor {
+	public:
+		/// <summary>
+		/// Starts the stages. When the thread counts are not given, the first images are
+		/// processed one by one to measure the stage times, and the threads are split
+		/// between the stages in proportion to them.
+		/// </summary>
+		/// <param name="source">The images to process, read by the decoder threads.</param>
+		/// <param name="options">The batch options, with the SVM model, decoding and stage thread counts.</param>
+		/// <param name="pipelines">The pipelines, detection worker k and OCR worker k share pipeline k.</param>
+		/// <param name="totalThreads">Count of threads split between the stages which are balanced automatically.</param>
+		/// <param name="manifest">Results of the previous run, images are hashed and unchanged ones are not processed again. NULL processes all images.</param>
+		StagedExecutor(ImageSource &source,
+				const Options &options,
+				boost::ptr_vector<pipeline::Pipeline> &pipelines,
+				unsigned int totalThreads,
+				manifest::Manifest *manifest = NULL);
+
+		/// <summary>
+		/// Waits for the workers to finish.
+		/// </summary>
+		~StagedExecutor();
+
+		/// <summary>
+		/// Waits until the image is processed, prints its buffered output and hands
+		/// over its result.
+		/// </summary>
+		/// <param name="index">Index of the image in the order of the source.</param>
+		/// <param name="result">Set to the result of the image.</param>
+		/// <returns>false if the source has less images</returns>
+		bool wait(size_t index, ImageResult &result);
+
+		/// <summary>
+		/// Gets the count of images whose results were copied from the previous run.
+		/// </summary>
+		size_t reused();
+
+		/// <summary>
+		/// Waits for the workers and prints thread counts, busy times, queue depths
+		/// and stall times of the stages.
+		/// </summary>
+		void printStats(std::ostream &out);
+
+	private:
+		struct Job;
+		typedef boost::shared_ptr<Job> JobPtr;
+
+		enum Stage {
+			STAGE_DECODE = 0,
+			STAGE_DETECT,
+			STAGE_RECOGNIZE,
+			STAGE_COUNT
+		};
+
+		bool reuse(Job &job);
+		bool decode(Job &job);
+		bool detect(Job &job, pipeline::Pipeline &pipeline);
+		void recognize(Job &job, pipeline::Pipeline &pipeline);
+		void finish(Job &job);
+		bool nextJob(Job &job);
+		void calibrate(size_t count, pipeline::Pipeline &pipeline,
+				StageThreads &threads, unsigned int totalThreads);
+		double recordBusy(Stage stage, int64 start);
+		void decodeWorker();
+		void detectWorker(pipeline::Pipeline *pipeline);
+		void recognizeWorker(pipeline::Pipeline *pipeline);
+
+		ImageSource &source;
+		manifest::Manifest *manifest;
+		std::string svmModel;
+		int decodeWidth; /* images are decoded at least this wide, 0 decodes the full image */
+		std::map<size_t, ImageResult> results; /* finished images not collected yet */
+		size_t next; /* index of the next image to decode */
+		bool sourceDone; /* all images of the source were taken */
+		size_t nReused;
+		unsigned int nThreads[STAGE_COUNT];
+		unsigned int running[STAGE_COUNT]; /* workers of the stage still running */
+		double busyMs[STAGE_COUNT];
+		size_t processed[STAGE_COUNT];
+		boost::scoped_ptr<BoundedQueue<JobPtr> > detectQueue;
+		boost::scoped_ptr<BoundedQueue<JobPtr> > recognizeQueue;
+		boost::mutex sourceMutex; /* serializes taking images, held before mutex */
+		boost::mutex mutex;
+		boost::condition_variable finished;
+		boost::thread_group workers;
+	};
+}
+
+#endif /* #ifndef EXECUTOR_H */
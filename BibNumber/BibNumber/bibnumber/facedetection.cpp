@@ -5,6 +5,7 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include "facedetection.h"
+#include "log.h"
 
 namespace facedetection {
 std::string cascadeName =
@@ -34,7 +35,9 @@ int processImage(cv::Mat& img, std::vector<cv::Rect>& faces) {
 	cv::resize(gray, smallImg, smallImg.size(), 0, 0, cv::INTER_LINEAR);
 	cv::equalizeHist(smallImg, smallImg);
 
-	cv::imwrite("smallImg.jpg", smallImg);
+	if (LOG_MASK & LOG_IMAGES) {
+		cv::imwrite("smallImg.jpg", smallImg);
+	}
 
 	t = (double) cvGetTickCount();
 	cascade.detectMultiScale(gray, faces, 1.03, 10, 0
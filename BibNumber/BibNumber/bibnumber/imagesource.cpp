@@ -0,0 +1,54 @@
+#include <iostream>
+
+#include "imagesource.h"
+#include "batch.h"
+
+namespace fs = boost::filesystem;
+
+namespace batch {
+
+SourceImage::SourceImage() :
+		data(NULL), length(0) {
+}
+
+ListSource::ListSource(const std::vector<fs::path> &paths) :
+		paths(paths), pos(0) {
+}
+
+bool ListSource::next(SourceImage &image) {
+	if (pos >= paths.size())
+		return false;
+	image = SourceImage();
+	image.path = paths[pos++];
+	return true;
+}
+
+DirectorySource::DirectorySource(const std::string &dir) {
+	boost::system::error_code error;
+	it = fs::directory_iterator(dir, error);
+	if (error) {
+		std::cerr << "ERROR: Could not read directory " << dir << ": "
+				<< error.message() << std::endl;
+	}
+}
+
+bool DirectorySource::next(SourceImage &image) {
+	while (it != fs::directory_iterator()) {
+		fs::path candidate = it->path();
+		boost::system::error_code error;
+		it.increment(error);
+		if (error) {
+			std::cerr << "ERROR: Could not read directory: "
+					<< error.message() << std::endl;
+			it = fs::directory_iterator();
+		}
+		if (isImageFile(candidate.string())) {
+			image = SourceImage();
+			image.path = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+} /* namespace batch */
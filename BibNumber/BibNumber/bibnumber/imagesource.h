@@ -0,0 +1,65 @@
+#ifndef IMAGESOURCE_H
+#define IMAGESOURCE_H
+
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace batch
+{
+	/// <summary>
+	/// Image supplied by a source: a file, or encoded data the source holds in memory.
+	/// </summary>
+	struct SourceImage {
+		SourceImage();
+		boost::filesystem::path path; /* file or name of the image */
+		const unsigned char *data; /* encoded image, NULL to read the file */
+		size_t length;
+		boost::shared_ptr<std::vector<unsigned char> > buffer; /* holds the data if it is not owned by the source */
+		std::string hash; /* content hash of the data if known, see manifest::formatHash */
+	};
+
+	/// <summary>
+	/// Supplies the images of a batch one at a time, so the list of images does not
+	/// have to be held in memory.
+	/// </summary>
+	class ImageSource {
+	public:
+		virtual ~ImageSource() {
+		}
+
+		/// <summary>
+		/// Gets the next image.
+		/// </summary>
+		/// <returns>false when there are no more images</returns>
+		virtual bool next(SourceImage &image) = 0;
+	};
+
+	/// <summary>
+	/// Supplies the images of a list, e.g. the images of a ground truth file.
+	/// </summary>
+	class ListSource : public ImageSource {
+	public:
+		ListSource(const std::vector<boost::filesystem::path> &paths);
+		virtual bool next(SourceImage &image);
+	private:
+		const std::vector<boost::filesystem::path> &paths;
+		size_t pos;
+	};
+
+	/// <summary>
+	/// Supplies the image files of a directory while the directory is read. Images are
+	/// supplied in directory order, which avoids listing and sorting directories of
+	/// hundreds of thousands of files first.
+	/// </summary>
+	class DirectorySource : public ImageSource {
+	public:
+		DirectorySource(const std::string &dir);
+		virtual bool next(SourceImage &image);
+	private:
+		boost::filesystem::directory_iterator it;
+	};
+}
+
+#endif /* #ifndef IMAGESOURCE_H */
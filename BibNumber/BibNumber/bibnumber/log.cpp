@@ -1,17 +1,156 @@
 /** includes */
+#include <sstream>
+#include <string>
+#include <csignal>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 #include "log.h"
 
 /* macros */
 //#define DEFAULT_DBG_MASK   ( LOG_TEXTREC | LOG_COMPONENTS | LOG_TXT_ORIENT | LOG_SVM)
 //#define DEFAULT_DBG_MASK   ( LOG_TEXTREC | LOG_COMPONENTS | LOG_CHAINS | LOG_TXT_ORIENT | LOG_SVM)
 //#define DEFAULT_DBG_MASK   ( LOG_TEXTREC | LOG_COMPONENTS | LOG_COMP_PAIRS | LOG_CHAINS | LOG_TXT_ORIENT | LOG_SVM)
-#define DEFAULT_DBG_MASK   ( LOG_TEXTREC | LOG_COMPONENTS |  LOG_CHAINS | LOG_TXT_ORIENT | LOG_SVM)
+#define DEFAULT_DBG_MASK   ( LOG_TEXTREC | LOG_COMPONENTS |  LOG_CHAINS | LOG_TXT_ORIENT | LOG_SVM | LOG_IMAGES)
 //#define DEFAULT_DBG_MASK   ( DBG_TEXTREC | DBG_COMPONENTS | DBG_CHAINS )
 //#define DEFAULT_DBG_MASK   ( DBG_TXT_ORIENT | DBG_CHAINS )
 //#define DEFAULT_DBG_MASK   ( DBG_TXT_ORIENT )
 //#define DEFAULT_DBG_MASK   ( LOG_ALL )
 //#define DEFAULT_DBG_MASK   ( DBG_NONE )
 
+static const char *fieldNames[] = { "image", "chain" };
+
+/// <summary>
+/// Log state of one thread, only used by its thread.
+/// </summary>
+struct ThreadLog {
+	ThreadLog() :
+			stage(NULL) {
+		for (int f = 0; f < biblog::FIELD_COUNT; f++)
+			fields[f] = -1;
+	}
+	std::ostringstream line; /* line in progress */
+	std::string buffer; /* completed lines */
+	long fields[biblog::FIELD_COUNT]; /* -1 if not set */
+	const char *stage; /* NULL if not set */
+};
+
+/// <summary>
+/// Writes the lines handed over by the threads to std::cout from a thread of its own.
+/// </summary>
+class Writer {
+public:
+	Writer() :
+			threadLog(&Writer::threadExited), stopping(false) {
+	}
+
+	~Writer() {
+		/* the main thread does not exit through boost */
+		ThreadLog *log = threadLog.release();
+		if (log != NULL) {
+			threadExited(log);
+		}
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			stopping = true;
+		}
+		pending.notify_all();
+		if (thread)
+			thread->join();
+		std::cout << lines << std::flush;
+	}
+
+	ThreadLog &current() {
+		ThreadLog *log = threadLog.get();
+		if (log == NULL) {
+			log = new ThreadLog();
+			threadLog.reset(log);
+		}
+		return *log;
+	}
+
+	/// <summary>
+	/// Takes the completed lines of a thread, which keeps its buffer for reuse.
+	/// </summary>
+	void handOff(std::string &buffer) {
+		if (buffer.empty())
+			return;
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			lines.append(buffer);
+			if (!thread)
+				start();
+		}
+		buffer.clear();
+		pending.notify_one();
+	}
+
+private:
+	/// <summary>
+	/// Starts the writer thread, the lock must be held.
+	/// </summary>
+	void start() {
+#ifndef _WIN32
+		/* the stop signals must interrupt the blocking calls of the other threads */
+		sigset_t signals, previous;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &signals, &previous);
+#endif
+		thread.reset(new boost::thread(boost::bind(&Writer::run, this)));
+#ifndef _WIN32
+		pthread_sigmask(SIG_SETMASK, &previous, NULL);
+#endif
+	}
+
+	void run() {
+		std::string batch;
+		boost::unique_lock<boost::mutex> lock(mutex);
+		for (;;) {
+			while (lines.empty() && !stopping)
+				pending.wait(lock);
+			if (lines.empty())
+				break;
+			batch.swap(lines);
+			lock.unlock();
+			std::cout << batch << std::flush;
+			batch.clear();
+			lock.lock();
+		}
+	}
+
+	static void threadExited(ThreadLog *log);
+
+	boost::thread_specific_ptr<ThreadLog> threadLog;
+	std::string lines; /* handed over, not written yet */
+	bool stopping;
+	boost::mutex mutex;
+	boost::condition_variable pending;
+	boost::scoped_ptr<boost::thread> thread;
+};
+
+static Writer writer;
+
+/// <summary>
+/// Hands over the lines of an exiting thread, including an unfinished line.
+/// </summary>
+void Writer::threadExited(ThreadLog *log) {
+	if (!log->line.str().empty())
+		log->buffer.append(log->line.str()).append("\n");
+	writer.handOff(log->buffer);
+	delete log;
+}
 
 namespace biblog
 {
@@ -23,6 +162,75 @@ namespace biblog
 	{
 		log_mask = mask;
 	}
-}
 
+	std::ostream &line()
+	{
+		ThreadLog &log = writer.current();
+		if (log.line.tellp() <= 0) {
+			bool any = false;
+			for (int f = 0; f < FIELD_COUNT; f++) {
+				if (log.fields[f] < 0)
+					continue;
+				log.line << (any ? " " : "[") << fieldNames[f] << "=" << log.fields[f];
+				any = true;
+			}
+			if (log.stage != NULL) {
+				log.line << (any ? " " : "[") << "stage=" << log.stage;
+				any = true;
+			}
+			if (any)
+				log.line << "] ";
+		}
+		return log.line;
+	}
+
+	void end_line()
+	{
+		ThreadLog &log = writer.current();
+		log.buffer.append(log.line.str()).append("\n");
+		log.line.str("");
+		if (log.buffer.size() >= LOG_BUFFER_BYTES)
+			writer.handOff(log.buffer);
+	}
+
+	void flush()
+	{
+		if (LOG_MASK == 0)
+			return;
+		ThreadLog &log = writer.current();
+		writer.handOff(log.buffer);
+	}
+
+	Scope::Scope(Field field, long value) :
+			active(LOG_MASK != 0), field(field), previous(-1),
+			previousStage(NULL)
+	{
+		if (!active)
+			return;
+		ThreadLog &log = writer.current();
+		previous = log.fields[field];
+		log.fields[field] = value;
+	}
+
+	Scope::Scope(const char *stage) :
+			active(LOG_MASK != 0), field(FIELD_COUNT), previous(-1),
+			previousStage(NULL)
+	{
+		if (!active)
+			return;
+		ThreadLog &log = writer.current();
+		previousStage = log.stage;
+		log.stage = stage;
+	}
 
+	Scope::~Scope()
+	{
+		if (!active)
+			return;
+		ThreadLog &log = writer.current();
+		if (field == FIELD_COUNT)
+			log.stage = previousStage;
+		else
+			log.fields[field] = previous;
+	}
+}
@@ -12,17 +12,27 @@
 #define LOG_SVM (1<<4)
 #define LOG_COMP_PAIRS (1<<5)
 #define LOG_SYMM_CHECK (1<<6)
+#define LOG_IMAGES (1<<7) /* intermediate images are saved to the working directory */
 #define LOG_ALL (0xFFFFFFFF)
 #define LOG_NONE (0)
 
-#define LOG_MASK (biblog::log_mask)
+/* categories compiled in, the others are removed by the compiler, e.g.
+   -DLOG_COMPILED_MASK=0 for a build without any logging */
+#ifndef LOG_COMPILED_MASK
+#define LOG_COMPILED_MASK (LOG_ALL)
+#endif
+
+/* a thread hands its log lines to the writer thread once it buffered this much */
+#define LOG_BUFFER_BYTES (4096)
+
+#define LOG_MASK (biblog::log_mask & LOG_COMPILED_MASK)
 
 #define LOG(mask,x) do { \
-  if (LOG_MASK & (mask)) { std::cout << x ; } \
+  if (LOG_MASK & (mask)) { biblog::line() << x ; } \
 } while (0)
 
 #define LOGL(mask,x) do { \
-  if (LOG_MASK & (mask)) { std::cout << x << std::endl; } \
+  if (LOG_MASK & (mask)) { biblog::line() << x ; biblog::end_line(); } \
 } while (0)
 
 namespace biblog
@@ -32,6 +42,58 @@ namespace biblog
 
 	/** public functions */
 	void set_log_mask(int log_mask);
+
+	/// <summary>
+	/// Gets the line being logged by the calling thread. A new line starts with the
+	/// fields of the thread, e.g. [image=12 stage=recognize chain=3].
+	/// </summary>
+	std::ostream &line();
+
+	/// <summary>
+	/// Ends the line of the calling thread and appends it to the buffer of the thread.
+	/// Full buffers are written by a background thread, so workers logging in parallel
+	/// neither interleave their lines nor wait for the console.
+	/// </summary>
+	void end_line();
+
+	/// <summary>
+	/// Hands the buffered lines of the calling thread to the writer thread, e.g. once
+	/// an image is done. The lines of exiting threads are handed over as well, and
+	/// all lines are written before the program exits.
+	/// </summary>
+	void flush();
+
+	/// <summary>
+	/// Numeric fields of the log lines.
+	/// </summary>
+	enum Field {
+		FIELD_IMAGE = 0, /* index of the image in the batch */
+		FIELD_CHAIN, /* index of the text chain */
+		FIELD_COUNT
+	};
+
+	/// <summary>
+	/// Sets a field of the log lines of the calling thread until destroyed, e.g.
+	/// biblog::Scope scope(biblog::FIELD_CHAIN, i);
+	/// Nothing is done while logging is disabled.
+	/// </summary>
+	class Scope {
+	public:
+		Scope(Field field, long value);
+
+		/// <summary>
+		/// Sets the stage field, a string literal.
+		/// </summary>
+		Scope(const char *stage);
+
+		~Scope();
+
+	private:
+		bool active;
+		Field field;
+		long previous;
+		const char *previousStage;
+	};
 }
 
 #endif /* #ifndef LOG_H */
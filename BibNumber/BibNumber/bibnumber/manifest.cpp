@@ -0,0 +1,188 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "manifest.h"
+
+/* FNV-1a 64-bit parameters */
+#define FNV_OFFSET_BASIS (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+namespace fs = boost::filesystem;
+
+/* suffix of the result stream of the previous run while a run is in progress */
+static const char *previousSuffix = ".prev";
+
+namespace manifest {
+
+boost::uint64_t hashBytes(const unsigned char *data, size_t length) {
+	boost::uint64_t hash = FNV_OFFSET_BASIS;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+std::string formatHash(boost::uint64_t hash) {
+	std::ostringstream text;
+	text << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return text.str();
+}
+
+bool readFile(const std::string &fileName, std::vector<unsigned char> &data) {
+	std::ifstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	file.seekg(0, std::ios::end);
+	std::streamoff length = file.tellg();
+	file.seekg(0, std::ios::beg);
+	if (length < 0)
+		return false;
+
+	data.resize((size_t) length);
+	if (length > 0)
+		file.read((char *) &data[0], length);
+	return !file.fail();
+}
+
+boost::uint64_t hashFile(const std::string &fileName) {
+	std::vector<unsigned char> data;
+	if (!readFile(fileName, data))
+		return 0;
+	return hashBytes(data.empty() ? NULL : &data[0], data.size());
+}
+
+static boost::uint64_t hashPath(const std::string &image) {
+	return hashBytes((const unsigned char *) image.data(), image.size());
+}
+
+Manifest::Manifest() :
+		owner(false) {
+}
+
+Manifest::~Manifest() {
+	if (previous.is_open())
+		previous.close();
+}
+
+int Manifest::open(const std::string &streamFileName,
+		const std::string &version, bool resume) {
+	previousFileName = streamFileName + previousSuffix;
+	owner = true;
+	boost::system::error_code error;
+
+	if (fs::exists(previousFileName) && fs::exists(streamFileName)) {
+		/* the last run was interrupted, its records supersede the older ones */
+		std::ifstream interrupted(streamFileName.c_str());
+		std::ofstream merged(previousFileName.c_str(), std::ios::out | std::ios::app);
+		std::string line;
+		results::ImageRecord record;
+		while (std::getline(interrupted, line)) {
+			if (results::parseRecord(line, record))
+				merged << line << '\n';
+		}
+		interrupted.close();
+		if (!merged.good()) {
+			std::cerr << "ERROR: Could not write " << previousFileName
+					<< std::endl;
+			return -1;
+		}
+		fs::remove(streamFileName, error);
+	} else if (fs::exists(streamFileName)) {
+		fs::rename(streamFileName, previousFileName, error);
+	}
+	if (error) {
+		std::cerr << "ERROR: Could not set aside " << streamFileName << ": "
+				<< error.message() << std::endl;
+		return -1;
+	}
+
+	if (!resume || !fs::exists(previousFileName))
+		return 0;
+	return load(version);
+}
+
+int Manifest::openPrevious(const std::string &previousFileName,
+		const std::string &version) {
+	this->previousFileName = previousFileName;
+	owner = false;
+	return load(version);
+}
+
+std::string Manifest::previousFile() const {
+	if (previousFileName.empty() || !fs::exists(previousFileName))
+		return std::string();
+	return previousFileName;
+}
+
+int Manifest::load(const std::string &version) {
+	previous.open(previousFileName.c_str(), std::ios::binary);
+	if (!previous.is_open()) {
+		std::cerr << "ERROR: Could not read " << previousFileName << std::endl;
+		return -1;
+	}
+
+	std::string line;
+	results::ImageRecord record;
+	for (;;) {
+		std::streamoff offset = previous.tellg();
+		if (!std::getline(previous, line))
+			break;
+		if (!results::parseRecord(line, record))
+			continue;
+
+		/* later records of an image replace earlier ones */
+		boost::uint64_t key = hashPath(record.image);
+		if ((record.version != version) || record.hash.empty()) {
+			entries.erase(key);
+			continue;
+		}
+		Entry entry;
+		entry.contentHash = strtoull(record.hash.c_str(), NULL, 16);
+		entry.offset = offset;
+		entries[key] = entry;
+	}
+	previous.clear();
+	return 0;
+}
+
+bool Manifest::lookup(const std::string &image, const std::string &hash,
+		results::ImageRecord &record) {
+	boost::unordered_map<boost::uint64_t, Entry>::const_iterator it =
+			entries.find(hashPath(image));
+	if ((it == entries.end())
+			|| (it->second.contentHash != strtoull(hash.c_str(), NULL, 16)))
+		return false;
+
+	std::string line;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		previous.clear();
+		previous.seekg(it->second.offset);
+		if (!std::getline(previous, line))
+			return false;
+	}
+	return results::parseRecord(line, record) && (record.image == image);
+}
+
+void Manifest::close() {
+	if (previous.is_open())
+		previous.close();
+	entries.clear();
+	if (owner && !previousFileName.empty()) {
+		boost::system::error_code error;
+		fs::remove(previousFileName, error);
+	}
+}
+
+size_t Manifest::size() const {
+	return entries.size();
+}
+
+} /* namespace manifest */
@@ -0,0 +1,114 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "resultsink.h"
+
+namespace manifest
+{
+	/// <summary>
+	/// Computes the 64-bit FNV-1a hash of a buffer.
+	/// </summary>
+	boost::uint64_t hashBytes(const unsigned char *data, size_t length);
+
+	/// <summary>
+	/// Formats a hash as 16 hexadecimal digits.
+	/// </summary>
+	std::string formatHash(boost::uint64_t hash);
+
+	/// <summary>
+	/// Reads a whole file into memory.
+	/// </summary>
+	/// <returns>false if the file could not be read</returns>
+	bool readFile(const std::string &fileName, std::vector<unsigned char> &data);
+
+	/// <summary>
+	/// Computes the content hash of a file, 0 if the file could not be read.
+	/// </summary>
+	boost::uint64_t hashFile(const std::string &fileName);
+
+	/// <summary>
+	/// Results of the previous runs on a directory, used to skip unchanged images.
+	/// The JSON-lines result stream of the directory is the manifest: each record holds
+	/// the content hash of the image, the version of the pipeline and parameters, and
+	/// the bib numbers. When a run starts, the stream of the previous run is kept aside
+	/// and indexed by image path; images whose content hash and version match are not
+	/// processed again, their results are copied to the new stream. Only hashes and
+	/// file offsets are held in memory, the results are read back when needed.
+	/// </summary>
+	class Manifest {
+	public:
+		Manifest();
+		~Manifest();
+
+		/// <summary>
+		/// Sets the result stream of the previous run aside and indexes it. The records
+		/// of an interrupted run are added to the ones of the run before it.
+		/// </summary>
+		/// <param name="streamFileName">The result stream of the directory.</param>
+		/// <param name="version">Version of the pipeline and parameters of this run.</param>
+		/// <param name="resume">false to process all images again.</param>
+		/// <returns>0 if no error occured</returns>
+		int open(const std::string &streamFileName, const std::string &version,
+				bool resume = true);
+
+		/// <summary>
+		/// Indexes the result stream of the previous run which another process set
+		/// aside with open(), e.g. in the workers of the shard coordinator. The stream
+		/// is only read, close() leaves it to the process which set it aside.
+		/// </summary>
+		/// <param name="previousFileName">The stream set aside, as given by previousFile().</param>
+		/// <param name="version">Version of the pipeline and parameters of this run.</param>
+		/// <returns>0 if no error occured</returns>
+		int openPrevious(const std::string &previousFileName,
+				const std::string &version);
+
+		/// <summary>
+		/// Gets the file the result stream of the previous run is set aside to, empty
+		/// if there is none.
+		/// </summary>
+		std::string previousFile() const;
+
+		/// <summary>
+		/// Looks up the results of an unchanged image. Can be called from several threads.
+		/// </summary>
+		/// <param name="image">Path of the image.</param>
+		/// <param name="hash">Content hash of the image, as formatted by formatHash.</param>
+		/// <param name="record">Set to the record of the previous run.</param>
+		/// <returns>true if the image was processed before with the same content and version</returns>
+		bool lookup(const std::string &image, const std::string &hash,
+				results::ImageRecord &record);
+
+		/// <summary>
+		/// Removes the results of the previous run once the new stream is complete.
+		/// </summary>
+		void close();
+
+		/// <summary>
+		/// Gets the count of images which can be reused.
+		/// </summary>
+		size_t size() const;
+
+	private:
+		struct Entry {
+			boost::uint64_t contentHash;
+			std::streamoff offset; /* of the record in the previous stream */
+		};
+
+		int load(const std::string &version);
+
+		boost::unordered_map<boost::uint64_t, Entry> entries; /* keyed by path hash */
+		std::string previousFileName;
+		bool owner; /* the previous stream was set aside by this manifest */
+		std::ifstream previous;
+		boost::mutex mutex;
+	};
+}
+
+#endif /* #ifndef MANIFEST_H */
@@ -0,0 +1,249 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <csignal>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/locks.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#include <pthread.h>
+#endif
+
+#include "metrics.h"
+
+/* upper bounds of the latency buckets in milliseconds */
+static const double stageBounds[] = { 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250,
+		500, 1000, 2500, 5000, 10000 };
+
+/* upper bounds of the buckets of the counts found in an image */
+static const double sizeBounds[] = { 0, 1, 2, 5, 10, 20, 50, 100, 200, 500,
+		1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000, 1000000 };
+
+#define STAGE_BUCKETS (sizeof(stageBounds) / sizeof(stageBounds[0]))
+#define SIZE_BUCKETS (sizeof(sizeBounds) / sizeof(sizeBounds[0]))
+#define MAX_BUCKETS (SIZE_BUCKETS)
+
+static const char *stageNames[] = { "decode", "smoothing", "canny",
+		"gradients", "swt", "labeling", "filtering", "chaining", "detect", "ocr",
+		"recognize", "image" };
+
+static const char *sizeNames[] = { "rays", "components", "chains" };
+
+static const char *counterNames[] = { "images", "image_errors", "ocr_calls",
+		"ocr_cache_hits", "ocr_cache_misses" };
+
+static const char *counterHelp[] = { "Images processed.",
+		"Images which could not be processed.", "Tesseract calls.",
+		"Chains whose OCR result was found in the OCR cache.",
+		"Chains which were not found in the OCR cache." };
+
+static const char *gaugeNames[] = { "detect", "recognize", "interactive",
+		"bulk" };
+
+/// <summary>
+/// Histogram with fixed buckets, updated without locks. Bucket counts are kept per
+/// bucket and made cumulative when formatted.
+/// </summary>
+class Histogram {
+public:
+	void observe(const double *bounds, size_t nBounds, double value) {
+		size_t bucket = std::lower_bound(bounds, bounds + nBounds, value) - bounds;
+		buckets[bucket].fetch_add(1, boost::memory_order_relaxed);
+		if (value > 0)
+			sumMilli.fetch_add((boost::uint64_t) (value * 1000 + 0.5),
+					boost::memory_order_relaxed);
+	}
+
+	/// <summary>
+	/// Writes the bucket, sum and count lines of the histogram.
+	/// </summary>
+	/// <param name="label">Label of the histogram within its family, e.g. stage="swt", empty if none.</param>
+	/// <param name="scale">Factor from the recorded values to the unit of the family.</param>
+	void format(std::ostream &out, const std::string &name,
+			const std::string &label, const double *bounds, size_t nBounds,
+			double scale) const {
+		std::string prefix = label.empty() ? "{" : "{" + label + ",";
+		std::string labels = label.empty() ? "" : "{" + label + "}";
+		boost::uint64_t cumulative = 0;
+		for (size_t b = 0; b < nBounds; b++) {
+			cumulative += buckets[b].load(boost::memory_order_relaxed);
+			out << name << "_bucket" << prefix << "le=\"" << bounds[b] * scale
+					<< "\"} " << cumulative << "\n";
+		}
+		cumulative += buckets[nBounds].load(boost::memory_order_relaxed);
+		out << name << "_bucket" << prefix << "le=\"+Inf\"} " << cumulative
+				<< "\n";
+		out << name << "_sum" << labels << " "
+				<< sumMilli.load(boost::memory_order_relaxed) / 1000. * scale
+				<< "\n";
+		out << name << "_count" << labels << " " << cumulative << "\n";
+	}
+
+private:
+	boost::atomic<boost::uint64_t> buckets[MAX_BUCKETS + 1]; /* the last one is +Inf */
+	boost::atomic<boost::uint64_t> sumMilli; /* sum of the values in thousandths */
+};
+
+static Histogram stageHistograms[metrics::STAGE_COUNT];
+static Histogram sizeHistograms[metrics::SIZE_COUNT];
+static boost::atomic<boost::uint64_t> counters[metrics::COUNTER_COUNT];
+static boost::atomic<boost::int64_t> gauges[metrics::GAUGE_COUNT];
+
+/// <summary>
+/// Gets the current resident set size of the process in bytes, 0 if unknown.
+/// </summary>
+static boost::uint64_t residentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.WorkingSetSize;
+	return 0;
+#else
+	long size, resident = 0;
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (file == NULL)
+		return 0;
+	if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(file);
+	return (boost::uint64_t) resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+namespace metrics {
+
+void observe(Stage stage, double ms) {
+	stageHistograms[stage].observe(stageBounds, STAGE_BUCKETS, ms);
+}
+
+void observe(Size size, size_t value) {
+	sizeHistograms[size].observe(sizeBounds, SIZE_BUCKETS, (double) value);
+}
+
+void increment(Counter counter, boost::uint64_t n) {
+	counters[counter].fetch_add(n, boost::memory_order_relaxed);
+}
+
+void set(Gauge gauge, boost::int64_t value) {
+	gauges[gauge].store(value, boost::memory_order_relaxed);
+}
+
+int64 lap(Stage stage, int64 start) {
+	int64 now = cv::getTickCount();
+	observe(stage, (now - start) * 1000. / cv::getTickFrequency());
+	return now;
+}
+
+std::string formatPrometheus() {
+	std::ostringstream out;
+	out.precision(12);
+
+	out << "# HELP bibnumber_stage_seconds Time of the pipeline stages.\n"
+			"# TYPE bibnumber_stage_seconds histogram\n";
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		stageHistograms[s].format(out, "bibnumber_stage_seconds",
+				std::string("stage=\"") + stageNames[s] + "\"", stageBounds,
+				STAGE_BUCKETS, 0.001);
+	}
+
+	for (int s = 0; s < SIZE_COUNT; s++) {
+		std::string name = std::string("bibnumber_image_") + sizeNames[s];
+		out << "# HELP " << name << " Count of " << sizeNames[s]
+				<< " found in an image.\n# TYPE " << name << " histogram\n";
+		sizeHistograms[s].format(out, name, "", sizeBounds, SIZE_BUCKETS, 1);
+	}
+
+	for (int c = 0; c < COUNTER_COUNT; c++) {
+		std::string name = std::string("bibnumber_") + counterNames[c] + "_total";
+		out << "# HELP " << name << " " << counterHelp[c] << "\n# TYPE " << name
+				<< " counter\n" << name << " "
+				<< counters[c].load(boost::memory_order_relaxed) << "\n";
+	}
+
+	out << "# HELP bibnumber_queue_depth Items waiting in the queues.\n"
+			"# TYPE bibnumber_queue_depth gauge\n";
+	for (int g = 0; g < GAUGE_COUNT; g++) {
+		out << "bibnumber_queue_depth{queue=\"" << gaugeNames[g] << "\"} "
+				<< gauges[g].load(boost::memory_order_relaxed) << "\n";
+	}
+
+	out << "# HELP bibnumber_resident_memory_bytes Resident set size of the process.\n"
+			"# TYPE bibnumber_resident_memory_bytes gauge\n"
+			"bibnumber_resident_memory_bytes " << residentBytes() << "\n";
+	return out.str();
+}
+
+int writeFile(const std::string &fileName) {
+	std::string temporary = fileName + ".tmp";
+	std::ofstream file(temporary.c_str(), std::ios::binary);
+	file << formatPrometheus();
+	file.close();
+	if (file.fail()) {
+		std::cerr << "ERROR: Could not write " << temporary << std::endl;
+		return -1;
+	}
+
+	boost::system::error_code error;
+	boost::filesystem::rename(temporary, fileName, error);
+	if (error) {
+		std::cerr << "ERROR: Could not rename " << temporary << " to "
+				<< fileName << ": " << error.message() << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+FileExporter::FileExporter(const std::string &fileName) :
+		fileName(fileName), stopping(false) {
+	if (fileName.empty())
+		return;
+
+#ifndef _WIN32
+	/* the stop signals must interrupt the blocking calls of the main thread */
+	sigset_t signals, previous;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &previous);
+#endif
+	thread.reset(new boost::thread(boost::bind(&FileExporter::run, this)));
+#ifndef _WIN32
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+#endif
+}
+
+FileExporter::~FileExporter() {
+	if (!thread)
+		return;
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		stopping = true;
+	}
+	stopped.notify_all();
+	thread->join();
+	writeFile(fileName);
+}
+
+void FileExporter::run() {
+	boost::unique_lock<boost::mutex> lock(mutex);
+	while (!stopping) {
+		stopped.timed_wait(lock,
+				boost::posix_time::milliseconds(METRICS_INTERVAL_MS));
+		if (stopping)
+			break;
+		lock.unlock();
+		writeFile(fileName);
+		lock.lock();
+	}
+}
+
+} /* namespace metrics */
@@ -0,0 +1,126 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "opencv2/core/core.hpp"
+
+/* interval at which a metrics file is replaced while a run is in progress */
+#define METRICS_INTERVAL_MS (10000)
+
+namespace metrics
+{
+	/// <summary>
+	/// Timed stages, each with a latency histogram.
+	/// </summary>
+	enum Stage {
+		STAGE_DECODE = 0, /* reading and decoding an image */
+		STAGE_SMOOTHING, /* edge preserving smoothing and segmentation */
+		STAGE_CANNY,
+		STAGE_GRADIENTS,
+		STAGE_SWT, /* stroke width transform and its median filter */
+		STAGE_LABELING, /* connected components of the SWT image */
+		STAGE_FILTERING, /* component filtering */
+		STAGE_CHAINING,
+		STAGE_DETECT, /* text detection of an image, the stages above but decoding */
+		STAGE_OCR, /* one Tesseract call */
+		STAGE_RECOGNIZE, /* recognition of the chains of an image */
+		STAGE_IMAGE, /* an image from taking it to its result */
+		STAGE_COUNT
+	};
+
+	/// <summary>
+	/// Counts found in an image, each with a histogram.
+	/// </summary>
+	enum Size {
+		SIZE_RAYS = 0, /* stroke width transform rays */
+		SIZE_COMPONENTS, /* connected components before filtering */
+		SIZE_CHAINS,
+		SIZE_COUNT
+	};
+
+	/// <summary>
+	/// Monotonic counters.
+	/// </summary>
+	enum Counter {
+		COUNTER_IMAGES = 0,
+		COUNTER_IMAGE_ERRORS,
+		COUNTER_OCR_CALLS,
+		COUNTER_OCR_CACHE_HITS,
+		COUNTER_OCR_CACHE_MISSES,
+		COUNTER_COUNT
+	};
+
+	/// <summary>
+	/// Current values, the resident set size is read when the metrics are formatted.
+	/// </summary>
+	enum Gauge {
+		GAUGE_DETECT_QUEUE = 0, /* decoded images waiting for detection */
+		GAUGE_RECOGNIZE_QUEUE, /* detected images waiting for OCR */
+		GAUGE_INTERACTIVE_QUEUE, /* interactive requests of the daemon waiting for a pipeline */
+		GAUGE_BULK_QUEUE, /* bulk requests of the daemon waiting for a pipeline */
+		GAUGE_COUNT
+	};
+
+	/// <summary>
+	/// Records a stage time. Metrics are updated with relaxed atomic operations, so
+	/// any thread may record without taking a lock.
+	/// </summary>
+	void observe(Stage stage, double ms);
+
+	/// <summary>
+	/// Records a count found in an image.
+	/// </summary>
+	void observe(Size size, size_t value);
+
+	void increment(Counter counter, boost::uint64_t n = 1);
+
+	void set(Gauge gauge, boost::int64_t value);
+
+	/// <summary>
+	/// Records the time of a stage which started at start.
+	/// </summary>
+	/// <returns>the current ticks, the start of the next stage</returns>
+	int64 lap(Stage stage, int64 start);
+
+	/// <summary>
+	/// Formats all metrics in the Prometheus text exposition format, e.g.
+	/// bibnumber_stage_seconds_bucket{stage="swt",le="0.05"} 812
+	/// </summary>
+	std::string formatPrometheus();
+
+	/// <summary>
+	/// Writes the metrics to a file under a temporary name and renames it into place,
+	/// as expected by the textfile collector of the node exporter.
+	/// </summary>
+	/// <returns>0 if no error occured</returns>
+	int writeFile(const std::string &fileName);
+
+	/// <summary>
+	/// Replaces a metrics file every METRICS_INTERVAL_MS while a run is in progress and
+	/// once more when destroyed.
+	/// </summary>
+	class FileExporter {
+	public:
+		/// <param name="fileName">The metrics file, nothing is written if empty.</param>
+		FileExporter(const std::string &fileName);
+		~FileExporter();
+
+	private:
+		void run();
+
+		std::string fileName;
+		bool stopping;
+		boost::mutex mutex;
+		boost::condition_variable stopped;
+		boost::scoped_ptr<boost::thread> thread;
+	};
+}
+
+#endif /* #ifndef METRICS_H */
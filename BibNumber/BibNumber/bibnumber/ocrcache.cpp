@@ -0,0 +1,187 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include <boost/thread/locks.hpp>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ocrcache.h"
+#include "log.h"
+
+/* hash grid dimensions - bib crops are wider than tall */
+#define HASH_GRID_WIDTH (32)
+#define HASH_GRID_HEIGHT (12)
+/* aspect ratio is quantized to 1/4 steps */
+#define HASH_ASPECT_STEPS (4)
+#define HASH_ASPECT_MAX (63)
+
+#define FNV_OFFSET_BASIS (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+/// <summary>
+/// Adds one byte to a FNV-1a hash.
+/// </summary>
+static inline boost::uint64_t fnv1a(boost::uint64_t hash, unsigned char value) {
+	return (hash ^ value) * FNV_PRIME;
+}
+
+namespace ocrcache {
+
+boost::uint64_t hashCrop(const cv::Mat& crop) {
+	boost::uint64_t hash = FNV_OFFSET_BASIS;
+	if ((crop.rows == 0) || (crop.cols == 0))
+		return hash;
+
+	/* aspect ratio separates bibs with a different count of digits */
+	int aspect = cvRound((double) HASH_ASPECT_STEPS * crop.cols / crop.rows);
+	hash = fnv1a(hash, (unsigned char) std::min(aspect, HASH_ASPECT_MAX));
+
+	/* block means of the binarized crop */
+	cv::Mat grid;
+	cv::resize(crop, grid, cv::Size(HASH_GRID_WIDTH, HASH_GRID_HEIGHT), 0, 0,
+			cv::INTER_AREA);
+
+	unsigned char bits = 0;
+	int nBits = 0;
+	for (int row = 0; row < grid.rows; row++) {
+		const uchar* ptr = grid.ptr<uchar>(row);
+		for (int col = 0; col < grid.cols; col++) {
+			bits = (bits << 1) | (ptr[col] > 127 ? 1 : 0);
+			if (++nBits == 8) {
+				hash = fnv1a(hash, bits);
+				bits = 0;
+				nBits = 0;
+			}
+		}
+	}
+	if (nBits)
+		hash = fnv1a(hash, bits);
+
+	return hash;
+}
+
+OcrCache::OcrCache(size_t capacity) :
+		capacity(capacity), nHits(0), nMisses(0), nEvictions(0) {
+	if (this->capacity == 0)
+		this->capacity = 1;
+}
+
+bool OcrCache::lookup(boost::uint64_t key, bool &accepted, std::string &text) {
+	boost::lock_guard<boost::mutex> lock(mutex);
+
+	EntryMap::iterator it = index.find(key);
+	if (it == index.end()) {
+		nMisses++;
+		return false;
+	}
+
+	/* move entry to the front of the LRU list */
+	entries.splice(entries.begin(), entries, it->second);
+	accepted = it->second->accepted;
+	text = it->second->text;
+	nHits++;
+	return true;
+}
+
+void OcrCache::insert(boost::uint64_t key, bool accepted,
+		const std::string &text) {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	insertLocked(key, accepted, text);
+}
+
+void OcrCache::insertLocked(boost::uint64_t key, bool accepted,
+		const std::string &text) {
+	EntryMap::iterator it = index.find(key);
+	if (it != index.end()) {
+		it->second->accepted = accepted;
+		it->second->text = text;
+		entries.splice(entries.begin(), entries, it->second);
+		return;
+	}
+
+	if (entries.size() >= capacity) {
+		index.erase(entries.back().key);
+		entries.pop_back();
+		nEvictions++;
+	}
+
+	Entry entry;
+	entry.key = key;
+	entry.accepted = accepted;
+	entry.text = text;
+	entries.push_front(entry);
+	index[key] = entries.begin();
+}
+
+int OcrCache::load(const std::string &fileName) {
+	std::ifstream file(fileName.c_str());
+	if (!file.is_open()) {
+		/* first run on this album */
+		return 0;
+	}
+
+	boost::lock_guard<boost::mutex> lock(mutex);
+
+	/* each line is <hash>;<accepted>;<text> */
+	std::string line;
+	int nLoaded = 0;
+	while (std::getline(file, line)) {
+		std::stringstream lineStream(line);
+		std::string keyCell, acceptedCell, text;
+		if (!std::getline(lineStream, keyCell, ';')
+				|| !std::getline(lineStream, acceptedCell, ';'))
+			continue;
+		std::getline(lineStream, text);
+
+		boost::uint64_t key = strtoull(keyCell.c_str(), NULL, 16);
+		insertLocked(key, acceptedCell == "1", text);
+		nLoaded++;
+	}
+
+	LOGL(LOG_TEXTREC, "Loaded " << nLoaded << " OCR cache entries from " << fileName);
+	return 0;
+}
+
+int OcrCache::save(const std::string &fileName) const {
+	std::ofstream file(fileName.c_str());
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write OCR cache " << fileName
+				<< std::endl;
+		return -1;
+	}
+
+	boost::lock_guard<boost::mutex> lock(mutex);
+
+	/* least recently used first, so that load() restores the LRU order */
+	for (EntryList::const_reverse_iterator it = entries.rbegin();
+			it != entries.rend(); ++it) {
+		file << std::hex << it->key << std::dec << ";"
+				<< (it->accepted ? 1 : 0) << ";" << it->text << std::endl;
+	}
+
+	return 0;
+}
+
+size_t OcrCache::size() const {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	return entries.size();
+}
+
+unsigned long OcrCache::hits() const {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	return nHits;
+}
+
+unsigned long OcrCache::misses() const {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	return nMisses;
+}
+
+unsigned long OcrCache::evictions() const {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	return nEvictions;
+}
+
+} /* namespace ocrcache */
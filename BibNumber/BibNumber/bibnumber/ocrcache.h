@@ -0,0 +1,86 @@
+#ifndef OCRCACHE_H
+#define OCRCACHE_H
+
+#include <list>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+namespace ocrcache
+{
+	/// <summary>
+	/// Computes a perceptual hash of the binarized OCR input crop.
+	/// The crop is reduced to a coarse grid of block means, thresholded and
+	/// combined with its aspect ratio, so near-identical bibs from a burst of
+	/// photos map to the same key.
+	/// </summary>
+	/// <param name="crop">8-bit single channel crop that is passed to Tesseract.</param>
+	/// <returns>64-bit hash of the crop.</returns>
+	boost::uint64_t hashCrop(const cv::Mat& crop);
+
+	/// <summary>
+	/// Bounded, thread-safe LRU cache of OCR results keyed by hashCrop(), mixed with
+	/// the BibRegistry::key() of the registry the result was verified against.
+	/// Both accepted bib numbers and rejections are stored, so a repeated crop
+	/// never reaches Tesseract again.
+	/// </summary>
+	class OcrCache {
+	public:
+		OcrCache(size_t capacity = 4096);
+
+		/// <summary>
+		/// Looks up a crop hash.
+		/// </summary>
+		/// <param name="key">hash of the crop</param>
+		/// <param name="accepted">set to true if the cached OCR result was accepted as a bib number</param>
+		/// <param name="text">set to the accepted bib number</param>
+		/// <returns>true on cache hit</returns>
+		bool lookup(boost::uint64_t key, bool &accepted, std::string &text);
+
+		/// <summary>
+		/// Stores the OCR result of a crop, evicting the least recently used entry if the cache is full.
+		/// </summary>
+		void insert(boost::uint64_t key, bool accepted, const std::string &text);
+
+		/// <summary>
+		/// Loads entries from a persistence file. A missing file is not an error.
+		/// </summary>
+		/// <returns>0 if no error occured</returns>
+		int load(const std::string &fileName);
+
+		/// <summary>
+		/// Saves entries to a persistence file, least recently used first.
+		/// </summary>
+		/// <returns>0 if no error occured</returns>
+		int save(const std::string &fileName) const;
+
+		size_t size() const;
+		unsigned long hits() const;
+		unsigned long misses() const;
+		unsigned long evictions() const;
+
+	private:
+		struct Entry {
+			boost::uint64_t key;
+			bool accepted;
+			std::string text;
+		};
+		typedef std::list<Entry> EntryList;
+		typedef boost::unordered_map<boost::uint64_t, EntryList::iterator> EntryMap;
+
+		void insertLocked(boost::uint64_t key, bool accepted, const std::string &text);
+
+		size_t capacity;
+		EntryList entries; /* most recently used first */
+		EntryMap index;
+		unsigned long nHits;
+		unsigned long nMisses;
+		unsigned long nEvictions;
+		mutable boost::mutex mutex;
+	};
+}
+
+#endif /* #ifndef OCRCACHE_H */
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "pack.h"
+#include "manifest.h"
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+namespace pack {
+
+int create(const std::string &dir, const std::string &packName) {
+	if (!fs::is_directory(dir)) {
+		std::cerr << "ERROR: Not a directory: " << dir << std::endl;
+		return -1;
+	}
+
+	std::ofstream data(packName.c_str(), std::ios::binary);
+	std::ofstream index(indexName(packName).c_str());
+	if (!data.is_open() || !index.is_open()) {
+		std::cerr << "ERROR: Could not write pack " << packName << std::endl;
+		return -1;
+	}
+
+	batch::DirectorySource source(dir);
+	batch::SourceImage image;
+	std::vector<unsigned char> bytes;
+	boost::uint64_t offset = 0;
+	size_t nImages = 0;
+	while (source.next(image)) {
+		if (!manifest::readFile(image.path.string(), bytes) || bytes.empty()) {
+			std::cerr << "ERROR: Could not read " << image.path.string()
+					<< std::endl;
+			continue;
+		}
+		data.write((const char *) &bytes[0], bytes.size());
+		index << offset << ";" << bytes.size() << ";"
+				<< manifest::formatHash(manifest::hashBytes(&bytes[0], bytes.size()))
+				<< ";" << image.path.filename().string() << '\n';
+		offset += bytes.size();
+		nImages++;
+	}
+
+	if (!data.good() || !index.good()) {
+		std::cerr << "ERROR: Could not write pack " << packName << std::endl;
+		return -1;
+	}
+	std::cout << "Packed " << nImages << " images (" << offset / (1024 * 1024)
+			<< " MB) into " << packName << std::endl;
+	return 0;
+}
+
+bool isPackFile(std::string name) {
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	return boost::algorithm::ends_with(name, ".pack");
+}
+
+std::string indexName(const std::string &packName) {
+	return packName + ".idx";
+}
+
+PackSource::PackSource() :
+		base(NULL), packLength(0) {
+}
+
+int PackSource::open(const std::string &packName) {
+	index.open(indexName(packName).c_str());
+	if (!index.is_open()) {
+		std::cerr << "ERROR: Could not read pack index " << indexName(packName)
+				<< std::endl;
+		return -1;
+	}
+
+	try {
+		/* an empty file cannot be mapped */
+		if (fs::file_size(packName) > 0) {
+			bip::file_mapping mapping(packName.c_str(), bip::read_only);
+			bip::mapped_region mapped(mapping, bip::read_only);
+			file.swap(mapping);
+			region.swap(mapped);
+			base = (const unsigned char *) region.get_address();
+			packLength = region.get_size();
+		}
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: Could not map pack " << packName << ": "
+				<< e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+bool PackSource::next(batch::SourceImage &image) {
+	std::string line;
+	while (std::getline(index, line)) {
+		/* offset;length;hash;name */
+		size_t first = line.find(';');
+		size_t second = line.find(';', first + 1);
+		size_t third = line.find(';', second + 1);
+		if ((first == std::string::npos) || (second == std::string::npos)
+				|| (third == std::string::npos))
+			continue;
+
+		boost::uint64_t offset = strtoull(line.c_str(), NULL, 10);
+		boost::uint64_t length = strtoull(line.c_str() + first + 1, NULL, 10);
+		if ((length == 0) || (offset + length > packLength)) {
+			std::cerr << "ERROR: Pack index entry out of range: " << line
+					<< std::endl;
+			continue;
+		}
+
+		image = batch::SourceImage();
+		image.path = line.substr(third + 1);
+		image.data = base + offset;
+		image.length = (size_t) length;
+		image.hash = line.substr(second + 1, third - second - 1);
+		return true;
+	}
+	return false;
+}
+
+} /* namespace pack */
@@ -0,0 +1,61 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <string>
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "imagesource.h"
+
+namespace pack
+{
+	/// <summary>
+	/// Packs the images of a directory: the encoded images are concatenated into the
+	/// pack file and the index file (pack name + ".idx") gets one
+	/// "offset;length;hash;name" line per image. Bulk runs then open two files instead
+	/// of one per image, which matters on network file systems.
+	/// </summary>
+	/// <param name="dir">The directory of the images.</param>
+	/// <param name="packName">The pack file to write.</param>
+	/// <returns>0 if no error occured</returns>
+	int create(const std::string &dir, const std::string &packName);
+
+	/// <summary>
+	/// Checks whether a batch input is a pack file.
+	/// </summary>
+	bool isPackFile(std::string name);
+
+	/// <summary>
+	/// Gets the name of the index file of a pack.
+	/// </summary>
+	std::string indexName(const std::string &packName);
+
+	/// <summary>
+	/// Supplies the images of a pack. The pack is memory-mapped and the decoders read
+	/// the encoded images in place, without copying them. The index is read while the
+	/// images are processed. The content hashes of the index are used by the manifest
+	/// instead of hashing the images again.
+	/// </summary>
+	class PackSource : public batch::ImageSource {
+	public:
+		PackSource();
+
+		/// <summary>
+		/// Maps the pack and opens its index.
+		/// </summary>
+		/// <returns>0 if no error occured</returns>
+		int open(const std::string &packName);
+
+		virtual bool next(batch::SourceImage &image);
+
+	private:
+		boost::interprocess::file_mapping file;
+		boost::interprocess::mapped_region region;
+		std::ifstream index;
+		const unsigned char *base; /* first byte of the mapped pack */
+		size_t packLength;
+	};
+}
+
+#endif /* #ifndef PACK_H */
@@ -2,11 +2,16 @@
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
+#include <algorithm>
+
 #include <boost/algorithm/string/trim.hpp>
 
 #include "pipeline.h"
+#include "decode.h"
 #include "facedetection.h"
 #include "textdetection.h"
+#include "metrics.h"
+#include "log.h"
 
 #include "stdio.h"
 
@@ -96,29 +101,213 @@ static void vectorAtoi(std::vector<int>&numbers, std::vector<std::string>&text)
 }
 
 /// <summary>
-/// Resizes input if the width is greater than 1200px.
+/// Sorts the numbers and removes duplicates, as a bib is often read in several chains.
+/// </summary>
+static void uniqueNumbers(std::vector<int>&numbers)
+{
+	std::sort(numbers.begin(), numbers.end());
+	numbers.erase(std::unique(numbers.begin(), numbers.end()), numbers.end());
+}
+
+/* working width is never lowered below this to meet a latency budget */
+#define MIN_WORKING_WIDTH (400)
+/* share of the latency budget which detection may use, the rest is left for OCR */
+#define DETECTION_BUDGET_SHARE (0.6)
+
+/// <summary>
+/// Resizes input if the width is greater than the working width (1200px by default).
 /// </summary>
-cv::Mat ResizeInput(cv::Mat& img)
+cv::Mat ResizeInput(cv::Mat& img, int width = WORKING_WIDTH)
 {
 	cv::Mat resizedImg = img;
-	if (resizedImg.cols > 1200)
+	if (resizedImg.cols > width)
 	{
-		double scale = (double)1200 / resizedImg.cols;
+		double scale = (double)width / resizedImg.cols;
 		resizedImg = cv::Mat(cvRound(img.rows * scale), cvRound(img.cols * scale), img.type());
 		cv::resize(img, resizedImg, resizedImg.size(), 0, 0, cv::INTER_LINEAR);
 	}
 	return resizedImg;
 }
 
+/// <summary>
+/// Updates a moving average, the first sample initializes it.
+/// </summary>
+static void updateAverage(double &average, double sample)
+{
+	average = (average > 0) ? (0.7 * average + 0.3 * sample) : sample;
+}
+
+Pipeline::Pipeline(void) :
+		latencyBudgetMs(0), workingWidth(WORKING_WIDTH),
+		lastDegradation(latency::DEGRADE_NONE),
+		smoothingMsPerMpx(0), detectionMsPerMpx(0) {
+}
+
+/// <summary>
+/// Chooses the degradation steps of an image from the detection times of the
+/// previous images, scaled by image area.
+/// </summary>
+void Pipeline::planDegradation(const cv::Mat& img, latency::Deadline &deadline,
+		int &workingWidth, bool &skipSmoothing)
+{
+	if (smoothingMsPerMpx + detectionMsPerMpx <= 0)
+		return;
+
+	int width = std::min(img.cols, workingWidth);
+	double mpx = (double)width * img.rows * width / img.cols / 1e6;
+	double share = DETECTION_BUDGET_SHARE * deadline.remainingMs();
+
+	double predictedMs = (smoothingMsPerMpx + detectionMsPerMpx) * mpx;
+	if (predictedMs <= share)
+		return;
+	skipSmoothing = true;
+	deadline.degrade(latency::DEGRADE_SKIP_SMOOTHING);
+
+	/* detection time is proportional to the area, so the width scales with the square root */
+	predictedMs = detectionMsPerMpx * mpx;
+	if ((predictedMs <= share) || (predictedMs <= 0))
+		return;
+	int lowerWidth = std::max(MIN_WORKING_WIDTH,
+		(int)(width * sqrt(std::max(share, 0.0) / predictedMs)));
+	if (lowerWidth < width)
+	{
+		workingWidth = lowerWidth;
+		deadline.degrade(latency::DEGRADE_LOWER_RESOLUTION);
+	}
+}
+
+Detection::Detection() :
+		scale(1), detectMs(0) {
+	stats.smoothingMs = 0;
+	stats.totalMs = 0;
+	stats.components = 0;
+}
+
+/// <summary>
+/// Detects text chains in the image, the first phase of processImage.
+/// </summary>
+int Pipeline::detect(
+		cv::Mat& img,
+		std::string svmModel,
+		Detection& detection,
+		double decodeScale) {
+
+	detection.deadline = latency::Deadline(latencyBudgetMs);
+	int width = workingWidth;
+	bool skipSmoothing = false;
+	if (detection.deadline.limited())
+		planDegradation(img, detection.deadline, width, skipSmoothing);
+
+	detection.image = ResizeInput(img, width);
+	if (img.cols > 0)
+		detection.scale = decodeScale * detection.image.cols / img.cols;
+	IplImage ipl_img = detection.image;
+	struct TextDetectionParams params = {
+						1, /* darkOnLight */
+						30, /* maxStrokeLength */
+						11, /* minCharacterHeight */
+						100, /* maxImgWidthToTextRatio */
+						45, /* maxAngle */
+						0, /* topBorder: discard top 10% */
+						0,  /* bottomBorder: discard bottom 5% */
+						3, /* min chain len */
+						0, /* verify with SVM model up to this chain len */
+						0, /* height needs to be this large to verify with model */
+						(int)(img.rows / decodeScale) * 5/1000, /* min connected component height, relative to the original photo */
+						0, /* min SVM score of chains verified with model */
+						0, /* max chains passed to OCR, 0 means all */
+						skipSmoothing /* skip smoothing to meet the latency budget */
+				};
+
+	if (!svmModel.empty())
+	{
+		/* lower min chain len */
+		params.minChainLen = 2;
+		/* verify with SVM model up to this chain len */
+		params.modelVerifLenCrit = 2;
+		/* height needs to be this large to verify with model */
+		params.modelVerifMinHeight = 15;
+		/* short chains need to be classified as bibs */
+		params.modelVerifThreshold = 0;
+		/* OCR only the most bib-like chains */
+		params.modelVerifTopK = 10;
+	}
+
+	detection.params = params;
+
+	struct DetectionStats &stats = detection.stats;
+	textDetector.detect(&ipl_img, detection.params, detection.chains,
+		detection.compBB, detection.chainBB, &detection.deadline, &stats);
+
+	/* learn stage times for planning the degradation of next images */
+	double mpx = (double)detection.image.cols * detection.image.rows / 1e6;
+	if (mpx > 0)
+	{
+		/* smoothing is not interrupted, its time is known even if the detection was truncated */
+		if (!skipSmoothing && (stats.smoothingMs > 0))
+			updateAverage(smoothingMsPerMpx, stats.smoothingMs / mpx);
+		double detectionSample = (stats.totalMs - stats.smoothingMs) / mpx;
+		if (!detection.deadline.truncated())
+			updateAverage(detectionMsPerMpx, detectionSample);
+		else
+			/* a truncated detection takes at least this long, so the estimate may only grow */
+			updateAverage(detectionMsPerMpx, std::max(detectionSample, detectionMsPerMpx));
+	}
+
+	if (LOG_MASK & LOG_IMAGES) {
+		cv::imwrite("face-detection.png", detection.image);
+	}
+
+	detection.detectMs = detection.deadline.elapsedMs();
+	return 0;
+}
+
+/// <summary>
+/// Recognizes the bib numbers of detected chains, the second phase of processImage.
+/// </summary>
+int Pipeline::recognize(
+		Detection& detection,
+		std::string svmModel,
+		std::vector<int>& bibNumbers,
+		std::vector<cv::Rect> *boxes) {
+
+	int64 startTicks = cv::getTickCount();
+	IplImage ipl_img = detection.image;
+	std::vector<std::string> text;
+	size_t nBoxes = (boxes != NULL) ? boxes->size() : 0;
+	/* the time spent in the recognize queue is not work on the image */
+	detection.deadline.resume(detection.detectMs);
+	if (!detection.deadline.checkpoint())
+		textRecognizer.recognize(&ipl_img, detection.params, svmModel, detection.chains,
+			detection.compBB, detection.chainBB, text, &detection.deadline, boxes);
+	vectorAtoi(bibNumbers, text);
+	metrics::lap(metrics::STAGE_RECOGNIZE, startTicks);
+	lastDegradation = detection.deadline.degradation();
+
+	/* boxes are found in the working image, report them in the original photo */
+	if ((boxes != NULL) && (detection.scale > 0)) {
+		for (size_t i = nBoxes; i < boxes->size(); i++) {
+			cv::Rect &box = (*boxes)[i];
+			box = cv::Rect(cvRound(box.x / detection.scale),
+				cvRound(box.y / detection.scale),
+				cvRound(box.width / detection.scale),
+				cvRound(box.height / detection.scale));
+		}
+	}
+
+	return 0;
+}
+
 //Runs detection/recognition algorithm on the input and returns 0 if process is successful.
 // img
 int Pipeline::processImage(
 		cv::Mat& img,
 		std::string svmModel,
-		std::vector<int>& bibNumbers) {
+		std::vector<int>& bibNumbers,
+		double decodeScale) {
 
-	cv::Mat resizedImg = ResizeInput(img);
 #if 0
+	cv::Mat resizedImg = ResizeInput(img);
 	int res;
 	const double scale = 1;
 	std::vector<cv::Rect> faces;
@@ -184,44 +373,94 @@ int Pipeline::processImage(
 			}
 		}
 	}
+	cv::imwrite("face-detection.png", resizedImg);
+
+	return 0;
 #else
-	IplImage ipl_img = resizedImg;
-	std::vector<std::string> text;
-	struct TextDetectionParams params = {
-						1, /* darkOnLight */
-						30, /* maxStrokeLength */
-						11, /* minCharacterHeight */
-						100, /* maxImgWidthToTextRatio */
-						45, /* maxAngle */
-						0, /* topBorder: discard top 10% */
-						0,  /* bottomBorder: discard bottom 5% */
-						3, /* min chain len */
-						0, /* verify with SVM model up to this chain len */
-						0, /* height needs to be this large to verify with model */
-						img.rows * 5/1000
-				};
+	Detection detection;
+	int res = detect(img, svmModel, detection, decodeScale);
+	if (res < 0)
+		return res;
 
-	if (!svmModel.empty())
-	{
-		/* lower min chain len */
-		params.minChainLen = 2;
-		/* verify with SVM model up to this chain len */
-		params.modelVerifLenCrit = 2;
-		/* height needs to be this large to verify with model */
-		params.modelVerifMinHeight = 15;
+	return recognize(detection, svmModel, bibNumbers);
+#endif
+}
+
+void Pipeline::setOcrCache(ocrcache::OcrCache *cache) {
+	textRecognizer.setCache(cache);
+}
+
+void Pipeline::setRegistry(const registry::BibRegistry *registry) {
+	textRecognizer.setRegistry(registry);
+}
+
+void Pipeline::setLatencyBudget(double budgetMs) {
+	latencyBudgetMs = budgetMs;
+}
+
+void Pipeline::setWorkingWidth(int width) {
+	workingWidth = width;
+}
+
+int Pipeline::processEncodedImage(
+		const unsigned char *data,
+		size_t length,
+		std::string svmModel,
+		std::vector<int>& bibNumbers) {
+	double decodeScale;
+	cv::Mat img = decode::decodeImage(data, length, workingWidth, decodeScale);
+	if (img.empty()) {
+		std::cerr << "ERROR: Could not decode image buffer" << std::endl;
+		return -1;
 	}
 
-	std::vector<Chain> chains;
-	std::vector<std::pair<Point2d, Point2d> > compBB;
-	std::vector<std::pair<CvPoint, CvPoint> > chainBB;
-	textDetector.detect(&ipl_img, params, chains, compBB, chainBB);
-	textRecognizer.recognize(&ipl_img, params, svmModel, chains, compBB, chainBB, text);
-	vectorAtoi(bibNumbers, text);
-#endif
-	cv::imwrite("face-detection.png", resizedImg);
+	int res = processImage(img, svmModel, bibNumbers, decodeScale);
+	uniqueNumbers(bibNumbers);
+	return res;
+}
 
-	return 0;
+int Pipeline::processPixels(
+		const unsigned char *pixels,
+		int width,
+		int height,
+		int channels,
+		size_t stride,
+		std::string svmModel,
+		std::vector<int>& bibNumbers) {
+	if ((pixels == NULL) || (width <= 0) || (height <= 0)
+			|| ((channels != 1) && (channels != 3) && (channels != 4))
+			|| ((stride != 0) && (stride < (size_t) width * channels))) {
+		std::cerr << "ERROR: Invalid pixel buffer" << std::endl;
+		return -1;
+	}
+
+	/* header only, the caller's pixels are not copied */
+	cv::Mat pixelsMat(height, width, CV_8UC(channels), (void *) pixels,
+			stride ? stride : cv::Mat::AUTO_STEP);
+
+	cv::Mat img;
+	if (channels == 1) {
+		cv::cvtColor(pixelsMat, img, CV_GRAY2BGR);
+	} else if (channels == 4) {
+		cv::cvtColor(pixelsMat, img, CV_BGRA2BGR);
+	} else if (width <= workingWidth) {
+		/* not resized, detection would smooth the caller's pixels */
+		img = pixelsMat.clone();
+	} else {
+		img = pixelsMat;
+	}
+
+	int res = processImage(img, svmModel, bibNumbers);
+	uniqueNumbers(bibNumbers);
+	return res;
+}
+
+int Pipeline::degradation() const {
+	return lastDegradation;
+}
 
+int Pipeline::loadModel(const std::string &svmModel) {
+	return textRecognizer.loadModel(svmModel);
 }
 
 } /* namespace pipeline */
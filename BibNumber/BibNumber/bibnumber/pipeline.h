@@ -4,22 +4,152 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "textdetection.h"
 #include "textrecognition.h"
+#include "ocrcache.h"
+#include "registry.h"
+#include "deadline.h"
+
+/* width images are processed at */
+#define WORKING_WIDTH (1200)
+
+/* version of the results, to be increased by changes which alter the bib numbers read */
+#define PIPELINE_VERSION "1"
 
 namespace pipeline
 {
+	/// <summary>
+	/// Intermediate result of the detection phase of an image, passed to the recognition phase.
+	/// </summary>
+	struct Detection {
+		Detection();
+		cv::Mat image; /* working image the chains were detected in */
+		double scale; /* size of the working image relative to the original photo */
+		struct TextDetectionParams params;
+		std::vector<Chain> chains;
+		std::vector<std::pair<Point2d, Point2d> > compBB;
+		std::vector<std::pair<CvPoint, CvPoint> > chainBB;
+		latency::Deadline deadline; /* started when the detection begins, resumed by the recognition */
+		double detectMs; /* budget used by the detection, excluding any wait before the recognition */
+		struct DetectionStats stats; /* stage times and component count of the detection */
+	};
+
 	class Pipeline {
 	public:		
+		Pipeline(void);
+
 		/// <summary>
 		/// Processes the image to detect and recognize bib numbers.
 		/// </summary>
 		/// <param name="img">The image that is used to detect and recognize bibnumbers</param>
 		/// <param name="svmModel">The SVM model.</param>
 		/// <param name="bibNumbers">The collection of found bibnumbers.</param>
+		/// <param name="decodeScale">Scale the image was decoded at relative to the original photo.</param>
+		/// <returns>0 if no error occured during the process.</returns>
+		int processImage(cv::Mat& img, std::string svmModel, std::vector<int>& bibNumbers,
+			double decodeScale = 1);
+
+		/// <summary>
+		/// Processes an encoded image (JPEG, PNG, ...) held in memory, for callers which
+		/// receive photos over the network. The data is neither copied nor modified, and
+		/// large JPEG images are decoded at reduced size like files in batch mode.
+		/// Concurrent calls must use different pipelines.
+		/// </summary>
+		/// <param name="data">The encoded image, owned by the caller.</param>
+		/// <param name="length">Length of the encoded image in bytes.</param>
+		/// <param name="svmModel">The SVM model.</param>
+		/// <param name="bibNumbers">The collection of found bibnumbers, sorted, each number once.</param>
+		/// <returns>0 if no error occured during the process, -1 if the image could not be decoded.</returns>
+		int processEncodedImage(const unsigned char *data, size_t length,
+			std::string svmModel, std::vector<int>& bibNumbers);
+
+		/// <summary>
+		/// Processes a decoded image held in a caller owned pixel buffer. The pixels are
+		/// only read: images wider than the working width are resized into a new working
+		/// image, smaller ones are copied once since detection smooths the working image in
+		/// place. Concurrent calls must use different pipelines.
+		/// </summary>
+		/// <param name="pixels">The first row of pixels, 8 bits per channel.</param>
+		/// <param name="width">Width of the image in pixels.</param>
+		/// <param name="height">Height of the image in pixels.</param>
+		/// <param name="channels">1 (gray), 3 (BGR) or 4 (BGRA).</param>
+		/// <param name="stride">Distance between two rows in bytes, 0 for packed rows.</param>
+		/// <param name="svmModel">The SVM model.</param>
+		/// <param name="bibNumbers">The collection of found bibnumbers, sorted, each number once.</param>
+		/// <returns>0 if no error occured during the process, -1 if the buffer is invalid.</returns>
+		int processPixels(const unsigned char *pixels, int width, int height,
+			int channels, size_t stride, std::string svmModel,
+			std::vector<int>& bibNumbers);
+
+		/// <summary>
+		/// Detects text chains in the image, the first phase of processImage.
+		/// Only the text detector is used, so detect and recognize can run at the same
+		/// time in different threads on different images.
+		/// </summary>
+		/// <param name="img">The image that is used to detect bibnumbers</param>
+		/// <param name="svmModel">The SVM model.</param>
+		/// <param name="detection">Filled with the detected chains.</param>
+		/// <param name="decodeScale">Scale the image was decoded at relative to the original photo.</param>
 		/// <returns>0 if no error occured during the process.</returns>
-		int processImage(cv::Mat& img, std::string svmModel, std::vector<int>& bibNumbers);
+		int detect(cv::Mat& img, std::string svmModel, Detection& detection,
+			double decodeScale = 1);
+
+		/// <summary>
+		/// Recognizes the bib numbers of detected chains with Tesseract, the second phase of processImage.
+		/// </summary>
+		/// <param name="detection">The result of the detection phase.</param>
+		/// <param name="svmModel">The SVM model.</param>
+		/// <param name="bibNumbers">The collection of found bibnumbers.</param>
+		/// <param name="boxes">Filled with the area of every found bibnumber in the original photo if not NULL.</param>
+		/// <returns>0 if no error occured during the process.</returns>
+		int recognize(Detection& detection, std::string svmModel, std::vector<int>& bibNumbers,
+			std::vector<cv::Rect> *boxes = NULL);
+
+		/// <summary>
+		/// Sets the OCR result cache, which may be shared between pipelines. NULL disables caching.
+		/// </summary>
+		void setOcrCache(ocrcache::OcrCache *cache);
+
+		/// <summary>
+		/// Sets the registry of valid bib numbers of the event. NULL accepts any number.
+		/// </summary>
+		void setRegistry(const registry::BibRegistry *registry);
+
+		/// <summary>
+		/// Sets the latency budget of one image. When an image is predicted to run over
+		/// the budget, smoothing is skipped, the working resolution is lowered and fewer
+		/// chains are passed to OCR. Processing stops with partial results when the
+		/// budget is exhausted.
+		/// </summary>
+		/// <param name="budgetMs">The budget in milliseconds, 0 means unlimited.</param>
+		void setLatencyBudget(double budgetMs);
+
+		/// <summary>
+		/// Sets the width images are resized to for detection, WORKING_WIDTH by default.
+		/// Smaller widths trade small bibs for speed.
+		/// </summary>
+		void setWorkingWidth(int width);
+
+		/// <summary>
+		/// Gets the degradation steps (latency::Degradation flags) taken for the last image.
+		/// </summary>
+		int degradation() const;
+
+		/// <summary>
+		/// Loads the SVM model ahead of the first image, so a daemon pays for it at start
+		/// and forked workers share it.
+		/// </summary>
+		/// <returns>0 if the model was loaded</returns>
+		int loadModel(const std::string &svmModel);
 	private:
+		void planDegradation(const cv::Mat& img, latency::Deadline &deadline,
+			int &workingWidth, bool &skipSmoothing);
+
 		textdetection::TextDetector textDetector;
 		textrecognition::TextRecognizer textRecognizer;
+		double latencyBudgetMs;
+		int workingWidth;
+		int lastDegradation;
+		double smoothingMsPerMpx; /* moving averages of stage times, 0 if unknown */
+		double detectionMsPerMpx; /* detection time without smoothing */
 	};
 
 }
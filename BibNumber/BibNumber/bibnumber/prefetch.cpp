@@ -0,0 +1,123 @@
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "prefetch.h"
+#include "manifest.h"
+#include "deadline.h"
+
+/* bytes between two touched bytes of an image in memory, a page or less */
+#define TOUCH_STRIDE (4096)
+
+namespace batch {
+
+PrefetchSource::Slot::Slot() :
+		ready(false) {
+}
+
+PrefetchSource::PrefetchSource(ImageSource &source, size_t window,
+		size_t maxBytes, unsigned int threads) :
+		source(source), window(window), maxBytes(maxBytes),
+		bytes(0), peakBytes(0), supplied(0), ready(0), waitMs(0),
+		sourceDone(false), stopping(false) {
+	if (window == 0)
+		return;
+	for (unsigned int k = 0; k < std::max(1u, threads); k++) {
+		readers.create_thread(boost::bind(&PrefetchSource::reader, this));
+	}
+}
+
+PrefetchSource::~PrefetchSource() {
+	{
+		boost::lock_guard<boost::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	readers.join_all();
+}
+
+void PrefetchSource::reader() {
+	for (;;) {
+		SlotPtr slot(new Slot());
+		{
+			boost::unique_lock<boost::mutex> lock(mutex);
+			while (!stopping && !sourceDone
+					&& ((slots.size() >= window) || (bytes >= maxBytes)))
+				changed.wait(lock);
+			if (stopping || sourceDone)
+				return;
+
+			/* the slot keeps the order of the source */
+			if (!source.next(slot->image)) {
+				sourceDone = true;
+				changed.notify_all();
+				return;
+			}
+			slots.push_back(slot);
+		}
+
+		SourceImage &image = slot->image;
+		size_t length = 0;
+		if (image.data == NULL) {
+			boost::shared_ptr<std::vector<unsigned char> > buffer(
+					new std::vector<unsigned char>());
+			/* a file which cannot be read is reported by the decoder */
+			if (manifest::readFile(image.path.string(), *buffer)
+					&& !buffer->empty()) {
+				image.buffer = buffer;
+				image.data = &(*buffer)[0];
+				image.length = buffer->size();
+				length = buffer->size();
+			}
+		} else {
+			volatile unsigned char sum = 0;
+			for (size_t i = 0; i < image.length; i += TOUCH_STRIDE)
+				sum += image.data[i];
+		}
+
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			slot->ready = true;
+			bytes += length;
+			peakBytes = std::max(peakBytes, bytes);
+		}
+		changed.notify_all();
+	}
+}
+
+bool PrefetchSource::next(SourceImage &image) {
+	if (window == 0)
+		return source.next(image);
+
+	boost::unique_lock<boost::mutex> lock(mutex);
+	int64 start = cv::getTickCount();
+	bool waited = false;
+	while ((slots.empty() && !sourceDone) || (!slots.empty() && !slots.front()->ready)) {
+		waited = true;
+		changed.wait(lock);
+	}
+	if (waited)
+		waitMs += latency::elapsedMs(start);
+	if (slots.empty())
+		return false;
+
+	SlotPtr slot = slots.front();
+	slots.pop_front();
+	if (slot->image.buffer)
+		bytes -= slot->image.length;
+	image = slot->image;
+	supplied++;
+	if (!waited)
+		ready++;
+	changed.notify_all();
+	return true;
+}
+
+void PrefetchSource::printStats(std::ostream &out) {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	out << "Prefetch: window=" << window << " images=" << supplied
+			<< " ready=" << ready << " wait=" << waitMs << " ms peak="
+			<< peakBytes / (1024 * 1024) << " MB" << std::endl;
+}
+
+} /* namespace batch */
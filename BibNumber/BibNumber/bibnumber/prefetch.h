@@ -0,0 +1,79 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "imagesource.h"
+
+/* default count of reader threads, reads of slow storage overlap */
+#define PREFETCH_THREADS (4)
+
+namespace batch
+{
+	/// <summary>
+	/// Reads the upcoming images of a source into memory on background threads, so
+	/// the decoders do not wait for slow storage. Up to window images, and about
+	/// maxBytes of encoded data, are held ahead of the decoders; a reader may go over
+	/// the byte limit by the size of the image it is reading. Images the source holds
+	/// in memory already, e.g. the images of a mapped pack, have their pages touched
+	/// instead so they are faulted in ahead. Images are supplied in the order of the
+	/// source. A window of 0 disables read-ahead and takes the images from the source
+	/// when they are asked for.
+	/// </summary>
+	class PrefetchSource : public ImageSource {
+	public:
+		/// <summary>
+		/// Starts the readers.
+		/// </summary>
+		/// <param name="source">The images to read ahead.</param>
+		/// <param name="window">Count of images held ahead, 0 to read no image ahead.</param>
+		/// <param name="maxBytes">Bytes of encoded images held ahead.</param>
+		/// <param name="threads">Count of reader threads.</param>
+		PrefetchSource(ImageSource &source, size_t window, size_t maxBytes,
+				unsigned int threads = PREFETCH_THREADS);
+
+		/// <summary>
+		/// Stops the readers.
+		/// </summary>
+		~PrefetchSource();
+
+		virtual bool next(SourceImage &image);
+
+		/// <summary>
+		/// Prints how often the decoders found the next image ready, the time they
+		/// waited for reads and the most memory held.
+		/// </summary>
+		void printStats(std::ostream &out);
+
+	private:
+		struct Slot {
+			Slot();
+			SourceImage image;
+			bool ready;
+		};
+		typedef boost::shared_ptr<Slot> SlotPtr;
+
+		void reader();
+
+		ImageSource &source;
+		size_t window;
+		size_t maxBytes;
+		std::deque<SlotPtr> slots; /* images taken from the source, in order */
+		size_t bytes; /* encoded bytes read and not supplied yet */
+		size_t peakBytes;
+		size_t supplied;
+		size_t ready; /* images which were read when supplied */
+		double waitMs;
+		bool sourceDone;
+		bool stopping;
+		boost::mutex mutex;
+		boost::condition_variable changed;
+		boost::thread_group readers;
+	};
+}
+
+#endif /* #ifndef PREFETCH_H */
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cctype>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include "registry.h"
+
+/* largest supported bib number, keeps the bitset below 2 MB */
+#define MAX_BIB_NUMBER (9999999)
+
+/// <summary>
+/// Checks if the string consists of digits only.
+/// </summary>
+static bool is_number(const std::string& s) {
+	std::string::const_iterator it = s.begin();
+	while (it != s.end() && std::isdigit((unsigned char) *it))
+		++it;
+	return !s.empty() && it == s.end();
+}
+
+/// <summary>
+/// Spreads the bits of a bib number over a 64 bit value (splitmix64 finalizer).
+/// </summary>
+static boost::uint64_t mix(boost::uint64_t value) {
+	value += 0x9E3779B97F4A7C15ULL;
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+	return value ^ (value >> 31);
+}
+
+namespace registry {
+
+BibRegistry::BibRegistry() :
+		lengthMask(0), digitMask(0), count(0), hash(0) {
+}
+
+int BibRegistry::load(const std::string &fileName) {
+	std::ifstream file(fileName.c_str());
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not open bib registry " << fileName
+				<< std::endl;
+		return -1;
+	}
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::string cell = line.substr(0, line.find_first_of(";,"));
+		boost::algorithm::trim(cell);
+		if (!is_number(cell) || (cell.size() > 7)) {
+			continue;
+		}
+		if (!add((unsigned int) atoi(cell.c_str()))) {
+			std::cerr << "ERROR: Bib number out of range " << cell << std::endl;
+		}
+	}
+
+	std::cout << "Loaded " << count << " registered bib numbers from "
+			<< fileName << std::endl;
+	return 0;
+}
+
+bool BibRegistry::add(unsigned int bib) {
+	if (bib > MAX_BIB_NUMBER)
+		return false;
+
+	if (bib >= bibs.size())
+		bibs.resize(bib + 1, false);
+	if (bibs[bib])
+		return true;
+
+	bibs[bib] = true;
+	count++;
+	hash ^= mix(bib);
+
+	unsigned int nDigits = 0;
+	do {
+		digitMask |= 1 << (bib % 10);
+		bib /= 10;
+		nDigits++;
+	} while (bib);
+	lengthMask |= 1 << nDigits;
+
+	return true;
+}
+
+bool BibRegistry::contains(const std::string &text) const {
+	/* bib numbers never start with '0' */
+	if (!is_number(text) || (text[0] == '0') || (text.size() > 7))
+		return false;
+
+	unsigned int bib = (unsigned int) atoi(text.c_str());
+	return (bib < bibs.size()) && bibs[bib];
+}
+
+size_t BibRegistry::minLength() const {
+	for (size_t n = 1; n < 32; n++) {
+		if (lengthMask & (1 << n))
+			return n;
+	}
+	return 0;
+}
+
+size_t BibRegistry::maxLength() const {
+	for (size_t n = 31; n > 0; n--) {
+		if (lengthMask & (1 << n))
+			return n;
+	}
+	return 0;
+}
+
+std::string BibRegistry::digits() const {
+	std::string result;
+	for (int d = 0; d < 10; d++) {
+		if (digitMask & (1 << d))
+			result += (char) ('0' + d);
+	}
+	return result;
+}
+
+boost::uint64_t BibRegistry::key() const {
+	return hash;
+}
+
+size_t BibRegistry::size() const {
+	return count;
+}
+
+bool BibRegistry::empty() const {
+	return count == 0;
+}
+
+} /* namespace registry */
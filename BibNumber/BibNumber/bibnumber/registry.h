@@ -0,0 +1,71 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+namespace registry
+{
+	/// <summary>
+	/// Set of the bib numbers registered for an event, stored as a bitset indexed by bib number.
+	/// Used to reject chains before OCR and to verify OCR output.
+	/// </summary>
+	class BibRegistry {
+	public:
+		BibRegistry();
+
+		/// <summary>
+		/// Loads bib numbers from a file. The first ';' or ',' separated cell of
+		/// every line is used, lines where it is not a number (e.g. headers) are skipped.
+		/// </summary>
+		/// <param name="fileName">registry file</param>
+		/// <returns>0 if no error occured</returns>
+		int load(const std::string &fileName);
+
+		/// <summary>
+		/// Adds a bib number to the registry.
+		/// </summary>
+		/// <returns>false if the number is out of the supported range</returns>
+		bool add(unsigned int bib);
+
+		/// <summary>
+		/// Checks if the recognized text is a registered bib number.
+		/// </summary>
+		bool contains(const std::string &text) const;
+
+		/// <summary>
+		/// Gets the count of digits of the shortest registered bib number, 0 if empty.
+		/// </summary>
+		size_t minLength() const;
+
+		/// <summary>
+		/// Gets the count of digits of the longest registered bib number, 0 if empty.
+		/// </summary>
+		size_t maxLength() const;
+
+		/// <summary>
+		/// Gets the digits used by registered bib numbers, suitable as an OCR character whitelist.
+		/// </summary>
+		std::string digits() const;
+
+		/// <summary>
+		/// Gets a hash of the registered bib numbers, independent of their order and 0
+		/// for an empty registry. OCR results depend on the registry, so it is mixed
+		/// into the OCR cache keys.
+		/// </summary>
+		boost::uint64_t key() const;
+
+		size_t size() const;
+		bool empty() const;
+
+	private:
+		std::vector<bool> bibs;
+		unsigned int lengthMask; /* bit n is set if a registered bib has n digits */
+		unsigned int digitMask; /* bit d is set if digit d is used */
+		size_t count;
+		boost::uint64_t hash; /* xor of the mixed registered bib numbers */
+	};
+}
+
+#endif /* #ifndef REGISTRY_H */
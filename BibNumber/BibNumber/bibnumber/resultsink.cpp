@@ -0,0 +1,531 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <queue>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include "resultsink.h"
+#include "deadline.h"
+
+/* count of run files merged at once, bounds the open files and merge buffers */
+#define MERGE_FAN_IN (16)
+
+namespace results {
+
+ImageRecord::ImageRecord() :
+		index(0), degradation(0) {
+}
+
+ResultSink::ResultSink(size_t flushRecords, double flushIntervalMs) :
+		flushRecords(flushRecords), flushIntervalMs(flushIntervalMs),
+		written(0), pending(0), flushCount(0), lastFlush(0) {
+}
+
+ResultSink::~ResultSink() {
+	close();
+}
+
+int ResultSink::open(const std::string &fileName, bool append) {
+	/* a record cut by a crash must not run into the first appended one */
+	bool truncated = false;
+	if (append) {
+		std::ifstream existing(fileName.c_str(), std::ios::binary);
+		if (existing.is_open() && existing.seekg(-1, std::ios::end)) {
+			truncated = (existing.get() != '\n');
+		}
+	}
+
+	file.open(fileName.c_str(),
+			append ? (std::ios::out | std::ios::app) : std::ios::out);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not open result stream " << fileName
+				<< std::endl;
+		return -1;
+	}
+	if (truncated)
+		file << '\n';
+	lastFlush = cv::getTickCount();
+	return 0;
+}
+
+int ResultSink::append(const ImageRecord &record) {
+	if (!file.is_open())
+		return -1;
+
+	file << formatRecord(record) << '\n';
+	written++;
+	pending++;
+	if (((flushRecords > 0) && (pending >= flushRecords))
+			|| ((flushIntervalMs > 0)
+					&& (latency::elapsedMs(lastFlush) >= flushIntervalMs))) {
+		flush();
+	}
+	return file.good() ? 0 : -1;
+}
+
+void ResultSink::flush() {
+	file.flush();
+	pending = 0;
+	flushCount++;
+	lastFlush = cv::getTickCount();
+}
+
+void ResultSink::close() {
+	if (!file.is_open())
+		return;
+	if (pending > 0)
+		flush();
+	file.close();
+}
+
+size_t ResultSink::records() const {
+	return written;
+}
+
+size_t ResultSink::flushes() const {
+	return flushCount;
+}
+
+static void appendEscaped(std::string &out, const std::string &text) {
+	for (std::string::const_iterator it = text.begin(); it != text.end(); ++it) {
+		unsigned char c = *it;
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\r':
+			out += "\\r";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			if (c < 0x20) {
+				char code[8];
+				sprintf(code, "\\u%04x", c);
+				out += code;
+			} else {
+				out += (char) c;
+			}
+		}
+	}
+}
+
+std::string escapeJson(const std::string &text) {
+	std::string escaped;
+	appendEscaped(escaped, text);
+	return escaped;
+}
+
+std::string formatRecord(const ImageRecord &record) {
+	std::ostringstream line;
+	line << "{\"index\":" << record.index << ",\"image\":\"";
+	std::string image;
+	appendEscaped(image, record.image);
+	line << image << "\",\"bibs\":[";
+	for (size_t i = 0; i < record.bibNumbers.size(); i++) {
+		if (i > 0)
+			line << ",";
+		line << record.bibNumbers[i];
+	}
+	line << "],\"degradation\":" << record.degradation;
+	if (!record.hash.empty()) {
+		line << ",\"hash\":\"" << record.hash << "\",\"version\":\"";
+		std::string version;
+		appendEscaped(version, record.version);
+		line << version << "\"";
+	}
+	line << "}";
+	return line.str();
+}
+
+/// <summary>
+/// Skips past the given key, searching from pos.
+/// </summary>
+static bool findKey(const std::string &line, const char *key, size_t &pos) {
+	size_t found = line.find(key, pos);
+	if (found == std::string::npos)
+		return false;
+	pos = found + strlen(key);
+	return true;
+}
+
+/// <summary>
+/// Reads the four hex digits of a \u escape at pos.
+/// </summary>
+static bool readHex4(const std::string &line, size_t &pos, unsigned int &code) {
+	if (pos + 4 > line.size())
+		return false;
+	code = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = line[pos++];
+		code <<= 4;
+		if ((c >= '0') && (c <= '9'))
+			code |= c - '0';
+		else if ((c >= 'a') && (c <= 'f'))
+			code |= c - 'a' + 10;
+		else if ((c >= 'A') && (c <= 'F'))
+			code |= c - 'A' + 10;
+		else
+			return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Appends a code point encoded as UTF-8.
+/// </summary>
+static void appendUtf8(std::string &value, unsigned int code) {
+	if (code < 0x80) {
+		value += (char) code;
+	} else if (code < 0x800) {
+		value += (char) (0xC0 | (code >> 6));
+		value += (char) (0x80 | (code & 0x3F));
+	} else if (code < 0x10000) {
+		value += (char) (0xE0 | (code >> 12));
+		value += (char) (0x80 | ((code >> 6) & 0x3F));
+		value += (char) (0x80 | (code & 0x3F));
+	} else {
+		value += (char) (0xF0 | (code >> 18));
+		value += (char) (0x80 | ((code >> 12) & 0x3F));
+		value += (char) (0x80 | ((code >> 6) & 0x3F));
+		value += (char) (0x80 | (code & 0x3F));
+	}
+}
+
+/// <summary>
+/// Reads a JSON string value, pos is after the opening quote and ends after the closing one.
+/// \u escapes are decoded to UTF-8, characters outside the BMP from their surrogate pair.
+/// </summary>
+static bool readString(const std::string &line, size_t &pos, std::string &value) {
+	value.clear();
+	while (pos < line.size()) {
+		char c = line[pos++];
+		if (c == '"')
+			return true;
+		if (c != '\\') {
+			value += c;
+			continue;
+		}
+		if (pos >= line.size())
+			return false;
+		c = line[pos++];
+		switch (c) {
+		case 'n':
+			value += '\n';
+			break;
+		case 'r':
+			value += '\r';
+			break;
+		case 't':
+			value += '\t';
+			break;
+		case 'b':
+			value += '\b';
+			break;
+		case 'f':
+			value += '\f';
+			break;
+		case 'u': {
+			unsigned int code;
+			if (!readHex4(line, pos, code) || ((code >= 0xDC00) && (code <= 0xDFFF)))
+				return false;
+			if ((code >= 0xD800) && (code <= 0xDBFF)) {
+				if (line.compare(pos, 2, "\\u") != 0)
+					return false;
+				pos += 2;
+				unsigned int low;
+				if (!readHex4(line, pos, low) || (low < 0xDC00) || (low > 0xDFFF))
+					return false;
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+			}
+			appendUtf8(value, code);
+			break;
+		}
+		case '"':
+		case '\\':
+		case '/':
+			value += c;
+			break;
+		default:
+			return false;
+		}
+	}
+	return false;
+}
+
+bool parseRecord(const std::string &line, ImageRecord &record) {
+	size_t pos = 0;
+	if (!findKey(line, "\"index\":", pos))
+		return false;
+	record.index = strtoul(line.c_str() + pos, NULL, 10);
+
+	if (!findKey(line, "\"image\":\"", pos)
+			|| !readString(line, pos, record.image))
+		return false;
+
+	if (!findKey(line, "\"bibs\":[", pos))
+		return false;
+	record.bibNumbers.clear();
+	while ((pos < line.size()) && (line[pos] != ']')) {
+		char *end;
+		long bib = strtol(line.c_str() + pos, &end, 10);
+		if (end == line.c_str() + pos)
+			return false;
+		record.bibNumbers.push_back((int) bib);
+		pos = end - line.c_str();
+		if ((pos < line.size()) && (line[pos] == ','))
+			pos++;
+	}
+	if (pos >= line.size())
+		return false;
+
+	if (!findKey(line, "\"degradation\":", pos))
+		return false;
+	record.degradation = atoi(line.c_str() + pos);
+
+	/* content hash and version are missing in streams of older runs */
+	record.hash.clear();
+	record.version.clear();
+	size_t hashPos = pos;
+	if (findKey(line, "\"hash\":\"", hashPos)) {
+		pos = hashPos;
+		if (!readString(line, pos, record.hash)
+				|| !findKey(line, "\"version\":\"", pos)
+				|| !readString(line, pos, record.version))
+			return false;
+	}
+
+	/* a record cut by a crash has no closing brace */
+	return line.find('}', pos) != std::string::npos;
+}
+
+bool parseStringList(const std::string &text, std::vector<std::string> &values) {
+	values.clear();
+	size_t pos = text.find_first_not_of(" \t\r\n");
+	if ((pos == std::string::npos) || (text[pos] != '['))
+		return false;
+	pos++;
+	bool expectValue = true; /* a string or, before the first one, the end */
+	while (pos < text.size()) {
+		char c = text[pos++];
+		if (isspace((unsigned char) c))
+			continue;
+		if ((c == ']') && (expectValue == values.empty()))
+			return text.find_first_not_of(" \t\r\n", pos) == std::string::npos;
+		if (expectValue && (c == '"')) {
+			std::string value;
+			if (!readString(text, pos, value))
+				return false;
+			values.push_back(value);
+			expectValue = false;
+		} else if (!expectValue && (c == ',')) {
+			expectValue = true;
+		} else {
+			return false;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// A bib number read in an image, the unit of the external sort.
+/// </summary>
+struct BibPair {
+	int bib;
+	size_t index;
+	std::string image;
+
+	bool operator<(const BibPair &other) const {
+		if (bib != other.bib)
+			return bib < other.bib;
+		return index < other.index;
+	}
+	bool operator>(const BibPair &other) const {
+		return other < *this;
+	}
+};
+
+static void writePair(std::ostream &out, const BibPair &pair) {
+	out << pair.bib << '\t' << pair.index << '\t' << pair.image << '\n';
+}
+
+static bool readPair(std::istream &in, BibPair &pair) {
+	std::string line;
+	if (!std::getline(in, line))
+		return false;
+	size_t first = line.find('\t');
+	size_t second = line.find('\t', first + 1);
+	if ((first == std::string::npos) || (second == std::string::npos))
+		return false;
+	pair.bib = atoi(line.c_str());
+	pair.index = strtoul(line.c_str() + first + 1, NULL, 10);
+	pair.image = line.substr(second + 1);
+	return true;
+}
+
+/// <summary>
+/// Sorts the buffered pairs and spills them to a new run file.
+/// </summary>
+static int spillRun(std::vector<BibPair> &pairs, const std::string &prefix,
+		std::vector<std::string> &runs) {
+	std::ostringstream name;
+	name << prefix << ".run" << runs.size();
+	std::ofstream run(name.str().c_str());
+	if (!run.is_open()) {
+		std::cerr << "ERROR: Could not write run file " << name.str()
+				<< std::endl;
+		return -1;
+	}
+
+	std::sort(pairs.begin(), pairs.end());
+	for (size_t i = 0; i < pairs.size(); i++)
+		writePair(run, pairs[i]);
+	pairs.clear();
+	runs.push_back(name.str());
+	return run.good() ? 0 : -1;
+}
+
+/// <summary>
+/// Writes the bib to images index: each bib starts a new line followed by its images.
+/// </summary>
+class IndexWriter {
+public:
+	IndexWriter(std::ostream &out) :
+			out(out), first(true), currentBib(0) {
+	}
+	void write(const BibPair &pair) {
+		if (first || (pair.bib != currentBib)) {
+			first = false;
+			currentBib = pair.bib;
+			out << std::endl << currentBib << ",";
+		}
+		out << pair.image << ",";
+	}
+private:
+	std::ostream &out;
+	bool first;
+	int currentBib;
+};
+
+typedef std::pair<BibPair, size_t> MergeHead; /* next pair of a run and the run */
+
+struct MergeHeadGreater {
+	bool operator()(const MergeHead &a, const MergeHead &b) const {
+		return a.first > b.first;
+	}
+};
+
+/// <summary>
+/// Merges sorted runs, into a run file or into the index when index is not NULL.
+/// </summary>
+static int mergeRuns(const std::vector<std::string> &runs, std::ostream *runOut,
+		IndexWriter *index) {
+	boost::ptr_vector<std::ifstream> inputs;
+	std::priority_queue<MergeHead, std::vector<MergeHead>, MergeHeadGreater> heads;
+	for (size_t r = 0; r < runs.size(); r++) {
+		inputs.push_back(new std::ifstream(runs[r].c_str()));
+		if (!inputs[r].is_open()) {
+			std::cerr << "ERROR: Could not read run file " << runs[r]
+					<< std::endl;
+			return -1;
+		}
+		BibPair pair;
+		if (readPair(inputs[r], pair))
+			heads.push(MergeHead(pair, r));
+	}
+
+	while (!heads.empty()) {
+		MergeHead head = heads.top();
+		heads.pop();
+		if (index != NULL)
+			index->write(head.first);
+		else
+			writePair(*runOut, head.first);
+
+		BibPair pair;
+		if (readPair(inputs[head.second], pair))
+			heads.push(MergeHead(pair, head.second));
+	}
+
+	inputs.clear();
+	for (size_t r = 0; r < runs.size(); r++)
+		remove(runs[r].c_str());
+	return 0;
+}
+
+int writeBibIndex(const std::string &streamFileName,
+		const std::string &csvFileName, size_t runPairs) {
+	std::ifstream stream(streamFileName.c_str());
+	if (!stream.is_open()) {
+		std::cerr << "ERROR: Could not read result stream " << streamFileName
+				<< std::endl;
+		return -1;
+	}
+	if (runPairs == 0)
+		runPairs = 1;
+
+	/* split the stream into sorted runs */
+	std::vector<std::string> runs;
+	std::vector<BibPair> pairs;
+	std::string line;
+	ImageRecord record;
+	while (std::getline(stream, line)) {
+		if (!parseRecord(line, record))
+			continue;
+		for (size_t i = 0; i < record.bibNumbers.size(); i++) {
+			BibPair pair;
+			pair.bib = record.bibNumbers[i];
+			pair.index = record.index;
+			pair.image = record.image;
+			pairs.push_back(pair);
+			if ((pairs.size() >= runPairs)
+					&& (spillRun(pairs, csvFileName, runs) < 0))
+				return -1;
+		}
+	}
+	if (!pairs.empty() && (spillRun(pairs, csvFileName, runs) < 0))
+		return -1;
+
+	/* merge MERGE_FAN_IN runs at a time until one pass is left */
+	size_t nextRun = runs.size();
+	while (runs.size() > MERGE_FAN_IN) {
+		std::vector<std::string> group(runs.begin(), runs.begin() + MERGE_FAN_IN);
+		runs.erase(runs.begin(), runs.begin() + MERGE_FAN_IN);
+
+		std::ostringstream name;
+		name << csvFileName << ".run" << nextRun++;
+		std::ofstream merged(name.str().c_str());
+		if (!merged.is_open()) {
+			std::cerr << "ERROR: Could not write run file " << name.str()
+					<< std::endl;
+			return -1;
+		}
+		if (mergeRuns(group, &merged, NULL) < 0)
+			return -1;
+		runs.push_back(name.str());
+	}
+
+	std::ofstream csv(csvFileName.c_str());
+	if (!csv.is_open()) {
+		std::cerr << "ERROR: Could not write " << csvFileName << std::endl;
+		return -1;
+	}
+	IndexWriter index(csv);
+	if (mergeRuns(runs, NULL, &index) < 0)
+		return -1;
+	return csv.good() ? 0 : -1;
+}
+
+} /* namespace results */
@@ -0,0 +1,113 @@
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "opencv2/core/core.hpp"
+
+namespace results
+{
+	/// <summary>
+	/// Result of one image as stored in the JSON-lines stream.
+	/// </summary>
+	struct ImageRecord {
+		ImageRecord();
+		size_t index; /* position of the image in the processing order */
+		std::string image; /* path of the image */
+		std::vector<int> bibNumbers;
+		int degradation; /* latency::Degradation flags */
+		std::string hash; /* content hash of the image, empty if unknown */
+		std::string version; /* version of the pipeline and parameters */
+	};
+
+	/// <summary>
+	/// Appends one JSON object per processed image to a file, e.g.
+	/// {"index":3,"image":"album/IMG_0035.JPG","bibs":[164,773],"degradation":0,
+	///  "hash":"9f3c4e1a2b7d6e05","version":"1/5a0e3c9d12f4b877"}
+	/// Records are written as soon as an image is done and flushed every few
+	/// records or milliseconds, so a crash loses at most the unflushed tail and
+	/// memory does not grow with the count of images.
+	/// </summary>
+	class ResultSink {
+	public:
+		/// <summary>
+		/// Creates the sink, open() must be called before appending.
+		/// </summary>
+		/// <param name="flushRecords">The stream is flushed after this count of records, 0 leaves flushing to the stream buffer.</param>
+		/// <param name="flushIntervalMs">The stream is also flushed when a record is appended this long after the last flush, 0 disables it.</param>
+		ResultSink(size_t flushRecords = 1, double flushIntervalMs = 0);
+		~ResultSink();
+
+		/// <summary>
+		/// Opens the stream file.
+		/// </summary>
+		/// <param name="append">true to append to the records of a previous run, false to truncate the file.</param>
+		/// <returns>0 if no error occured</returns>
+		int open(const std::string &fileName, bool append = false);
+
+		/// <summary>
+		/// Writes the record of an image and flushes according to the flush policy.
+		/// </summary>
+		/// <returns>0 if no error occured</returns>
+		int append(const ImageRecord &record);
+
+		/// <summary>
+		/// Flushes and closes the stream.
+		/// </summary>
+		void close();
+
+		size_t records() const;
+		size_t flushes() const;
+
+	private:
+		void flush();
+
+		std::ofstream file;
+		size_t flushRecords;
+		double flushIntervalMs;
+		size_t written;
+		size_t pending; /* records written since the last flush */
+		size_t flushCount;
+		int64 lastFlush;
+	};
+
+	/// <summary>
+	/// Formats a record as one line of JSON, without the line break.
+	/// </summary>
+	std::string formatRecord(const ImageRecord &record);
+
+	/// <summary>
+	/// Escapes a string for a JSON string value, without the quotes.
+	/// </summary>
+	std::string escapeJson(const std::string &text);
+
+	/// <summary>
+	/// Parses a line written by formatRecord.
+	/// </summary>
+	/// <returns>false if the line is not a valid record, e.g. the truncated last line after a crash</returns>
+	bool parseRecord(const std::string &line, ImageRecord &record);
+
+	/// <summary>
+	/// Parses a JSON array of strings, e.g. ["album/IMG_0035.JPG","album/IMG_0036.JPG"].
+	/// </summary>
+	/// <returns>false if the text is not an array of strings</returns>
+	bool parseStringList(const std::string &text, std::vector<std::string> &values);
+
+	/// <summary>
+	/// Writes the bib to images index (one line per bib number, followed by the images
+	/// it was read in, in processing order) from a JSON-lines result stream. The
+	/// (bib, image) pairs are sorted externally: bounded runs are sorted in memory and
+	/// spilled next to the output file, then merged a few runs at a time, so memory
+	/// does not depend on the size of the album.
+	/// </summary>
+	/// <param name="streamFileName">The JSON-lines result stream.</param>
+	/// <param name="csvFileName">The index file to write.</param>
+	/// <param name="runPairs">Count of pairs sorted in memory per run.</param>
+	/// <returns>0 if no error occured</returns>
+	int writeBibIndex(const std::string &streamFileName,
+			const std::string &csvFileName, size_t runPairs = 65536);
+}
+
+#endif /* #ifndef RESULTSINK_H */
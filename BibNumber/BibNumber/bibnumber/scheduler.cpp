@@ -0,0 +1,181 @@
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+#include <boost/thread/locks.hpp>
+
+#include "scheduler.h"
+#include "metrics.h"
+
+static const char *priorityNames[] = { "interactive", "bulk" };
+
+namespace server {
+
+LatencyStats::LatencyStats() :
+		n(0), sumMs(0), maximumMs(0) {
+}
+
+void LatencyStats::add(double ms) {
+	if (window.size() < LATENCY_WINDOW)
+		window.push_back(ms);
+	else
+		window[n % LATENCY_WINDOW] = ms;
+	n++;
+	sumMs += ms;
+	maximumMs = std::max(maximumMs, ms);
+}
+
+size_t LatencyStats::count() const {
+	return n;
+}
+
+double LatencyStats::meanMs() const {
+	return n ? sumMs / n : 0;
+}
+
+double LatencyStats::maxMs() const {
+	return maximumMs;
+}
+
+/// <summary>
+/// Gets a percentile of the recent times by the nearest rank method.
+/// </summary>
+double LatencyStats::percentileMs(double p) const {
+	if (window.empty())
+		return 0;
+	std::vector<double> sorted(window);
+	size_t rank = (size_t) ceil(p / 100 * sorted.size());
+	rank = std::min(std::max(rank, (size_t) 1), sorted.size());
+	std::nth_element(sorted.begin(), sorted.begin() + rank - 1, sorted.end());
+	return sorted[rank - 1];
+}
+
+Scheduler::Scheduler(const std::vector<pipeline::Pipeline *> &pipelines,
+		const size_t queueLimits[PRIORITY_COUNT], double agingMs) :
+		idle(pipelines), agingMs(agingMs), lastAgedGrant(0) {
+	for (int c = 0; c < PRIORITY_COUNT; c++) {
+		this->queueLimits[c] = queueLimits[c];
+		busy[c] = 0;
+		rejected[c] = 0;
+	}
+	/* one pipeline is kept for interactive requests */
+	maxBulk = std::max(1, (int) pipelines.size() - 1);
+}
+
+/// <summary>
+/// Picks the waiting request an idle pipeline goes to.
+/// </summary>
+/// <returns>the request, NULL if no waiting request may take a pipeline</returns>
+Scheduler::Waiter *Scheduler::choose() {
+	std::deque<Waiter *> &interactive = queues[PRIORITY_INTERACTIVE];
+	std::deque<Waiter *> &bulk = queues[PRIORITY_BULK];
+	bool bulkAllowed = !bulk.empty() && (busy[PRIORITY_BULK] < maxBulk);
+	bool bulkAged = bulkAllowed
+			&& (latency::elapsedMs(bulk.front()->enqueued) >= agingMs)
+			&& ((lastAgedGrant == 0)
+					|| (latency::elapsedMs(lastAgedGrant) >= agingMs));
+
+	std::deque<Waiter *> *queue = NULL;
+	if (!interactive.empty() && !bulkAged) {
+		queue = &interactive;
+	} else if (bulkAllowed) {
+		queue = &bulk;
+		/* one aged bulk request per aging time goes before interactive ones */
+		if (!interactive.empty())
+			lastAgedGrant = cv::getTickCount();
+	}
+	if (queue == NULL)
+		return NULL;
+
+	Waiter *waiter = queue->front();
+	queue->pop_front();
+	return waiter;
+}
+
+/// <summary>
+/// Grants the idle pipelines, the lock must be held.
+/// </summary>
+void Scheduler::dispatch() {
+	bool any = false;
+	while (!idle.empty()) {
+		Waiter *waiter = choose();
+		if (waiter == NULL)
+			break;
+		waiter->pipeline = idle.back();
+		idle.pop_back();
+		busy[waiter->priority]++;
+		any = true;
+	}
+	metrics::set(metrics::GAUGE_INTERACTIVE_QUEUE,
+			queues[PRIORITY_INTERACTIVE].size());
+	metrics::set(metrics::GAUGE_BULK_QUEUE, queues[PRIORITY_BULK].size());
+	if (any)
+		granted.notify_all();
+}
+
+pipeline::Pipeline *Scheduler::acquire(Priority priority, double &waitMs) {
+	Waiter waiter;
+	waiter.priority = priority;
+	waiter.enqueued = cv::getTickCount();
+	waiter.pipeline = NULL;
+
+	boost::unique_lock<boost::mutex> lock(mutex);
+	if ((queueLimits[priority] > 0)
+			&& (queues[priority].size() >= queueLimits[priority])) {
+		rejected[priority]++;
+		return NULL;
+	}
+	queues[priority].push_back(&waiter);
+	dispatch();
+	/* aging only matters when a pipeline is released, dispatch() then checks it */
+	while (waiter.pipeline == NULL)
+		granted.wait(lock);
+	waitMs = latency::elapsedMs(waiter.enqueued);
+	wait[priority].add(waitMs);
+	return waiter.pipeline;
+}
+
+void Scheduler::release(pipeline::Pipeline *pipeline, Priority priority,
+		double serviceMs) {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	idle.push_back(pipeline);
+	busy[priority]--;
+	service[priority].add(serviceMs);
+	dispatch();
+}
+
+void Scheduler::printStats(std::ostream &out) {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	for (int c = 0; c < PRIORITY_COUNT; c++) {
+		out << "Class " << priorityNames[c] << ": requests="
+				<< service[c].count() << " rejected=" << rejected[c]
+				<< " wait p50/p99/max=" << wait[c].percentileMs(50) << "/"
+				<< wait[c].percentileMs(99) << "/" << wait[c].maxMs()
+				<< " ms service p50/p99/max=" << service[c].percentileMs(50)
+				<< "/" << service[c].percentileMs(99) << "/"
+				<< service[c].maxMs() << " ms" << std::endl;
+	}
+}
+
+std::string Scheduler::formatStats() {
+	boost::lock_guard<boost::mutex> lock(mutex);
+	std::ostringstream json;
+	json << "{";
+	for (int c = 0; c < PRIORITY_COUNT; c++) {
+		json << (c > 0 ? "," : "") << "\"" << priorityNames[c]
+				<< "\":{\"requests\":" << service[c].count() << ",\"rejected\":"
+				<< rejected[c] << ",\"waiting\":" << queues[c].size()
+				<< ",\"busy\":" << busy[c] << ",\"waitMs\":{\"mean\":"
+				<< wait[c].meanMs() << ",\"p50\":" << wait[c].percentileMs(50)
+				<< ",\"p99\":" << wait[c].percentileMs(99) << ",\"max\":"
+				<< wait[c].maxMs() << "},\"serviceMs\":{\"mean\":"
+				<< service[c].meanMs() << ",\"p50\":"
+				<< service[c].percentileMs(50) << ",\"p99\":"
+				<< service[c].percentileMs(99) << ",\"max\":"
+				<< service[c].maxMs() << "}}";
+	}
+	json << "}";
+	return json.str();
+}
+
+} /* namespace server */
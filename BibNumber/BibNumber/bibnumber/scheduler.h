@@ -0,0 +1,116 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <deque>
+#include <vector>
+#include <iostream>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "pipeline.h"
+
+/* recent requests of a class the latency percentiles are computed over */
+#define LATENCY_WINDOW (4096)
+
+namespace server
+{
+	/// <summary>
+	/// Priority classes of requests.
+	/// </summary>
+	enum Priority {
+		PRIORITY_INTERACTIVE = 0, /* a runner waiting for the result of one photo */
+		PRIORITY_BULK, /* photos of an album job */
+		PRIORITY_COUNT
+	};
+
+	/// <summary>
+	/// Queue wait or service time of the requests of a class. Percentiles are
+	/// computed over the last LATENCY_WINDOW requests.
+	/// </summary>
+	class LatencyStats {
+	public:
+		LatencyStats();
+		void add(double ms);
+		size_t count() const;
+		double meanMs() const;
+		double maxMs() const;
+		double percentileMs(double p) const;
+
+	private:
+		std::vector<double> window; /* ring buffer of recent times */
+		size_t n;
+		double sumMs;
+		double maximumMs;
+	};
+
+	/// <summary>
+	/// Lends the pipelines of the daemon to waiting requests by priority. An idle
+	/// pipeline goes to the oldest interactive request, unless the oldest bulk request
+	/// has waited longer than the aging time, so bulk work is not starved by a steady
+	/// stream of interactive requests. Aging is a starvation guard, not a change of
+	/// priority: at most one bulk request per aging time goes before waiting
+	/// interactive requests, otherwise a backlog of aged album photos would take
+	/// every pipeline but the reserved one. One pipeline of the pool (when it has more
+	/// than one) is reserved for interactive requests, so a runner does not wait for
+	/// the photos of an album to finish. Requests beyond the queue limit of their
+	/// class are rejected instead of queued.
+	/// </summary>
+	class Scheduler {
+	public:
+		/// <param name="pipelines">The pipelines to lend, owned by the caller.</param>
+		/// <param name="queueLimits">Count of waiting requests of each class, 0 for unlimited.</param>
+		/// <param name="agingMs">Wait after which a bulk request goes before interactive ones.</param>
+		Scheduler(const std::vector<pipeline::Pipeline *> &pipelines,
+				const size_t queueLimits[PRIORITY_COUNT], double agingMs);
+
+		/// <summary>
+		/// Waits for a pipeline.
+		/// </summary>
+		/// <param name="waitMs">Set to the time the request waited.</param>
+		/// <returns>the pipeline, NULL if the queue of the class is full</returns>
+		pipeline::Pipeline *acquire(Priority priority, double &waitMs);
+
+		/// <summary>
+		/// Returns a pipeline once the request is done.
+		/// </summary>
+		/// <param name="serviceMs">Time the request used the pipeline.</param>
+		void release(pipeline::Pipeline *pipeline, Priority priority,
+				double serviceMs);
+
+		/// <summary>
+		/// Prints requests, rejections, queue wait and service time per class.
+		/// </summary>
+		void printStats(std::ostream &out);
+
+		/// <summary>
+		/// Formats the statistics of printStats as a JSON object.
+		/// </summary>
+		std::string formatStats();
+
+	private:
+		struct Waiter {
+			Priority priority;
+			int64 enqueued;
+			pipeline::Pipeline *pipeline; /* set when granted */
+		};
+
+		void dispatch();
+		Waiter *choose();
+
+		std::vector<pipeline::Pipeline *> idle;
+		std::deque<Waiter *> queues[PRIORITY_COUNT];
+		size_t queueLimits[PRIORITY_COUNT];
+		unsigned int busy[PRIORITY_COUNT]; /* pipelines in use by the class */
+		unsigned int maxBulk; /* pipelines bulk requests may use at once */
+		double agingMs;
+		int64 lastAgedGrant; /* when a bulk request last went before interactive ones, 0 if never */
+		size_t rejected[PRIORITY_COUNT];
+		LatencyStats wait[PRIORITY_COUNT];
+		LatencyStats service[PRIORITY_COUNT];
+		boost::mutex mutex;
+		boost::condition_variable granted;
+	};
+}
+
+#endif /* #ifndef SCHEDULER_H */
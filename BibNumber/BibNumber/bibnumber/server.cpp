@@ -0,0 +1,600 @@
+#include <iostream>
+#include <sstream>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#endif
+
+#include "server.h"
+#include "batch.h"
+#include "album.h"
+#include "scheduler.h"
+#include "manifest.h"
+#include "resultsink.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+/* concurrent client connections, further clients are refused */
+#define MAX_CONNECTIONS (256)
+
+/* a worker which dies sooner than this after its start is respawned after this delay */
+#define RESPAWN_BACKOFF_MS (1000)
+
+/* pipelines of a pre-forked worker: one is kept for interactive requests, so a bulk
+   album taking every worker's other pipelines does not block interactive requests */
+#define MIN_WORKER_PIPELINES (2)
+
+#ifndef _WIN32
+
+/* set by SIGINT and SIGTERM */
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int) {
+	stopRequested = 1;
+}
+
+static bool readFull(int fd, void *buffer, size_t length) {
+	char *p = (char *) buffer;
+	while (length > 0) {
+		ssize_t n = read(fd, p, length);
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		length -= n;
+	}
+	return true;
+}
+
+static bool writeFull(int fd, const void *buffer, size_t length) {
+	const char *p = (const char *) buffer;
+	while (length > 0) {
+		ssize_t n = write(fd, p, length);
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		length -= n;
+	}
+	return true;
+}
+
+/// <summary>
+/// Reads a frame: a 32-bit big-endian length followed by that many bytes.
+/// </summary>
+/// <returns>false if the connection was closed or the frame is too large</returns>
+static bool readFrame(int fd, std::vector<unsigned char> &frame) {
+	boost::uint32_t length;
+	if (!readFull(fd, &length, sizeof(length)))
+		return false;
+	length = ntohl(length);
+	if ((length == 0) || (length > MAX_FRAME_BYTES))
+		return false;
+	frame.resize(length);
+	return readFull(fd, &frame[0], length);
+}
+
+static bool writeFrame(int fd, const std::string &payload) {
+	boost::uint32_t length = htonl((boost::uint32_t) payload.size());
+	return writeFull(fd, &length, sizeof(length))
+			&& writeFull(fd, payload.data(), payload.size());
+}
+
+/// <summary>
+/// Starts a thread which does not receive the stop signals, so they interrupt accept().
+/// </summary>
+static void startThread(const boost::function0<void> &function) {
+	sigset_t signals, previous;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, &previous);
+	boost::thread thread(function);
+	thread.detach();
+	pthread_sigmask(SIG_SETMASK, &previous, NULL);
+}
+
+static int connectSocket(const std::string &socketPath) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "ERROR: Socket path too long: " << socketPath << std::endl;
+		return -1;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((fd < 0)
+			|| (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0)) {
+		std::cerr << "ERROR: Could not connect to " << socketPath << ": "
+				<< strerror(errno) << std::endl;
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+#endif /* #ifndef _WIN32 */
+
+static std::string errorResponse(const std::string &message) {
+	return "{\"status\":-1,\"error\":\"" + results::escapeJson(message) + "\"}";
+}
+
+namespace server {
+
+/// <summary>
+/// Pipelines initialized once and lent to the requests of the clients.
+/// </summary>
+class Daemon {
+public:
+	Daemon(const batch::Options &options) :
+			options(options), albums(options), requests(0), failures(0),
+			totalMs(0) {
+	}
+
+	int run(const std::string &socketPath);
+
+private:
+	int initialize(unsigned int nPipelines);
+	int acceptConnections(int listener);
+	void printStats();
+	int supervise(int listener);
+#ifndef _WIN32
+	pid_t spawnWorker(int listener);
+#endif
+	void serve(int fd);
+	std::string process(const std::vector<unsigned char> &frame);
+
+	const batch::Options &options;
+	batch::AlbumProcessor albums; /* owns the pipelines, registry and OCR cache */
+	boost::scoped_ptr<Scheduler> scheduler; /* lends the pipelines by priority */
+	std::set<int> connections; /* sockets of the connected clients */
+	size_t requests;
+	size_t failures;
+	double totalMs;
+	boost::mutex mutex;
+	boost::condition_variable closed;
+};
+
+/// <summary>
+/// Processes one request frame.
+/// </summary>
+/// <returns>the JSON response</returns>
+std::string Daemon::process(const std::vector<unsigned char> &frame) {
+	trace::Span span("request", "bytes", frame.size());
+	int64 start = cv::getTickCount();
+	const unsigned char *data = &frame[0] + 1;
+	size_t length = frame.size() - 1;
+
+	char kind = frame[0];
+	if (kind == REQUEST_STATS)
+		return "{\"status\":0,\"classes\":" + scheduler->formatStats() + "}";
+	if (kind == REQUEST_METRICS)
+		return metrics::formatPrometheus();
+	Priority priority = PRIORITY_INTERACTIVE;
+	if ((kind == REQUEST_BULK_PATH) || (kind == REQUEST_BULK_IMAGE)) {
+		priority = PRIORITY_BULK;
+		kind = toupper(kind);
+	}
+
+	if ((kind != REQUEST_PATH) && (kind != REQUEST_IMAGE))
+		return errorResponse("Unknown request kind");
+
+	/* reading and decoding are scheduled work as well, so the queue limits and
+	   priority classes bound them and a rejected request costs nothing */
+	double queueMs;
+	pipeline::Pipeline *pipeline = scheduler->acquire(priority, queueMs);
+	if (pipeline == NULL)
+		return errorResponse("Queue full");
+	int64 serviceStart = cv::getTickCount();
+	metrics::increment(metrics::COUNTER_IMAGES);
+	pipeline::Detection detection;
+	std::vector<int> bibNumbers;
+	std::vector<cv::Rect> boxes;
+	int res = -1;
+	std::string error("Could not process image");
+	try {
+		std::vector<unsigned char> file;
+		if (kind == REQUEST_PATH) {
+			std::string path(data, data + length);
+			if (manifest::readFile(path, file) && !file.empty()) {
+				data = &file[0];
+				length = file.size();
+				res = 0;
+			} else {
+				error = "Could not read " + path;
+			}
+		} else {
+			res = 0;
+		}
+
+		if (res >= 0) {
+			double decodeScale;
+			int64 decodeStart = cv::getTickCount();
+			cv::Mat image = decode::decodeImage(data, length,
+					options.reducedDecode ? options.workingWidth : 0, decodeScale);
+			metrics::lap(metrics::STAGE_DECODE, decodeStart);
+			file.clear();
+			if (image.empty()) {
+				res = -1;
+				error = "Could not decode image";
+			} else {
+				res = pipeline->detect(image, options.svmModel, detection, decodeScale);
+				image.release();
+				if (res >= 0)
+					res = pipeline->recognize(detection, options.svmModel, bibNumbers, &boxes);
+			}
+		}
+	} catch (std::exception &e) {
+		res = -1;
+		error = e.what();
+	}
+	scheduler->release(pipeline, priority, latency::elapsedMs(serviceStart));
+	metrics::lap(metrics::STAGE_IMAGE, start);
+	if (res < 0) {
+		metrics::increment(metrics::COUNTER_IMAGE_ERRORS);
+		return errorResponse(error);
+	}
+
+	/* a bib read in several chains is reported with its first box */
+	std::ostringstream response;
+	response << "{\"status\":0,\"bibs\":[";
+	std::set<int> reported;
+	for (size_t i = 0; i < bibNumbers.size(); i++) {
+		if (!reported.insert(bibNumbers[i]).second)
+			continue;
+		response << (reported.size() > 1 ? "," : "") << "{\"bib\":"
+				<< bibNumbers[i] << ",\"box\":[" << boxes[i].x << ","
+				<< boxes[i].y << "," << boxes[i].width << ","
+				<< boxes[i].height << "]}";
+	}
+	response << "],\"degradation\":" << detection.deadline.degradation()
+			<< ",\"queueMs\":" << queueMs << ",\"ms\":"
+			<< latency::elapsedMs(start) << "}";
+	return response.str();
+}
+
+#ifndef _WIN32
+
+/// <summary>
+/// Answers the requests of a client until it disconnects.
+/// </summary>
+void Daemon::serve(int fd) {
+	std::vector<unsigned char> frame;
+	while (readFrame(fd, frame)) {
+		int64 start = cv::getTickCount();
+		std::string response = process(frame);
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			requests++;
+			if (response.compare(0, 11, "{\"status\":0") != 0)
+				failures++;
+			totalMs += latency::elapsedMs(start);
+		}
+		if (!writeFrame(fd, response))
+			break;
+	}
+
+	/* the descriptor may be reused by the next accept() once closed */
+	boost::lock_guard<boost::mutex> lock(mutex);
+	connections.erase(fd);
+	close(fd);
+	closed.notify_all();
+}
+
+/// <summary>
+/// Loads the registry, the OCR cache and the model and initializes the pipelines.
+/// </summary>
+/// <returns>0 if the daemon is ready to serve</returns>
+int Daemon::initialize(unsigned int nPipelines) {
+	/* Tesseract is initialized once per pipeline, here instead of per request */
+	if (albums.initialize(nPipelines) < 0)
+		return -1;
+	std::vector<pipeline::Pipeline *> pool;
+	for (unsigned int k = 0; k < nPipelines; k++)
+		pool.push_back(&albums.pipeline(k));
+	size_t queueLimits[PRIORITY_COUNT] = { options.interactiveQueue,
+			options.bulkQueue };
+	scheduler.reset(new Scheduler(pool, queueLimits, options.agingMs));
+	return 0;
+}
+
+/// <summary>
+/// Serves the clients connecting to the listener until a stop signal, then
+/// answers the requests in progress.
+/// </summary>
+/// <returns>0 if stopped on a signal</returns>
+int Daemon::acceptConnections(int listener) {
+	int res = 0;
+	while (!stopRequested) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			std::cerr << "ERROR: Could not accept a connection: "
+					<< strerror(errno) << std::endl;
+			res = -1;
+			break;
+		}
+
+		boost::lock_guard<boost::mutex> lock(mutex);
+		if (connections.size() >= MAX_CONNECTIONS) {
+			writeFrame(fd, errorResponse("Too many connections"));
+			close(fd);
+			continue;
+		}
+		connections.insert(fd);
+		startThread(boost::bind(&Daemon::serve, this, fd));
+	}
+	close(listener);
+
+	/* idle clients are disconnected, requests in progress are answered */
+	boost::unique_lock<boost::mutex> lock(mutex);
+	for (std::set<int>::iterator it = connections.begin();
+			it != connections.end(); ++it)
+		shutdown(*it, SHUT_RD);
+	while (!connections.empty())
+		closed.wait(lock);
+	return res;
+}
+
+void Daemon::printStats() {
+	std::cout << "Requests: " << requests << " failed=" << failures
+			<< " mean=" << (requests ? totalMs / requests : 0) << " ms"
+			<< std::endl;
+	scheduler->printStats(std::cout);
+	albums.printCacheStats(std::cout);
+}
+
+/// <summary>
+/// Forks a worker serving the listener with the pipelines of this process. The
+/// worker shares the pages of Tesseract and the model copy-on-write, so it starts
+/// without initializing anything.
+/// </summary>
+/// <returns>the process id of the worker, -1 if it could not be forked</returns>
+pid_t Daemon::spawnWorker(int listener) {
+	/* buffered output would be written by both processes */
+	std::cout.flush();
+	std::cerr.flush();
+	int64 start = cv::getTickCount();
+	pid_t pid = fork();
+	if (pid < 0) {
+		std::cerr << "ERROR: Could not fork a worker: " << strerror(errno)
+				<< std::endl;
+		return -1;
+	}
+	if (pid == 0) {
+		int res;
+		{
+			/* each worker exports its own metrics and trace, to <file>.<pid> */
+			std::ostringstream metricsFile, traceFile;
+			if (!options.metricsFile.empty())
+				metricsFile << options.metricsFile << "." << getpid();
+			if (!options.traceFile.empty())
+				traceFile << options.traceFile << "." << getpid();
+			metrics::FileExporter exporter(metricsFile.str());
+			trace::Session session(traceFile.str());
+			res = acceptConnections(listener);
+		}
+		std::cout << "Worker " << getpid() << ":" << std::endl;
+		printStats();
+		std::cout.flush();
+		/* the objects of the parent are not destroyed twice */
+		_exit(res < 0 ? 1 : 0);
+	}
+	std::cout << "Worker " << pid << " started in "
+			<< latency::elapsedMs(start) << " ms" << std::endl;
+	return pid;
+}
+
+/// <summary>
+/// Forks the workers and respawns those which die until a stop signal, which is
+/// forwarded to the workers. The parent must not have started any thread.
+/// </summary>
+/// <returns>0 if stopped on a signal</returns>
+int Daemon::supervise(int listener) {
+	std::map<pid_t, int64> workers; /* start tick of each worker */
+	size_t respawned = 0;
+	int res = 0;
+	while (!stopRequested) {
+		while (!stopRequested && (workers.size() < options.preforkWorkers)) {
+			pid_t pid = spawnWorker(listener);
+			if (pid < 0) {
+				res = -1;
+				break;
+			}
+			workers[pid] = cv::getTickCount();
+		}
+		if (res < 0)
+			break;
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		std::map<pid_t, int64>::iterator it = workers.find(pid);
+		if (it == workers.end())
+			continue;
+		double lifeMs = latency::elapsedMs(it->second);
+		workers.erase(it);
+		if (stopRequested)
+			break;
+		std::cerr << "ERROR: Worker " << pid << " died ("
+				<< (WIFSIGNALED(status) ? "signal " : "status ")
+				<< (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status))
+				<< "), respawning" << std::endl;
+		respawned++;
+		/* a worker which dies at once would otherwise be forked in a busy loop */
+		if (lifeMs < RESPAWN_BACKOFF_MS)
+			usleep(RESPAWN_BACKOFF_MS * 1000);
+	}
+	close(listener);
+
+	for (std::map<pid_t, int64>::iterator it = workers.begin();
+			it != workers.end(); ++it)
+		kill(it->first, SIGTERM);
+	while (!workers.empty()) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if ((pid < 0) && (errno != EINTR))
+			break;
+		if (pid > 0)
+			workers.erase(pid);
+	}
+	std::cout << "Workers: " << options.preforkWorkers << " respawned="
+			<< respawned << std::endl;
+	return res;
+}
+
+int Daemon::run(const std::string &socketPath) {
+	/* with workers, each worker lends its own pipelines */
+	unsigned int nPipelines = options.jobs;
+	if (nPipelines == 0)
+		nPipelines = (options.preforkWorkers > 0) ? MIN_WORKER_PIPELINES :
+				std::max(1u, boost::thread::hardware_concurrency());
+	if ((options.preforkWorkers > 0) && (nPipelines < MIN_WORKER_PIPELINES)) {
+		std::cerr << "ERROR: -prefork needs -jobs " << MIN_WORKER_PIPELINES
+				<< " or more, to keep a pipeline of each worker for interactive requests"
+				<< std::endl;
+		return -1;
+	}
+	int64 start = cv::getTickCount();
+	if (initialize(nPipelines) < 0)
+		return -1;
+	double initializeMs = latency::elapsedMs(start);
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "ERROR: Socket path too long: " << socketPath << std::endl;
+		return -1;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath.c_str());
+
+	/* the socket of a previous daemon which was killed is replaced */
+	unlink(socketPath.c_str());
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((listener < 0)
+			|| (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0)
+			|| (listen(listener, SOMAXCONN) < 0)) {
+		std::cerr << "ERROR: Could not listen on " << socketPath << ": "
+				<< strerror(errno) << std::endl;
+		if (listener >= 0)
+			close(listener);
+		return -1;
+	}
+
+	/* stop signals interrupt accept(), clients which disconnect do not kill the daemon */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onStopSignal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	std::cout << "Listening on " << socketPath << " with " << nPipelines
+			<< " pipelines";
+	if (options.preforkWorkers > 0)
+		std::cout << " in each of " << options.preforkWorkers << " workers";
+	std::cout << ", initialized in " << initializeMs << " ms" << std::endl;
+
+	int res;
+	if (options.preforkWorkers > 0) {
+		/* each worker updates its own copy of the OCR cache, which is not saved */
+		res = supervise(listener);
+		unlink(socketPath.c_str());
+		return res;
+	}
+
+	{
+		metrics::FileExporter exporter(options.metricsFile);
+		trace::Session session(options.traceFile);
+		res = acceptConnections(listener);
+	}
+	unlink(socketPath.c_str());
+	printStats();
+	albums.saveCache();
+	return res;
+}
+
+#else
+
+int Daemon::run(const std::string &socketPath) {
+	std::cerr << "ERROR: Daemon mode needs Unix domain sockets" << std::endl;
+	return -1;
+}
+
+#endif /* #ifndef _WIN32 */
+
+int run(const std::string &socketPath, const batch::Options &options) {
+	/* set log mask to minimum */
+	biblog::set_log_mask(LOG_NONE);
+
+	Daemon daemon(options);
+	return daemon.run(socketPath);
+}
+
+int request(const std::string &socketPath, const std::string &imageName,
+		bool bulk) {
+#ifndef _WIN32
+	std::vector<unsigned char> image;
+	if (!manifest::readFile(imageName, image) || image.empty()) {
+		std::cerr << "ERROR: Could not read " << imageName << std::endl;
+		return -1;
+	}
+	std::vector<unsigned char> frame(1, bulk ? REQUEST_BULK_IMAGE : REQUEST_IMAGE);
+	frame.insert(frame.end(), image.begin(), image.end());
+
+	int fd = connectSocket(socketPath);
+	if (fd < 0)
+		return -1;
+	boost::uint32_t length = htonl((boost::uint32_t) frame.size());
+	std::vector<unsigned char> response;
+	bool ok = writeFull(fd, &length, sizeof(length))
+			&& writeFull(fd, &frame[0], frame.size())
+			&& readFrame(fd, response);
+	close(fd);
+	if (!ok) {
+		std::cerr << "ERROR: No response from " << socketPath << std::endl;
+		return -1;
+	}
+
+	std::string json(response.begin(), response.end());
+	std::cout << json << std::endl;
+	return (json.compare(0, 11, "{\"status\":0") == 0) ? 0 : -1;
+#else
+	std::cerr << "ERROR: Daemon mode needs Unix domain sockets" << std::endl;
+	return -1;
+#endif
+}
+
+} /* namespace server */
@@ -0,0 +1,56 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+/* request kinds, the first byte of a request frame; lower case kinds are bulk requests */
+#define REQUEST_PATH 'P'
+#define REQUEST_IMAGE 'I'
+#define REQUEST_BULK_PATH 'p'
+#define REQUEST_BULK_IMAGE 'i'
+#define REQUEST_STATS 'S'
+#define REQUEST_METRICS 'M'
+
+/* largest request frame, connections sending larger frames are closed */
+#define MAX_FRAME_BYTES (64 * 1024 * 1024)
+
+namespace batch
+{
+	struct Options;
+}
+
+namespace server
+{
+	/// <summary>
+	/// Runs bibnumber as a long-lived daemon listening on a Unix domain socket, so
+	/// Tesseract and the models are loaded once per host instead of once per photo.
+	/// A pool of options.jobs pipelines (one per core for 0) is initialized at start
+	/// and lent to one request at a time. Each frame is a 32-bit big-endian length
+	/// followed by that many bytes. A request frame is the request kind followed by
+	/// an image path (REQUEST_PATH) or encoded image bytes (REQUEST_IMAGE), the
+	/// response frame is one JSON object, e.g.
+	/// {"status":0,"bibs":[{"bib":164,"box":[412,630,88,41]}],"degradation":0,"queueMs":0.2,"ms":182.5}
+	/// with the boxes in pixels of the original photo, or
+	/// {"status":-1,"error":"Could not decode image"}.
+	/// The bulk kinds are scheduled behind interactive requests (see Scheduler), a
+	/// REQUEST_STATS frame is answered with the queue statistics of the classes and a
+	/// REQUEST_METRICS frame with the metrics of the process in the Prometheus text
+	/// format (see metrics::formatPrometheus) instead of JSON.
+	/// A client may send any count of requests on one connection. The daemon stops
+	/// on SIGINT or SIGTERM after the requests in progress are answered.
+	/// </summary>
+	/// <param name="socketPath">Path of the socket, replaced if it exists.</param>
+	/// <param name="options">The model, registry, OCR cache, latency budget, pipeline count and queue limits.</param>
+	/// <returns>0 if the daemon stopped on a signal</returns>
+	int run(const std::string &socketPath, const batch::Options &options);
+
+	/// <summary>
+	/// Sends the bytes of an image file to a running daemon and prints the response.
+	/// </summary>
+	/// <param name="bulk">true to send a bulk request.</param>
+	/// <returns>0 if the image was processed</returns>
+	int request(const std::string &socketPath, const std::string &imageName,
+			bool bulk = false);
+}
+
+#endif /* #ifndef SERVER_H */
@@ -0,0 +1,638 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/locks.hpp>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <sys/wait.h>
+#endif
+
+#include "shards.h"
+#include "batch.h"
+#include "album.h"
+#include "imagesource.h"
+#include "resultsink.h"
+#include "manifest.h"
+#include "ocrcache.h"
+#include "log.h"
+
+/* consecutive worker deaths without progress before a shard is given up */
+#define MAX_FAILED_RESTARTS (3)
+
+namespace fs = boost::filesystem;
+
+/* working directory of the coordinator, next to the results */
+static const char *shardDirName = "bibnumber-shards";
+
+/* serializes the messages of the threads watching the workers */
+static boost::mutex consoleMutex;
+
+/// <summary>
+/// Files of one shard.
+/// </summary>
+struct Shard {
+	Shard() :
+			images(0), restarts(0), skipped(0), complete(false) {
+	}
+	fs::path list; /* "index;path" line per image */
+	fs::path stream; /* results appended by the workers */
+	fs::path marker; /* image being processed in isolation mode */
+	fs::path log; /* console output of the workers */
+	fs::path ocrCache; /* copy of the OCR cache used by the workers, empty if none */
+	std::vector<std::string> arguments; /* command line of the workers, without the shard */
+	size_t images;
+	size_t restarts;
+	size_t skipped; /* images a worker died on */
+	bool complete;
+};
+
+/// <summary>
+/// Gets the command line of the workers of a shard: the executable and the options
+/// which change the results or the resources of a worker. Each worker exports its
+/// own metrics and trace, to <file>.<shard>, and uses its own copy of the OCR cache.
+/// </summary>
+static std::vector<std::string> workerArguments(const std::string &executable,
+		const batch::Options &options, const Shard &shard,
+		const std::string &previousResults) {
+	std::vector<std::string> args;
+	args.push_back(executable);
+	if (!options.svmModel.empty()) {
+		args.push_back("-model");
+		args.push_back(options.svmModel);
+	}
+	if (!options.registryFile.empty()) {
+		args.push_back("-registry");
+		args.push_back(options.registryFile);
+	}
+	if (!shard.ocrCache.empty()) {
+		args.push_back("-ocrcache");
+		args.push_back(shard.ocrCache.string());
+	}
+	std::ostringstream value;
+	if (options.latencyBudgetMs > 0) {
+		value << options.latencyBudgetMs;
+		args.push_back("-budget");
+		args.push_back(value.str());
+	}
+	if (options.workingWidth != WORKING_WIDTH) {
+		value.str("");
+		value << options.workingWidth;
+		args.push_back("-width");
+		args.push_back(value.str());
+	}
+	value.str("");
+	value << options.jobs;
+	args.push_back("-jobs");
+	args.push_back(value.str());
+	if (options.stages.decode && options.stages.detect
+			&& options.stages.recognize) {
+		value.str("");
+		value << options.stages.decode << "," << options.stages.detect << ","
+				<< options.stages.recognize;
+		args.push_back("-stages");
+		args.push_back(value.str());
+	}
+	if (!options.reducedDecode)
+		args.push_back("-fulldecode");
+	value.str("");
+	value << options.prefetchImages;
+	args.push_back("-prefetch");
+	args.push_back(value.str());
+	value.str("");
+	value << options.prefetchMB;
+	args.push_back("-prefetchmb");
+	args.push_back(value.str());
+	std::string suffix = "." + shard.list.stem().string();
+	if (!options.metricsFile.empty()) {
+		args.push_back("-metrics");
+		args.push_back(options.metricsFile + suffix);
+	}
+	if (!options.traceFile.empty()) {
+		args.push_back("-trace");
+		args.push_back(options.traceFile + suffix);
+	}
+	if (!previousResults.empty()) {
+		args.push_back("-manifest");
+		args.push_back(previousResults);
+	}
+	return args;
+}
+
+#ifdef _WIN32
+
+/// <summary>
+/// Quotes an argument of a command line as the C runtime splits it again.
+/// </summary>
+static std::string quoteArgument(const std::string &arg) {
+	if (!arg.empty() && (arg.find_first_of(" \t\n\v\"") == std::string::npos))
+		return arg;
+	std::string quoted("\"");
+	std::string::const_iterator it = arg.begin();
+	for (;;) {
+		size_t backslashes = 0;
+		while ((it != arg.end()) && (*it == '\\')) {
+			++it;
+			backslashes++;
+		}
+		if (it == arg.end()) {
+			/* the closing quote must not be escaped */
+			quoted.append(backslashes * 2, '\\');
+			break;
+		}
+		if (*it == '"')
+			quoted.append(backslashes * 2 + 1, '\\');
+		else
+			quoted.append(backslashes, '\\');
+		quoted += *it++;
+	}
+	return quoted + "\"";
+}
+
+/// <summary>
+/// Runs a worker with its output appended to the log and waits for it. No shell is
+/// involved, so paths are passed to the worker as they are.
+/// </summary>
+/// <returns>the exit status of the worker, -1 if it could not be started</returns>
+static int runWorker(const std::vector<std::string> &args, const fs::path &log) {
+	std::string commandLine;
+	for (size_t i = 0; i < args.size(); i++)
+		commandLine += (i ? " " : "") + quoteArgument(args[i]);
+
+	SECURITY_ATTRIBUTES security;
+	memset(&security, 0, sizeof(security));
+	security.nLength = sizeof(security);
+	security.bInheritHandle = TRUE;
+	HANDLE output = CreateFileA(log.string().c_str(), FILE_APPEND_DATA,
+			FILE_SHARE_READ | FILE_SHARE_WRITE, &security, OPEN_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+	if (output == INVALID_HANDLE_VALUE)
+		return -1;
+
+	STARTUPINFOA startup;
+	memset(&startup, 0, sizeof(startup));
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	startup.hStdOutput = output;
+	startup.hStdError = output;
+	PROCESS_INFORMATION process;
+	std::vector<char> buffer(commandLine.begin(), commandLine.end());
+	buffer.push_back('\0');
+	BOOL started = CreateProcessA(NULL, &buffer[0], NULL, NULL, TRUE, 0, NULL,
+			NULL, &startup, &process);
+	CloseHandle(output);
+	if (!started)
+		return -1;
+
+	DWORD status = (DWORD) -1;
+	WaitForSingleObject(process.hProcess, INFINITE);
+	GetExitCodeProcess(process.hProcess, &status);
+	CloseHandle(process.hThread);
+	CloseHandle(process.hProcess);
+	return (int) status;
+}
+
+#else
+
+/// <summary>
+/// Runs a worker with its output appended to the log and waits for it. No shell is
+/// involved, so paths are passed to the worker as they are.
+/// </summary>
+/// <returns>the exit status of the worker, 128 + the signal if it was killed, -1 if it could not be started</returns>
+static int runWorker(const std::vector<std::string> &args, const fs::path &log) {
+	/* the child of a threaded process may only make async-signal-safe calls */
+	std::vector<char *> argv;
+	for (size_t i = 0; i < args.size(); i++)
+		argv.push_back(const_cast<char *>(args[i].c_str()));
+	argv.push_back(NULL);
+	std::string logName = log.string();
+
+	/* buffered output would be written by both processes */
+	std::cout.flush();
+	std::cerr.flush();
+	pid_t pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0) {
+		int fd = open(logName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			close(fd);
+		}
+		execvp(argv[0], &argv[0]);
+		_exit(127);
+	}
+
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return -1;
+	}
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return WEXITSTATUS(status);
+}
+
+#endif
+
+/// <summary>
+/// Reads the indices of the images which have a result in a shard stream.
+/// </summary>
+static void readDoneIndices(const fs::path &stream, std::set<size_t> &done) {
+	std::ifstream file(stream.string().c_str());
+	std::string line;
+	results::ImageRecord record;
+	while (std::getline(file, line)) {
+		if (results::parseRecord(line, record))
+			done.insert(record.index);
+	}
+}
+
+static size_t countDone(const fs::path &stream) {
+	std::set<size_t> done;
+	readDoneIndices(stream, done);
+	return done.size();
+}
+
+/// <summary>
+/// Records an empty result for the image an isolated worker died on.
+/// </summary>
+/// <returns>false if the worker did not die on an image</returns>
+static bool skipCurrentImage(Shard &shard) {
+	std::ifstream marker(shard.marker.string().c_str());
+	std::string line;
+	if (!std::getline(marker, line))
+		return false;
+	marker.close();
+	boost::system::error_code error;
+	fs::remove(shard.marker, error);
+
+	size_t sep = line.find(';');
+	if (sep == std::string::npos)
+		return false;
+	results::ImageRecord record;
+	record.index = strtoul(line.c_str(), NULL, 10);
+	record.image = line.substr(sep + 1);
+
+	std::set<size_t> done;
+	readDoneIndices(shard.stream, done);
+	if (done.count(record.index))
+		return false;
+
+	results::ResultSink sink;
+	if ((sink.open(shard.stream.string(), true) < 0) || (sink.append(record) < 0))
+		return false;
+	shard.skipped++;
+
+	boost::lock_guard<boost::mutex> lock(consoleMutex);
+	std::cerr << "ERROR: Worker died on " << record.image << ", skipped"
+			<< std::endl;
+	return true;
+}
+
+/// <summary>
+/// Runs workers on a shard until all its images have a result.
+/// </summary>
+static void runShard(Shard *shard) {
+	bool isolate = false;
+	int failed = 0;
+	for (;;) {
+		size_t before = countDone(shard->stream);
+		if (before >= shard->images)
+			break;
+
+		std::vector<std::string> args(shard->arguments);
+		if (isolate)
+			args.push_back("-isolate");
+		args.push_back(shard->list.string());
+		int status = runWorker(args, shard->log);
+
+		size_t after = countDone(shard->stream);
+		if (after >= shard->images)
+			break;
+
+		shard->restarts++;
+		{
+			boost::lock_guard<boost::mutex> lock(consoleMutex);
+			std::cerr << "ERROR: Worker of " << shard->list.filename().string()
+					<< " exited with status " << status << " after "
+					<< after << "/" << shard->images << " images, restarting"
+					<< std::endl;
+		}
+
+		if (isolate && skipCurrentImage(*shard)) {
+			/* the rest of the shard is processed in parallel again */
+			isolate = false;
+			failed = 0;
+		} else if (after > before) {
+			failed = 0;
+		} else {
+			/* find the image the worker dies on */
+			isolate = true;
+			if (++failed >= MAX_FAILED_RESTARTS) {
+				boost::lock_guard<boost::mutex> lock(consoleMutex);
+				std::cerr << "ERROR: Giving up "
+						<< shard->list.filename().string() << ", see "
+						<< shard->log.string() << std::endl;
+				return;
+			}
+		}
+	}
+	shard->complete = true;
+}
+
+namespace batch {
+
+bool isShardFile(std::string name) {
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	return boost::algorithm::ends_with(name, ".shard");
+}
+
+int coordinate(std::string inputName, const Options &options,
+		const std::string &executable) {
+	std::string name(inputName);
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	bool groundTruthMode = fs::is_regular_file(inputName)
+			&& boost::algorithm::ends_with(name, ".csv");
+	if (!groundTruthMode && !fs::is_directory(inputName)) {
+		std::cerr << "ERROR: -shards needs a directory or a ground truth file: "
+				<< inputName << std::endl;
+		return -1;
+	}
+
+	fs::path outDir = groundTruthMode ? fs::path(inputName).parent_path()
+			: fs::path(inputName);
+	if (outDir.empty())
+		outDir = ".";
+	fs::path workDir = outDir / shardDirName;
+
+	/* the results of a ground truth file go next to it, so the result stream of
+	   the directory of its images, which is its manifest, is left alone */
+	fs::path streamPath = groundTruthMode ?
+			fs::path(inputName).replace_extension(".results.jsonl") :
+			outDir / "results.jsonl";
+	fs::path outPath = groundTruthMode ?
+			fs::path(inputName).replace_extension(".out.csv") : outDir / "out.csv";
+	boost::system::error_code error;
+	fs::remove_all(workDir, error);
+	fs::create_directories(workDir, error);
+	if (error) {
+		std::cerr << "ERROR: Could not create " << workDir.string() << ": "
+				<< error.message() << std::endl;
+		return -1;
+	}
+
+	/* split the images round robin, which balances the shards */
+	unsigned int nShards = std::max(1u, options.shards);
+	boost::ptr_vector<Shard> shards;
+	boost::ptr_vector<std::ofstream> lists;
+	for (unsigned int k = 0; k < nShards; k++) {
+		std::ostringstream base;
+		base << "shard-" << k;
+		Shard *shard = new Shard();
+		shard->list = workDir / (base.str() + ".shard");
+		shard->stream = workDir / (base.str() + ".jsonl");
+		shard->marker = workDir / (base.str() + ".current");
+		shard->log = workDir / (base.str() + ".log");
+		if (!options.ocrCacheFile.empty()) {
+			/* workers save their cache at the end, a copy each keeps them from
+			   overwriting each other's */
+			shard->ocrCache = workDir / (base.str() + ".ocrcache");
+			if (fs::exists(options.ocrCacheFile))
+				fs::copy_file(options.ocrCacheFile, shard->ocrCache, error);
+		}
+		shards.push_back(shard);
+		lists.push_back(new std::ofstream(shard->list.string().c_str()));
+	}
+
+	std::vector<fs::path> paths;
+	std::vector<std::vector<int> > groundTruth;
+	boost::scoped_ptr<ImageSource> source;
+	if (groundTruthMode) {
+		readGroundTruth(inputName, paths, groundTruth);
+		source.reset(new ListSource(paths));
+	} else {
+		source.reset(new DirectorySource(inputName));
+	}
+
+	size_t nImages = 0;
+	SourceImage image;
+	while (source->next(image)) {
+		unsigned int k = nImages % nShards;
+		lists[k] << nImages << ";" << image.path.string() << '\n';
+		shards[k].images++;
+		nImages++;
+	}
+	lists.clear();
+
+	std::cout << "Processing " << nImages << " images of " << inputName
+			<< " in " << nShards << " worker processes" << std::endl;
+
+	/* the result stream of a directory is its manifest: it is set aside like in a
+	   run in this process, and the workers reuse the results of unchanged images */
+	std::string version = resultVersion(options);
+	manifest::Manifest manifest;
+	if (!groundTruthMode) {
+		if (manifest.open(streamPath.string(), version, options.resume) < 0)
+			return -1;
+		if (manifest.size() > 0) {
+			std::cout << "Resuming from the results of " << manifest.size()
+					<< " images" << std::endl;
+		}
+	}
+	std::string previousResults = (manifest.size() > 0) ?
+			manifest.previousFile() : std::string();
+
+	boost::thread_group watchers;
+	for (unsigned int k = 0; k < nShards; k++) {
+		shards[k].arguments = workerArguments(executable, options, shards[k],
+				previousResults);
+		watchers.create_thread(boost::bind(runShard, &shards[k]));
+	}
+	watchers.join_all();
+
+	/* merge the shard streams, whose records hold the content hash and version */
+	results::ResultSink sink(0);
+	if (sink.open(streamPath.string()) < 0)
+		return -1;
+	std::vector<std::vector<int> > found(groundTruth.size());
+	bool complete = true;
+	for (unsigned int k = 0; k < nShards; k++) {
+		std::ifstream stream(shards[k].stream.string().c_str());
+		std::string line;
+		results::ImageRecord record;
+		while (std::getline(stream, line)) {
+			if (!results::parseRecord(line, record))
+				continue;
+			sink.append(record);
+			if (record.index < found.size())
+				found[record.index].swap(record.bibNumbers);
+		}
+
+		std::cout << "Shard " << k << ": images=" << shards[k].images
+				<< " restarts=" << shards[k].restarts << " skipped="
+				<< shards[k].skipped
+				<< (shards[k].complete ? "" : " incomplete") << std::endl;
+		complete = complete && shards[k].complete;
+	}
+	sink.close();
+
+	/* the results of the previous run are kept until every shard completed, the
+	   next run then adds the records of this one to them */
+	if (complete)
+		manifest.close();
+
+	/* the copies of the OCR cache hold the entries of every worker */
+	if (!options.ocrCacheFile.empty()) {
+		ocrcache::OcrCache ocrCache;
+		ocrCache.load(options.ocrCacheFile);
+		for (unsigned int k = 0; k < nShards; k++)
+			ocrCache.load(shards[k].ocrCache.string());
+		ocrCache.save(options.ocrCacheFile);
+	}
+
+	std::cout << "Saving results to " << outPath.string() << std::endl;
+	results::writeBibIndex(streamPath.string(), outPath.string());
+
+	if (groundTruthMode) {
+		Score score;
+		for (size_t n = 0; n < groundTruth.size(); n++)
+			score.add(groundTruth[n], found[n], std::cout);
+		score.print(std::cout);
+	}
+
+	if (!complete) {
+		std::cerr << "ERROR: Some shards did not complete, worker logs are in "
+				<< workDir.string() << std::endl;
+		return -1;
+	}
+	fs::remove_all(workDir, error);
+	return 0;
+}
+
+/// <summary>
+/// Appends the results of a shard to its stream under their album indices, with the
+/// content hash and version the coordinator needs to keep the stream a manifest.
+/// </summary>
+class ShardCallback : public AlbumCallback {
+public:
+	ShardCallback(results::ResultSink &sink, const std::vector<size_t> &indices,
+			const std::string &version) :
+			sink(sink), indices(indices), version(version) {
+	}
+
+	virtual void imageDone(const AlbumProgress &progress, ImageResult &result) {
+		results::ImageRecord record;
+		record.index = indices[progress.index];
+		record.image = result.image;
+		record.bibNumbers.swap(result.bibNumbers);
+		record.degradation = result.degradation;
+		record.hash = result.hash;
+		record.version = version;
+		sink.append(record);
+	}
+
+private:
+	results::ResultSink &sink;
+	const std::vector<size_t> &indices;
+	const std::string &version;
+};
+
+int processShard(std::string shardName, const Options &options,
+		AlbumProcessor &processor, size_t &nImages) {
+	nImages = 0;
+	fs::path shardPath(shardName);
+	fs::path streamPath = fs::path(shardPath).replace_extension(".jsonl");
+	fs::path markerPath = fs::path(shardPath).replace_extension(".current");
+
+	/* images finished by a previous worker of the shard */
+	std::set<size_t> done;
+	readDoneIndices(streamPath, done);
+
+	std::ifstream list(shardName.c_str());
+	if (!list.is_open()) {
+		std::cerr << "ERROR: Could not read shard " << shardName << std::endl;
+		return -1;
+	}
+	std::vector<size_t> indices;
+	std::vector<fs::path> paths;
+	std::string line;
+	while (std::getline(list, line)) {
+		size_t sep = line.find(';');
+		if (sep == std::string::npos)
+			continue;
+		size_t index = strtoul(line.c_str(), NULL, 10);
+		if (done.count(index))
+			continue;
+		indices.push_back(index);
+		paths.push_back(fs::path(line.substr(sep + 1)));
+	}
+
+	/* set log mask to minimum */
+	biblog::set_log_mask(LOG_NONE);
+
+	/* every result is flushed, a crash loses at most the images in progress */
+	results::ResultSink sink(1);
+	if (sink.open(streamPath.string(), true) < 0)
+		return -1;
+
+	std::string version = resultVersion(options);
+	results::ImageRecord record;
+	if (options.isolate) {
+		for (size_t n = 0; n < paths.size(); n++) {
+			{
+				std::ofstream marker(markerPath.string().c_str());
+				marker << indices[n] << ";" << paths[n].string() << std::endl;
+			}
+			std::vector<int> bibNumbers;
+			int res = processSingleImage(paths[n].string(), options,
+					processor.pipeline(0), bibNumbers);
+
+			record.index = indices[n];
+			record.image = paths[n].string();
+			record.bibNumbers.swap(bibNumbers);
+			record.degradation = (res < 0) ? 0 : processor.pipeline(0).degradation();
+			boost::uint64_t hash = manifest::hashFile(record.image);
+			record.hash = hash ? manifest::formatHash(hash) : std::string();
+			record.version = version;
+			sink.append(record);
+		}
+		boost::system::error_code error;
+		fs::remove(markerPath, error);
+	} else {
+		/* images are hashed, and unchanged ones reuse the results of the previous
+		   run set aside by the coordinator */
+		manifest::Manifest manifest;
+		if (!options.manifestFile.empty()
+				&& (manifest.openPrevious(options.manifestFile, version) < 0))
+			return -1;
+		ShardCallback callback(sink, indices, version);
+		AlbumRun run;
+		run.callback = &callback;
+		run.manifest = &manifest;
+		run.stats = &std::cout;
+		processor.process(paths, run);
+		manifest.close();
+	}
+	sink.close();
+
+	nImages = paths.size();
+	return 0;
+}
+
+} /* namespace batch */
@@ -0,0 +1,48 @@
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <string>
+
+namespace batch
+{
+	struct Options;
+	class AlbumProcessor;
+
+	/// <summary>
+	/// Processes a directory or a ground truth file with worker processes. The images
+	/// are split round robin into options.shards shard files, one bibnumber process is
+	/// started per shard and the results of the shards are merged into results.jsonl
+	/// and out.csv of a directory, which keeps results.jsonl a resume manifest, or
+	/// next to a ground truth file with one F-score report. A worker which dies,
+	/// e.g. on a corrupt JPEG, is restarted on the images of its shard it did not
+	/// finish; when it dies without progress, it is restarted in isolation mode to
+	/// find the image that kills it, which is then skipped.
+	/// </summary>
+	/// <param name="inputName">The directory or ground truth file.</param>
+	/// <param name="options">The batch options, passed on to the workers.</param>
+	/// <param name="executable">Path of the bibnumber executable.</param>
+	/// <returns>0 if all shards completed</returns>
+	int coordinate(std::string inputName, const Options &options,
+		const std::string &executable);
+
+	/// <summary>
+	/// Processes a shard file in a worker process, appending the results to the result
+	/// stream of the shard with their content hash and version. Images which already
+	/// have a result in the stream, from a worker which died, are skipped, and with
+	/// options.manifestFile unchanged images reuse the results of the previous run.
+	/// In isolation mode the images are processed one by one and the current image is
+	/// recorded next to the shard file.
+	/// </summary>
+	/// <param name="shardName">The shard file, one "index;path" line per image.</param>
+	/// <param name="nImages">Set to the count of images processed.</param>
+	/// <returns>0 if no error occured</returns>
+	int processShard(std::string shardName, const Options &options,
+		AlbumProcessor &processor, size_t &nImages);
+
+	/// <summary>
+	/// Checks whether a batch input is a shard file written by the coordinator.
+	/// </summary>
+	bool isShardFile(std::string name);
+}
+
+#endif /* #ifndef SHARDS_H */
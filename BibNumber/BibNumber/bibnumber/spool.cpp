@@ -0,0 +1,335 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <csignal>
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "spool.h"
+#include "batch.h"
+#include "album.h"
+#include "resultsink.h"
+#include "manifest.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+namespace fs = boost::filesystem;
+
+/* suffixes of the job files */
+#define JOB_SUFFIX ".json"
+#define CLAIMED_SUFFIX ".running"
+#define DONE_SUFFIX ".done"
+#define FAILED_SUFFIX ".failed"
+#define PROGRESS_SUFFIX ".progress.json"
+#define RESULT_SUFFIX ".result.json"
+
+/* set by SIGINT and SIGTERM */
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onStopSignal(int) {
+	stopRequested = 1;
+}
+
+/// <summary>
+/// Checks whether a file of the spool directory is a job waiting to be claimed.
+/// </summary>
+static bool isJobFile(const std::string &name) {
+	return boost::algorithm::ends_with(name, JOB_SUFFIX)
+			&& !boost::algorithm::ends_with(name, PROGRESS_SUFFIX)
+			&& !boost::algorithm::ends_with(name, RESULT_SUFFIX);
+}
+
+/// <summary>
+/// Replaces a file by renaming a temporary file written next to it.
+/// </summary>
+/// <returns>0 if no error occured</returns>
+static int renameIntoPlace(const fs::path &temporary, const fs::path &path) {
+	boost::system::error_code error;
+	fs::rename(temporary, path, error);
+	if (error) {
+		std::cerr << "ERROR: Could not rename " << temporary.string() << " to "
+				<< path.string() << ": " << error.message() << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+/// <summary>
+/// Writes a file under a temporary name and renames it into place, so a reader
+/// sees either the previous or the new content.
+/// </summary>
+/// <returns>0 if no error occured</returns>
+static int writeAtomically(const fs::path &path, const std::string &content) {
+	fs::path temporary(path.string() + ".tmp");
+	std::ofstream file(temporary.string().c_str(), std::ios::binary);
+	file << content;
+	file.close();
+	if (file.fail()) {
+		std::cerr << "ERROR: Could not write " << temporary.string() << std::endl;
+		return -1;
+	}
+	return renameIntoPlace(temporary, path);
+}
+
+namespace spool {
+
+/// <summary>
+/// Runs the jobs of the spool directory in turn with one album processor.
+/// </summary>
+class JobRunner : public batch::AlbumCallback {
+public:
+	JobRunner(const std::string &spoolDir, const batch::Options &options) :
+			spoolDir(spoolDir), processor(options), result(NULL) {
+	}
+
+	int run();
+
+	virtual void imageDone(const batch::AlbumProgress &albumProgress,
+			batch::ImageResult &image);
+
+private:
+	/// <summary>
+	/// Progress of the job in process.
+	/// </summary>
+	struct Progress {
+		std::string job;
+		std::string state;
+		size_t done;
+		size_t total;
+		size_t failed;
+		int64 start;
+	};
+
+	void requeueClaimed();
+	bool claimJob(fs::path &claimed, std::string &name);
+	int processJob(const fs::path &claimed, const std::string &name);
+	void writeProgress();
+
+	fs::path spoolDir;
+	batch::AlbumProcessor processor;
+	Progress progress;
+	std::vector<std::string> images; /* image paths of the job as listed */
+	std::vector<std::string> failedImages;
+	std::ofstream *result; /* result file of the job in process */
+	int64 lastProgress;
+};
+
+/// <summary>
+/// Returns the jobs claimed by a runner which was killed to the spool.
+/// </summary>
+void JobRunner::requeueClaimed() {
+	boost::system::error_code error;
+	for (fs::directory_iterator it(spoolDir, error), end; !error && (it != end);
+			it.increment(error)) {
+		std::string name = it->path().string();
+		if (!boost::algorithm::ends_with(name, JOB_SUFFIX CLAIMED_SUFFIX))
+			continue;
+		fs::path job(name.substr(0, name.size() - strlen(CLAIMED_SUFFIX)));
+		std::cout << "Requeueing interrupted job " << job.filename().string()
+				<< std::endl;
+		renameIntoPlace(it->path(), job);
+	}
+}
+
+/// <summary>
+/// Claims the first waiting job in name order.
+/// </summary>
+/// <param name="claimed">Set to the path of the claimed job file.</param>
+/// <param name="name">Set to the name of the job, the file name without extension.</param>
+/// <returns>false if no job is waiting</returns>
+bool JobRunner::claimJob(fs::path &claimed, std::string &name) {
+	std::vector<fs::path> waiting;
+	boost::system::error_code error;
+	for (fs::directory_iterator it(spoolDir, error), end; !error && (it != end);
+			it.increment(error)) {
+		if (isJobFile(it->path().filename().string())
+				&& fs::is_regular_file(it->path()))
+			waiting.push_back(it->path());
+	}
+	std::sort(waiting.begin(), waiting.end());
+
+	for (size_t i = 0; i < waiting.size(); i++) {
+		/* the job may have been removed since the directory was read */
+		claimed = fs::path(waiting[i].string() + CLAIMED_SUFFIX);
+		fs::rename(waiting[i], claimed, error);
+		if (error)
+			continue;
+		name = waiting[i].stem().string();
+		return true;
+	}
+	return false;
+}
+
+void JobRunner::writeProgress() {
+	std::ostringstream json;
+	json << "{\"job\":\"" << results::escapeJson(progress.job)
+			<< "\",\"state\":\"" << progress.state << "\",\"done\":"
+			<< progress.done << ",\"total\":" << progress.total
+			<< ",\"failed\":" << progress.failed << ",\"ms\":"
+			<< latency::elapsedMs(progress.start) << "}\n";
+	writeAtomically(spoolDir / (progress.job + PROGRESS_SUFFIX), json.str());
+}
+
+/// <summary>
+/// Appends the record of an image to the result file and replaces the progress
+/// file every PROGRESS_INTERVAL_MS.
+/// </summary>
+void JobRunner::imageDone(const batch::AlbumProgress &albumProgress,
+		batch::ImageResult &image) {
+	results::ImageRecord record;
+	record.index = albumProgress.index;
+	record.image = images[albumProgress.index];
+	record.bibNumbers.swap(image.bibNumbers);
+	record.degradation = image.degradation;
+	*result << (albumProgress.index > 0 ? ",\n" : "\n")
+			<< results::formatRecord(record);
+	if (image.res < 0)
+		failedImages.push_back(images[albumProgress.index]);
+	progress.done = albumProgress.done;
+	progress.failed = albumProgress.failed;
+
+	if (latency::elapsedMs(lastProgress) >= PROGRESS_INTERVAL_MS) {
+		writeProgress();
+		lastProgress = cv::getTickCount();
+	}
+
+	/* images in progress are completed, the job is processed again on restart */
+	if (stopRequested)
+		processor.cancel();
+}
+
+/// <summary>
+/// Processes the images of a claimed job and writes its result file.
+/// </summary>
+/// <returns>0 if the result file was written</returns>
+int JobRunner::processJob(const fs::path &claimed, const std::string &name) {
+	progress.job = name;
+	progress.state = "running";
+	progress.done = 0;
+	progress.total = 0;
+	progress.failed = 0;
+	progress.start = cv::getTickCount();
+	failedImages.clear();
+
+	std::vector<unsigned char> data;
+	if (!manifest::readFile(claimed.string(), data)
+			|| !results::parseStringList(std::string(data.begin(), data.end()),
+					images)) {
+		std::cerr << "ERROR: Job " << name
+				<< " is not a JSON array of image paths" << std::endl;
+		progress.state = "invalid";
+		writeProgress();
+		return -1;
+	}
+
+	std::vector<fs::path> paths;
+	for (size_t i = 0; i < images.size(); i++) {
+		fs::path path(images[i]);
+		paths.push_back(path.is_absolute() ? path : spoolDir / path);
+	}
+	progress.total = paths.size();
+	std::cout << "Processing job " << name << " with " << paths.size()
+			<< " images" << std::endl;
+	writeProgress();
+
+	/* the records are streamed into the result file, renamed when complete */
+	fs::path resultPath = spoolDir / (name + RESULT_SUFFIX);
+	fs::path temporary(resultPath.string() + ".tmp");
+	std::ofstream file(temporary.string().c_str(), std::ios::binary);
+	file << "{\"job\":\"" << results::escapeJson(name) << "\",\"results\":[";
+	result = &file;
+	lastProgress = cv::getTickCount();
+
+	batch::AlbumRun run;
+	run.callback = this;
+	int res = processor.process(paths, run);
+	result = NULL;
+	if (res < 0) {
+		file.close();
+		fs::remove(temporary);
+		std::cout << "Job " << name << " interrupted after " << progress.done
+				<< " images" << std::endl;
+		progress.state = "interrupted";
+		writeProgress();
+		return -1;
+	}
+
+	file << "],\"failed\":[";
+	for (size_t i = 0; i < failedImages.size(); i++) {
+		file << (i > 0 ? "," : "") << "\""
+				<< results::escapeJson(failedImages[i]) << "\"";
+	}
+	file << "],\"images\":" << progress.done << ",\"ms\":"
+			<< latency::elapsedMs(progress.start) << "}\n";
+	file.close();
+	if (file.fail() || (renameIntoPlace(temporary, resultPath) < 0)) {
+		std::cerr << "ERROR: Could not write " << resultPath.string() << std::endl;
+		progress.state = "failed";
+		writeProgress();
+		return -1;
+	}
+
+	progress.state = "done";
+	writeProgress();
+	std::cout << "Job " << name << " done: " << progress.done << " images, "
+			<< progress.failed << " failed in " << latency::elapsedMs(progress.start)
+			<< " ms" << std::endl;
+	return 0;
+}
+
+int JobRunner::run() {
+	if (!fs::is_directory(spoolDir)) {
+		std::cerr << "ERROR: Not a directory: " << spoolDir.string() << std::endl;
+		return -1;
+	}
+	if (processor.initialize() < 0)
+		return -1;
+
+	signal(SIGINT, onStopSignal);
+	signal(SIGTERM, onStopSignal);
+
+	requeueClaimed();
+	std::cout << "Watching " << spoolDir.string() << " for jobs with "
+			<< processor.pipelineCount() << " pipelines" << std::endl;
+
+	size_t nJobs = 0;
+	while (!stopRequested) {
+		fs::path claimed;
+		std::string name;
+		if (!claimJob(claimed, name)) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(SPOOL_POLL_MS));
+			continue;
+		}
+
+		/* an interrupted job goes back to the spool, a job which cannot be read does not */
+		int res = processJob(claimed, name);
+		std::string job = claimed.string().substr(0,
+				claimed.string().size() - strlen(CLAIMED_SUFFIX));
+		if (progress.state == "interrupted")
+			renameIntoPlace(claimed, job);
+		else
+			renameIntoPlace(claimed, job + (res < 0 ? FAILED_SUFFIX : DONE_SUFFIX));
+		nJobs++;
+	}
+
+	std::cout << "Jobs: " << nJobs << std::endl;
+	processor.finish(std::cout);
+	return 0;
+}
+
+int run(const std::string &spoolDir, const batch::Options &options) {
+	/* set log mask to minimum */
+	biblog::set_log_mask(LOG_NONE);
+
+	metrics::FileExporter exporter(options.metricsFile);
+	trace::Session session(options.traceFile);
+	JobRunner runner(spoolDir, options);
+	return runner.run();
+}
+
+} /* namespace spool */
@@ -0,0 +1,43 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <string>
+
+/* interval at which the spool directory is checked for new jobs */
+#define SPOOL_POLL_MS (500)
+
+/* the progress file of a job is replaced at most this often */
+#define PROGRESS_INTERVAL_MS (250)
+
+namespace batch
+{
+	struct Options;
+}
+
+namespace spool
+{
+	/// <summary>
+	/// Runs album jobs dropped into a spool directory, a local stand-in for the job
+	/// queue. A job is a file <job>.json holding the JSON array of its image paths,
+	/// relative to the spool directory unless absolute; it should be written under
+	/// another name and renamed into place. The runner claims a job by renaming it to
+	/// <job>.json.running, processes its images with a batch::AlbumProcessor
+	/// initialized at start, and renames it to <job>.json.done at the end,
+	/// or <job>.json.failed if the job could not be read (progress state "invalid")
+	/// or its result not written (state "failed").
+	/// While the album is processed, <job>.progress.json is replaced with e.g.
+	/// {"job":"race12","state":"running","done":140,"total":800,"failed":1,"ms":52310.4}
+	/// and when it is done, <job>.result.json appears with the records of the images
+	/// (see results::formatRecord) and the images which failed, followed by a last
+	/// progress file with the state "done". Both files are written under a temporary
+	/// name and renamed, so a reader never sees a partial file. Jobs are processed in
+	/// name order. Only one runner may use a spool directory: jobs still claimed when
+	/// it starts were interrupted and are processed again.
+	/// </summary>
+	/// <param name="spoolDir">The spool directory.</param>
+	/// <param name="options">The model, registry, OCR cache, latency budget and threads of the jobs.</param>
+	/// <returns>0 if the runner stopped on SIGINT or SIGTERM, which cancels the job in progress and returns it to the spool</returns>
+	int run(const std::string &spoolDir, const batch::Options &options);
+}
+
+#endif /* #ifndef SPOOL_H */
@@ -0,0 +1,495 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/highgui/highgui.hpp"
+
+#include "synth.h"
+
+namespace fs = boost::filesystem;
+
+/* pixels of scene per clutter stroke */
+#define CLUTTER_AREA (20000)
+/* pixels of photo per spectator of a crowd background */
+#define SPECTATOR_AREA (15000)
+/* JPEG quality of the corpus photos */
+#define CORPUS_JPEG_QUALITY (90)
+
+static const int bibFonts[] = { cv::FONT_HERSHEY_SIMPLEX, cv::FONT_HERSHEY_DUPLEX,
+		cv::FONT_HERSHEY_COMPLEX, cv::FONT_HERSHEY_TRIPLEX };
+
+static const cv::Scalar skinTones[] = { cv::Scalar(180, 200, 240), cv::Scalar(140,
+		170, 220), cv::Scalar(100, 135, 190), cv::Scalar(70, 100, 150), cv::Scalar(
+		45, 65, 100) };
+
+/// <summary>
+/// Draws a random color. The channels are drawn one statement at a time, the order
+/// in which function arguments are evaluated is unspecified and would change the
+/// scenes between compilers.
+/// </summary>
+static cv::Scalar randomColor(cv::RNG &rng, int low) {
+	int b = rng.uniform(low, 256);
+	int g = rng.uniform(low, 256);
+	int r = rng.uniform(low, 256);
+	return cv::Scalar(b, g, r);
+}
+
+static cv::Point randomPoint(cv::RNG &rng, cv::Point origin, int rangeX,
+		int rangeY) {
+	int x = origin.x + rng.uniform(0, rangeX);
+	int y = origin.y + rng.uniform(0, rangeY);
+	return cv::Point(x, y);
+}
+
+/// <summary>
+/// Fills the scene with low frequency shading, grain and random strokes, which give
+/// the edge and stroke width stages work the detector has to reject.
+/// </summary>
+static void renderBackground(cv::Mat &scene, cv::RNG &rng) {
+	cv::Mat coarse(6, 8, CV_8UC3);
+	rng.fill(coarse, cv::RNG::UNIFORM, cv::Scalar::all(40), cv::Scalar::all(200));
+	cv::resize(coarse, scene, scene.size(), 0, 0, cv::INTER_LINEAR);
+
+	cv::Mat shaded, grain(scene.size(), CV_16SC3);
+	rng.fill(grain, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(12));
+	scene.convertTo(shaded, CV_16SC3);
+	cv::add(shaded, grain, shaded);
+	shaded.convertTo(scene, CV_8UC3);
+
+	int nStrokes = std::max(1, scene.cols * scene.rows / CLUTTER_AREA);
+	for (int i = 0; i < nStrokes; i++) {
+		cv::Scalar color = randomColor(rng, 0);
+		cv::Point a = randomPoint(rng, cv::Point(0, 0), scene.cols, scene.rows);
+		int reach = std::max(2, scene.rows / 10);
+		cv::Point b = randomPoint(rng, cv::Point(a.x - reach, a.y - reach),
+				2 * reach, 2 * reach);
+		int thickness = rng.uniform(1, std::max(2, scene.rows / 150));
+		switch (rng.uniform(0, 3)) {
+		case 0:
+			cv::line(scene, a, b, color, thickness);
+			break;
+		case 1:
+			cv::circle(scene, a, rng.uniform(2, reach / 2 + 3), color, thickness);
+			break;
+		default:
+			cv::rectangle(scene, a, b, color, -1);
+			break;
+		}
+	}
+	cv::GaussianBlur(scene, scene, cv::Size(3, 3), 0);
+}
+
+static cv::Scalar randomSkin(cv::RNG &rng) {
+	cv::Scalar tone = skinTones[rng.uniform(0,
+			(int) (sizeof(skinTones) / sizeof(skinTones[0])))];
+	int shift = rng.uniform(-15, 16);
+	return tone + cv::Scalar::all(shift);
+}
+
+/// <summary>
+/// Maps a point of a figure, given relative to its center and upright, into the photo.
+/// </summary>
+static cv::Point toPhoto(cv::Point2f center, double cosAngle, double sinAngle,
+		double x, double y) {
+	return cv::Point(cvRound(center.x + cosAngle * x - sinAngle * y),
+			cvRound(center.y + sinAngle * x + cosAngle * y));
+}
+
+/// <summary>
+/// Draws a person seen from the front, leaning by an angle: legs, arms, torso and head.
+/// </summary>
+/// <param name="center">Center of the torso.</param>
+static void drawPerson(cv::Mat &photo, cv::RNG &rng, cv::Point2f center,
+		double torsoWidth, double torsoHeight, double angle) {
+	double c = cos(angle * CV_PI / 180), s = sin(angle * CV_PI / 180);
+	double w = torsoWidth / 2, h = torsoHeight / 2;
+	cv::Scalar shirt = randomColor(rng, 0);
+	cv::Scalar shorts = randomColor(rng, 0) * 0.5;
+	cv::Scalar skin = randomSkin(rng);
+	int limb = std::max(1, cvRound(torsoWidth / 5));
+
+	cv::line(photo, toPhoto(center, c, s, -w / 2, h), toPhoto(center, c, s,
+			-w / 2 - w * rng.uniform(0.0, 0.4), 3.2 * h), skin, limb);
+	cv::line(photo, toPhoto(center, c, s, w / 2, h), toPhoto(center, c, s,
+			w / 2 + w * rng.uniform(0.0, 0.4), 3.2 * h), skin, limb);
+	cv::line(photo, toPhoto(center, c, s, -w, -0.8 * h), toPhoto(center, c, s,
+			-w * rng.uniform(1.3, 1.9), h * rng.uniform(-0.6, 0.6)), skin, limb);
+	cv::line(photo, toPhoto(center, c, s, w, -0.8 * h), toPhoto(center, c, s,
+			w * rng.uniform(1.3, 1.9), h * rng.uniform(-0.6, 0.6)), skin, limb);
+
+	cv::Point legs[4] = { toPhoto(center, c, s, -w, 0.8 * h), toPhoto(center, c, s,
+			w, 0.8 * h), toPhoto(center, c, s, w, 1.5 * h), toPhoto(center, c, s, -w,
+			1.5 * h) };
+	cv::fillConvexPoly(photo, legs, 4, shorts);
+	cv::Point torso[4] = { toPhoto(center, c, s, -w, -h), toPhoto(center, c, s, w,
+			-h), toPhoto(center, c, s, w, h), toPhoto(center, c, s, -w, h) };
+	cv::fillConvexPoly(photo, torso, 4, shirt);
+	cv::circle(photo, toPhoto(center, c, s, 0, -h - 0.45 * torsoWidth),
+			std::max(2, cvRound(0.4 * torsoWidth)), skin, -1);
+}
+
+/// <summary>
+/// Fills the photo with a street scene: the textured background above the horizon,
+/// a road below it and spectators growing with their distance from the horizon.
+/// Some shirts carry letters, which detection has to reject.
+/// </summary>
+static void renderCrowd(cv::Mat &photo, cv::RNG &rng) {
+	renderBackground(photo, rng);
+	int horizon = (int) (photo.rows * rng.uniform(0.25, 0.45));
+	cv::Scalar road = cv::Scalar::all(rng.uniform(70, 150));
+	cv::rectangle(photo, cv::Rect(0, horizon, photo.cols, photo.rows - horizon),
+			road, -1);
+
+	int nSpectators = std::max(1, photo.cols * photo.rows / SPECTATOR_AREA);
+	std::vector<int> rows(nSpectators);
+	for (int i = 0; i < nSpectators; i++)
+		rows[i] = rng.uniform(horizon, photo.rows);
+	/* the nearer spectators cover the farther ones */
+	std::sort(rows.begin(), rows.end());
+	for (int i = 0; i < nSpectators; i++) {
+		double depth = (double) (rows[i] - horizon + 1) / (photo.rows - horizon + 1);
+		double torsoHeight = photo.rows * (0.03 + 0.12 * depth);
+		int x = rng.uniform(0, photo.cols);
+		cv::Point2f center((float) x, (float) (rows[i] - 1.5 * torsoHeight));
+		drawPerson(photo, rng, center, 0.7 * torsoHeight, torsoHeight,
+				rng.uniform(-10.0, 10.0));
+		if ((rng.uniform(0, 5) == 0) && (torsoHeight > 30)) {
+			std::string letters;
+			int nLetters = rng.uniform(2, 6);
+			for (int l = 0; l < nLetters; l++)
+				letters += (char) ('A' + rng.uniform(0, 26));
+			double scale = 0.25 * torsoHeight / 22;
+			cv::putText(photo, letters, cv::Point(cvRound(center.x - 0.3 * torsoHeight),
+					cvRound(center.y)), cv::FONT_HERSHEY_SIMPLEX, scale,
+					randomColor(rng, 0), std::max(1, cvRound(scale * 2)));
+		}
+	}
+}
+
+/// <summary>
+/// Draws a bib number, with its count of digits drawn from the options.
+/// </summary>
+static int randomNumber(cv::RNG &rng, const synth::PhotoOptions &options) {
+	int digits = rng.uniform(options.minDigits, options.maxDigits + 1);
+	int low = 1, high = 10;
+	for (int d = 1; d < digits; d++) {
+		low = high;
+		high *= 10;
+	}
+	return rng.uniform(low, high);
+}
+
+/// <summary>
+/// Renders an upright bib patch: a light sheet, sometimes with a sponsor band on top,
+/// and the number in dark digits of a random font filling most of the rest.
+/// </summary>
+static cv::Mat renderPatch(cv::RNG &rng, int number, int width, int height) {
+	cv::Mat patch(height, width, CV_8UC3, randomColor(rng, 215));
+	int top = 0;
+	if (rng.uniform(0, 2)) {
+		top = height / 6;
+		cv::rectangle(patch, cv::Rect(0, 0, width, top), randomColor(rng, 0), -1);
+	}
+
+	std::ostringstream text;
+	text << number;
+	int font = bibFonts[rng.uniform(0, (int) (sizeof(bibFonts) / sizeof(bibFonts[0])))];
+	if (rng.uniform(0, 4) == 0)
+		font |= cv::FONT_ITALIC;
+	int thickness = std::max(2, (int) (height * rng.uniform(0.05, 0.11)));
+	int blue = rng.uniform(0, 60);
+	int green = rng.uniform(0, 60);
+	int red = rng.uniform(0, 60);
+	int baseline;
+	cv::Size unit = cv::getTextSize(text.str(), font, 1.0, thickness, &baseline);
+	double scale = std::min(0.85 * width / unit.width,
+			rng.uniform(0.5, 0.7) * (height - top) / unit.height);
+	cv::Size extent = cv::getTextSize(text.str(), font, scale, thickness, &baseline);
+	cv::Point origin((width - extent.width) / 2,
+			top + (height - top + extent.height) / 2);
+	cv::putText(patch, text.str(), origin, font, scale,
+			cv::Scalar(blue, green, red), thickness, CV_AA);
+	return patch;
+}
+
+/// <summary>
+/// Warps a patch onto the photo so that its corners land on the given points,
+/// clockwise from the top left one.
+/// </summary>
+static void pastePatch(cv::Mat &photo, const cv::Mat &patch,
+		const cv::Point2f corners[4], const cv::Rect &box) {
+	cv::Rect roi = box & cv::Rect(0, 0, photo.cols, photo.rows);
+	if ((roi.width <= 0) || (roi.height <= 0))
+		return;
+	cv::Point2f source[4] = { cv::Point2f(0, 0), cv::Point2f((float) patch.cols, 0),
+			cv::Point2f((float) patch.cols, (float) patch.rows), cv::Point2f(0,
+					(float) patch.rows) };
+	cv::Point2f target[4];
+	cv::Point polygon[4];
+	for (int k = 0; k < 4; k++) {
+		target[k] = corners[k] - cv::Point2f((float) roi.x, (float) roi.y);
+		polygon[k] = cv::Point(cvRound(target[k].x), cvRound(target[k].y));
+	}
+	cv::Mat transform = cv::getPerspectiveTransform(source, target);
+	cv::Mat warped, mask = cv::Mat::zeros(roi.size(), CV_8UC1);
+	cv::warpPerspective(patch, warped, transform, roi.size(), cv::INTER_LINEAR);
+	cv::fillConvexPoly(mask, polygon, 4, cv::Scalar(255));
+	cv::Mat region = photo(roi);
+	warped.copyTo(region, mask);
+}
+
+/// <summary>
+/// Bib placed in a photo, before it is drawn.
+/// </summary>
+struct Placement {
+	synth::Bib bib;
+	cv::Mat patch;
+	cv::Point2f corners[4];
+	cv::Point2f center;
+	double angle;
+	double scale; /* of the patch in the photo */
+};
+
+static bool hasNumber(const std::vector<Placement> &placements, int number) {
+	for (size_t b = 0; b < placements.size(); b++) {
+		if (placements[b].bib.number == number)
+			return true;
+	}
+	return false;
+}
+
+/// <summary>
+/// Writes the photos k, k + step, ... of a corpus and their ground truth lines.
+/// </summary>
+static void writePhotos(const fs::path &dir, size_t first, size_t step,
+		size_t count, const synth::PhotoOptions &options, unsigned int seed,
+		std::vector<std::string> &lines, std::vector<char> &failed) {
+	for (size_t i = first; i < count; i += step) {
+		std::vector<synth::Bib> bibs;
+		cv::Mat photo = synth::renderPhoto(options, seed + (unsigned int) i, bibs);
+		std::ostringstream name;
+		name << "synth-" << std::setw(6) << std::setfill('0') << i << ".jpg";
+		std::vector<int> params;
+		params.push_back(CV_IMWRITE_JPEG_QUALITY);
+		params.push_back(CORPUS_JPEG_QUALITY);
+		if (!cv::imwrite((dir / name.str()).string(), photo, params)) {
+			failed[i] = 1;
+			continue;
+		}
+		std::ostringstream line;
+		line << name.str();
+		for (size_t b = 0; b < bibs.size(); b++)
+			line << ";" << bibs[b].number;
+		lines[i] = line.str();
+	}
+}
+
+namespace synth {
+
+cv::Mat renderScene(cv::Size size, int nBibs, unsigned int seed,
+		std::vector<Bib> &bibs) {
+	cv::RNG rng(seed);
+	cv::Mat scene(size, CV_8UC3);
+	renderBackground(scene, rng);
+	bibs.clear();
+	if (nBibs <= 0)
+		return scene;
+
+	/* one bib per cell of a grid close to the aspect ratio of the scene */
+	int cols = std::max(1, cvRound(std::sqrt(nBibs * (double) size.width / size.height)));
+	int rows = (nBibs + cols - 1) / cols;
+	int cellWidth = size.width / cols;
+	int cellHeight = size.height / rows;
+	for (int b = 0; b < nBibs; b++) {
+		int width = (int) (cellWidth * rng.uniform(0.45, 0.7));
+		int height = std::min((int) (width * 0.7), (int) (cellHeight * 0.8));
+		if ((width < 8) || (height < 8))
+			break;
+		Bib bib;
+		cv::Point corner = randomPoint(rng,
+				cv::Point((b % cols) * cellWidth, (b / cols) * cellHeight),
+				cellWidth - width, cellHeight - height + 1);
+		bib.box = cv::Rect(corner, cv::Size(width, height));
+		bib.number = rng.uniform(1, 10000);
+		cv::rectangle(scene, bib.box, randomColor(rng, 215), -1);
+
+		/* digits filling most of the patch, as printed on race bibs */
+		std::ostringstream text;
+		text << bib.number;
+		int font = rng.uniform(0, 2) ? cv::FONT_HERSHEY_DUPLEX : cv::FONT_HERSHEY_SIMPLEX;
+		int thickness = std::max(2, height / 12);
+		int baseline;
+		cv::Size unit = cv::getTextSize(text.str(), font, 1.0, thickness, &baseline);
+		double scale = std::min(0.85 * width / unit.width, 0.6 * height / unit.height);
+		cv::Size extent = cv::getTextSize(text.str(), font, scale, thickness, &baseline);
+		cv::Point origin(bib.box.x + (width - extent.width) / 2,
+				bib.box.y + (height + extent.height) / 2);
+		cv::putText(scene, text.str(), origin, font, scale, cv::Scalar(20, 20, 20),
+				thickness, 8);
+		bibs.push_back(bib);
+	}
+	return scene;
+}
+
+PhotoOptions::PhotoOptions() :
+		size(2400, 1600), minBibs(1), maxBibs(8), minDigits(3), maxDigits(4),
+		maxAngle(20), maxPerspective(0.12), maxBlur(1.5), noise(6),
+		background(BACKGROUND_MIXED) {
+}
+
+cv::Mat renderPhoto(const PhotoOptions &options, unsigned int seed,
+		std::vector<Bib> &bibs) {
+	cv::RNG rng(seed);
+	cv::Mat photo(options.size, CV_8UC3);
+	Background background = options.background;
+	if (background == BACKGROUND_MIXED)
+		background = rng.uniform(0, 2) ? BACKGROUND_CROWD : BACKGROUND_TEXTURED;
+	if (background == BACKGROUND_CROWD)
+		renderCrowd(photo, rng);
+	else
+		renderBackground(photo, rng);
+	bibs.clear();
+
+	int nBibs = rng.uniform(options.minBibs, options.maxBibs + 1);
+	std::vector<Placement> placements;
+	if (nBibs > 0) {
+		/* one bib per cell of a grid close to the aspect ratio of the photo */
+		int cols = std::max(1, cvRound(std::sqrt(nBibs * (double) options.size.width
+				/ options.size.height)));
+		int rows = (nBibs + cols - 1) / cols;
+		int cellWidth = options.size.width / cols;
+		int cellHeight = options.size.height / rows;
+		for (int b = 0; b < nBibs; b++) {
+			int width = (int) (cellWidth * rng.uniform(0.3, 0.7));
+			int height = std::min((int) (width * rng.uniform(0.55, 0.75)),
+					(int) (cellHeight * 0.8));
+			if ((width < 16) || (height < 12))
+				break;
+			/* numbers are unique in a photo, as far as the digits allow */
+			Placement placement;
+			placement.bib.number = randomNumber(rng, options);
+			for (int attempt = 0; (attempt < 100)
+					&& hasNumber(placements, placement.bib.number); attempt++)
+				placement.bib.number = randomNumber(rng, options);
+			placement.patch = renderPatch(rng, placement.bib.number, width, height);
+
+			/* corners relative to the center, rotated and shifted for perspective */
+			placement.angle = options.maxAngle * rng.uniform(-1.0, 1.0);
+			double c = cos(placement.angle * CV_PI / 180);
+			double s = sin(placement.angle * CV_PI / 180);
+			double xs[4] = { -width / 2.0, width / 2.0, width / 2.0, -width / 2.0 };
+			double ys[4] = { -height / 2.0, -height / 2.0, height / 2.0, height / 2.0 };
+			float minX = 0, maxX = 0, minY = 0, maxY = 0;
+			for (int k = 0; k < 4; k++) {
+				double x = xs[k] + width * options.maxPerspective * rng.uniform(-1.0, 1.0);
+				double y = ys[k] + height * options.maxPerspective * rng.uniform(-1.0, 1.0);
+				placement.corners[k] = cv::Point2f((float) (c * x - s * y),
+						(float) (s * x + c * y));
+				minX = std::min(minX, placement.corners[k].x);
+				maxX = std::max(maxX, placement.corners[k].x);
+				minY = std::min(minY, placement.corners[k].y);
+				maxY = std::max(maxY, placement.corners[k].y);
+			}
+
+			/* shrunk to fit its cell, then moved to a random spot of the cell */
+			placement.scale = std::min(1.0, std::min(0.95 * cellWidth / (maxX - minX),
+					0.95 * cellHeight / (maxY - minY)));
+			float spanX = (float) ((maxX - minX) * placement.scale);
+			float spanY = (float) ((maxY - minY) * placement.scale);
+			float left = (float) ((b % cols) * cellWidth + rng.uniform(0.0,
+					std::max(1.0, cellWidth - (double) spanX)));
+			float top = (float) ((b / cols) * cellHeight + rng.uniform(0.0,
+					std::max(1.0, cellHeight - (double) spanY)));
+			placement.center = cv::Point2f(left - (float) (minX * placement.scale),
+					top - (float) (minY * placement.scale));
+			for (int k = 0; k < 4; k++)
+				placement.corners[k] = placement.center
+						+ placement.corners[k] * (float) placement.scale;
+			placement.bib.box = cv::Rect(cvFloor(left), cvFloor(top),
+					cvCeil(spanX) + 1, cvCeil(spanY) + 1)
+					& cv::Rect(0, 0, photo.cols, photo.rows);
+			placements.push_back(placement);
+		}
+	}
+
+	/* the runners first, so no runner covers the bib of another */
+	if (background == BACKGROUND_CROWD) {
+		for (size_t b = 0; b < placements.size(); b++) {
+			const Placement &placement = placements[b];
+			double torsoWidth = placement.patch.cols * placement.scale
+					* rng.uniform(1.4, 1.8);
+			double torsoHeight = placement.patch.rows * placement.scale
+					* rng.uniform(1.8, 2.4);
+			drawPerson(photo, rng, placement.center, torsoWidth, torsoHeight,
+					placement.angle);
+		}
+	}
+	for (size_t b = 0; b < placements.size(); b++) {
+		pastePatch(photo, placements[b].patch, placements[b].corners,
+				placements[b].bib.box);
+		bibs.push_back(placements[b].bib);
+	}
+
+	double sigma = rng.uniform(0.0, std::max(options.maxBlur, 1e-3));
+	if (sigma >= 0.3)
+		cv::GaussianBlur(photo, photo, cv::Size(0, 0), sigma);
+	if (options.noise > 0) {
+		cv::Mat noisy, noise(photo.size(), CV_16SC3);
+		rng.fill(noise, cv::RNG::NORMAL, cv::Scalar::all(0),
+				cv::Scalar::all(options.noise));
+		photo.convertTo(noisy, CV_16SC3);
+		cv::add(noisy, noise, noisy);
+		noisy.convertTo(photo, CV_8UC3);
+	}
+	return photo;
+}
+
+int writeCorpus(const std::string &dir, size_t count,
+		const PhotoOptions &options, unsigned int seed) {
+	boost::system::error_code error;
+	fs::create_directories(dir, error);
+	if (error) {
+		std::cerr << "ERROR: Could not create " << dir << ": " << error.message()
+				<< std::endl;
+		return -1;
+	}
+
+	std::vector<std::string> lines(count);
+	std::vector<char> failed(count, 0);
+	unsigned int nThreads = std::max(1u, boost::thread::hardware_concurrency());
+	boost::thread_group workers;
+	for (unsigned int k = 0; k < nThreads; k++) {
+		workers.create_thread(boost::bind(writePhotos, fs::path(dir), k, nThreads,
+				count, boost::cref(options), seed, boost::ref(lines),
+				boost::ref(failed)));
+	}
+	workers.join_all();
+	if (std::find(failed.begin(), failed.end(), 1) != failed.end()) {
+		std::cerr << "ERROR: Could not write the photos to " << dir << std::endl;
+		return -1;
+	}
+
+	fs::path groundTruthPath = fs::path(dir) / "ground-truth.csv";
+	std::ofstream groundTruth(groundTruthPath.string().c_str());
+	for (size_t i = 0; i < count; i++)
+		groundTruth << lines[i] << std::endl;
+	if (!groundTruth) {
+		std::cerr << "ERROR: Could not write " << groundTruthPath.string()
+				<< std::endl;
+		return -1;
+	}
+	std::cout << "Wrote " << count << " photos and " << groundTruthPath.string()
+			<< std::endl;
+	return 0;
+}
+
+} /* namespace synth */
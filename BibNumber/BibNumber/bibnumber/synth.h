@@ -0,0 +1,85 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+
+/* largest bib rotation in degrees, the maxAngle of the detection parameters */
+#define SYNTH_MAX_ANGLE (45)
+
+namespace synth
+{
+	/// <summary>
+	/// Bib rendered into a scene.
+	/// </summary>
+	struct Bib {
+		int number;
+		cv::Rect box; /* bounding box of the bib patch in the scene */
+	};
+
+	/// <summary>
+	/// Renders a deterministic race-like scene: a textured background with clutter
+	/// and bib patches printed with black digits. The same size, count and seed give
+	/// the same pixels on every machine, so kernels can be timed on comparable inputs
+	/// without shipping photos.
+	/// </summary>
+	/// <param name="size">Size of the scene in pixels.</param>
+	/// <param name="nBibs">Count of bibs, laid out on a grid without overlapping.</param>
+	/// <param name="seed">Seed of the random choices.</param>
+	/// <param name="bibs">Receives the rendered bibs.</param>
+	/// <returns>the 8 bit BGR scene</returns>
+	cv::Mat renderScene(cv::Size size, int nBibs, unsigned int seed,
+			std::vector<Bib> &bibs);
+
+	enum Background {
+		BACKGROUND_TEXTURED = 0, /* shading, grain and clutter strokes as in renderScene */
+		BACKGROUND_CROWD, /* street and spectators, bibs are worn by runners */
+		BACKGROUND_MIXED /* one of the above drawn per photo */
+	};
+
+	/// <summary>
+	/// Settings of the photos of a synthetic corpus.
+	/// </summary>
+	struct PhotoOptions {
+		PhotoOptions();
+		cv::Size size; /* size of the photos in pixels */
+		int minBibs; /* bibs per photo are drawn from [minBibs, maxBibs] */
+		int maxBibs;
+		int minDigits; /* digits per bib number are drawn from [minDigits, maxDigits] */
+		int maxDigits;
+		double maxAngle; /* largest rotation of a bib in degrees, up to SYNTH_MAX_ANGLE */
+		double maxPerspective; /* largest shift of a bib corner, as a share of the bib size */
+		double maxBlur; /* largest sigma of the Gaussian blur of a photo in pixels */
+		double noise; /* sigma of the Gaussian noise added to a photo */
+		Background background;
+	};
+
+	/// <summary>
+	/// Renders a race-like photo: bib patches printed with the digits of random Hershey
+	/// fonts, sizes and thicknesses, rotated and seen in perspective, on a textured or
+	/// crowd-like background, then blurred and noised. The same options and seed give
+	/// the same pixels on every machine.
+	/// </summary>
+	/// <param name="seed">Seed of the random choices.</param>
+	/// <param name="bibs">Receives the rendered bibs, their boxes bound the warped patches.</param>
+	/// <returns>the 8 bit BGR photo</returns>
+	cv::Mat renderPhoto(const PhotoOptions &options, unsigned int seed,
+			std::vector<Bib> &bibs);
+
+	/// <summary>
+	/// Writes a corpus of JPEG photos rendered by renderPhoto to a directory, together
+	/// with ground-truth.csv in the format read by batch::process: one line per photo,
+	/// its file name followed by its bib numbers, separated by ';'. Photo i is rendered
+	/// with seed + i, so any photo can be rendered again on its own, and the photos
+	/// are rendered by one thread per core.
+	/// </summary>
+	/// <param name="dir">Output directory, created if missing.</param>
+	/// <param name="count">Count of photos.</param>
+	/// <returns>0 if no error occured</returns>
+	int writeCorpus(const std::string &dir, size_t count,
+			const PhotoOptions &options, unsigned int seed);
+}
+
+#endif /* #ifndef SYNTH_H */
@@ -39,6 +39,8 @@
 #include <algorithm>
 #include <vector>
 #include "textdetection.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include "log.h"
 
@@ -315,6 +317,31 @@ void renderChains(IplImage * SWTImage,
 	cvReleaseImage(&outTemp);
 }
 
+/// <summary>
+/// Releases the intermediate images of text detection.
+/// </summary>
+static void releaseDetectionImages(IplImage ** grayImage,
+		IplImage ** edgeSmoothedImage, IplImage ** edgeImage,
+		IplImage ** gradientX, IplImage ** gradientY, IplImage ** SWTImage) {
+	cvReleaseImage(gradientX);
+	cvReleaseImage(gradientY);
+	cvReleaseImage(SWTImage);
+	cvReleaseImage(edgeImage);
+	cvReleaseImage(edgeSmoothedImage);
+	cvReleaseImage(grayImage);
+}
+
+/// <summary>
+/// Records the total detection time.
+/// </summary>
+static void finishDetectionStats(struct DetectionStats *stats, int64 startTicks) {
+	double totalMs = latency::elapsedMs(startTicks);
+	metrics::observe(metrics::STAGE_DETECT, totalMs);
+	if (stats != NULL) {
+		stats->totalMs = totalMs;
+	}
+}
+
 namespace textdetection {
 
 TextDetector::TextDetector()
@@ -333,31 +360,67 @@ TextDetector::~TextDetector(void)
 /// <param name="chains">chains that was created by joining connected components</param>
 /// <param name="compBB">rectangle areas of connected components. will be filled in the method.</param>
 /// <param name="chainBB">rectangle area of chains. will be filled in the method.</param>
+/// <param name="deadline">latency budget of the image, checked between stages. NULL if unlimited.</param>
+/// <param name="stats">filled with stage timings if not NULL.</param>
 void TextDetector::detect(IplImage * input,
 		const struct TextDetectionParams &params,
 		std::vector<Chain> &chains,
 		std::vector<std::pair<Point2d, Point2d> > &compBB,
-		std::vector<std::pair<CvPoint, CvPoint> > &chainBB) {
+		std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
+		latency::Deadline *deadline,
+		struct DetectionStats *stats) {
+	trace::Span span("TextDetector::detect");
 	assert(input->depth == IPL_DEPTH_8U);
 	assert(input->nChannels == 3);
+	int64 startTicks = cv::getTickCount();
+	if (stats != NULL) {
+		stats->smoothingMs = 0;
+		stats->totalMs = 0;
+		stats->components = 0;
+	}
 	CvSize size = cvGetSize(input);
 	if (size.height > 0
 		&& size.width > 0)
 	{
 		cv::Mat inputMat2(input, false);
 		cv::Mat outputMat1;
-		EdgePreservingSmoothingRGB(inputMat2);
-		//cv::GaussianBlur(input, input, cv::Size(5, 5), 0);
-		ImageSegmentationFloodFill(inputMat2);
-		// Convert to grayscale
 		IplImage * grayImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
-		cvCvtColor(input, grayImage, CV_RGB2GRAY);
-		//swtDepthMatrix(grayImage, NULL);
 		IplImage * edgeSmoothedImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
-		EdgePreservingSmoothing(grayImage, edgeSmoothedImage);
+		if (params.skipSmoothing)
+		{
+			/* degraded mode: edges are detected on the plain grayscale image */
+			cvCvtColor(input, grayImage, CV_RGB2GRAY);
+			cvCopy(grayImage, edgeSmoothedImage);
+		}
+		else
+		{
+			int64 smoothingTicks = cv::getTickCount();
+			EdgePreservingSmoothingRGB(inputMat2);
+			//cv::GaussianBlur(input, input, cv::Size(5, 5), 0);
+			ImageSegmentationFloodFill(inputMat2);
+			// Convert to grayscale
+			cvCvtColor(input, grayImage, CV_RGB2GRAY);
+			//swtDepthMatrix(grayImage, NULL);
+			EdgePreservingSmoothing(grayImage, edgeSmoothedImage);
+			if (stats != NULL) {
+				stats->smoothingMs = latency::elapsedMs(smoothingTicks);
+			}
+			metrics::lap(metrics::STAGE_SMOOTHING, smoothingTicks);
+		}
 		cv::Mat edgeSmoothMat(edgeSmoothedImage, false);
-		cvSaveImage("edgeSmoothedImage.png", edgeSmoothedImage);
+		if (LOG_MASK & LOG_IMAGES) {
+			cvSaveImage("edgeSmoothedImage.png", edgeSmoothedImage);
+		}
+
+		if ((deadline != NULL) && deadline->checkpoint()) {
+			LOGL(LOG_COMPONENTS, "Deadline expired after smoothing");
+			cvReleaseImage(&edgeSmoothedImage);
+			cvReleaseImage(&grayImage);
+			finishDetectionStats(stats, startTicks);
+			return;
+		}
 
+		int64 stageTicks = cv::getTickCount();
 		cv::Mat gray;
 		cv::Mat inputMat(input, true);
 		//cv::GaussianBlur(inputMat, inputMat, cv::Size(5, 5), 0);
@@ -372,8 +435,11 @@ void TextDetector::detect(IplImage * input,
 
 
 		IplImage* edgeImage = cvCloneImage(&(IplImage)edge);
+		stageTicks = metrics::lap(metrics::STAGE_CANNY, stageTicks);
 
-		cvSaveImage("canny.png", edgeImage);
+		if (LOG_MASK & LOG_IMAGES) {
+			cvSaveImage("canny.png", edgeImage);
+		}
 
 		// Create gradient X, gradient Y
 		IplImage * gaussianImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F,
@@ -388,6 +454,7 @@ void TextDetector::detect(IplImage * input,
 		cvSmooth(gradientX, gradientX, 3, 3);
 		cvSmooth(gradientY, gradientY, 3, 3);
 		cvReleaseImage(&gaussianImage);
+		stageTicks = metrics::lap(metrics::STAGE_GRADIENTS, stageTicks);
 
 		// Calculate SWT and return ray vectors
 		std::vector<Ray> rays;
@@ -409,88 +476,136 @@ void TextDetector::detect(IplImage * input,
 		//cvSaveImage("gradientY.png", gradientY);
 
 
-		cvSaveImage("SWT_0.png", SWTImage);
+		if (LOG_MASK & LOG_IMAGES) {
+			cvSaveImage("SWT_0.png", SWTImage);
+		}
 		SWTMedianFilter(SWTImage, rays);
-		cvSaveImage("SWT_1.png", SWTImage);
+		if (LOG_MASK & LOG_IMAGES) {
+			cvSaveImage("SWT_1.png", SWTImage);
+		}
+		stageTicks = metrics::lap(metrics::STAGE_SWT, stageTicks);
+		metrics::observe(metrics::SIZE_RAYS, rays.size());
+
+		if ((deadline != NULL) && deadline->checkpoint()) {
+			LOGL(LOG_COMPONENTS, "Deadline expired after stroke width transform");
+			releaseDetectionImages(&grayImage, &edgeSmoothedImage, &edgeImage,
+				&gradientX, &gradientY, &SWTImage);
+			finishDetectionStats(stats, startTicks);
+			return;
+		}
 
-		IplImage * output2 = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F, 1);
-		normalizeImage(SWTImage, output2);
-		cvSaveImage("SWT_2.png", output2);
-		IplImage * saveSWT = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
-		cvConvertScale(output2, saveSWT, 255, 0);
-		cvSaveImage("SWT.png", saveSWT);
-		cvReleaseImage(&output2);
-		cvReleaseImage(&saveSWT);
+		if (LOG_MASK & LOG_IMAGES) {
+			IplImage * output2 = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F, 1);
+			normalizeImage(SWTImage, output2);
+			cvSaveImage("SWT_2.png", output2);
+			IplImage * saveSWT = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
+			cvConvertScale(output2, saveSWT, 255, 0);
+			cvSaveImage("SWT.png", saveSWT);
+			cvReleaseImage(&output2);
+			cvReleaseImage(&saveSWT);
+		}
 
 		// Calculate legally connected components from SWT and gradient image.
 		// return type is a vector of vectors, where each outer vector is a component and
 		// the inner vector contains the (y,x) of each pixel in that component.
-		cvSaveImage("grayImg.png", grayImage);
+		if (LOG_MASK & LOG_IMAGES) {
+			cvSaveImage("grayImg.png", grayImage);
+		}
 	
+		stageTicks = cv::getTickCount();
 		std::vector<std::vector<Point2d> > components =
 			findLegallyConnectedComponents(SWTImage, rays, edgeSmoothedImage);
+		if (stats != NULL)
+			stats->components = components.size();
+		metrics::lap(metrics::STAGE_LABELING, stageTicks);
+		metrics::observe(metrics::SIZE_COMPONENTS, components.size());
+
+		if ((deadline != NULL) && deadline->checkpoint()) {
+			LOGL(LOG_COMPONENTS, "Deadline expired after connected components");
+			releaseDetectionImages(&grayImage, &edgeSmoothedImage, &edgeImage,
+				&gradientX, &gradientY, &SWTImage);
+			finishDetectionStats(stats, startTicks);
+			return;
+		}
 
 	
-		IplImage * connectedComponentsImg = cvCreateImage(cvGetSize(input), 8U, 3);
-		//cvCopy(SWTImage, connectedComponentsImg, NULL);
-		for (std::vector<std::vector<Point2d> >::iterator it = components.begin();
-			it != components.end(); it++)
-		{
-			float mean, variance, median;
-			float meanColor, varianceColor, medianColor;
-			int minx, miny, maxx, maxy;
-			componentStats(SWTImage, (*it), mean, variance, median, minx, miny,
-				maxx, maxy,
-				meanColor, varianceColor, medianColor, edgeSmoothedImage);
-
-			Point2d bb1;
-			bb1.x = minx;
-			bb1.y = miny;
-
-			Point2d bb2;
-			bb2.x = maxx;
-			bb2.y = maxy;
-			std::pair<Point2d, Point2d> pair(bb1, bb2);
-
-			compBB.push_back(pair);
-		}
+		if (LOG_MASK & LOG_IMAGES) {
+			IplImage * connectedComponentsImg = cvCreateImage(cvGetSize(input), 8U, 3);
+			//cvCopy(SWTImage, connectedComponentsImg, NULL);
+			for (std::vector<std::vector<Point2d> >::iterator it = components.begin();
+				it != components.end(); it++)
+			{
+				float mean, variance, median;
+				float meanColor, varianceColor, medianColor;
+				int minx, miny, maxx, maxy;
+				componentStats(SWTImage, (*it), mean, variance, median, minx, miny,
+					maxx, maxy,
+					meanColor, varianceColor, medianColor, edgeSmoothedImage);
+
+				Point2d bb1;
+				bb1.x = minx;
+				bb1.y = miny;
+
+				Point2d bb2;
+				bb2.x = maxx;
+				bb2.y = maxy;
+				std::pair<Point2d, Point2d> pair(bb1, bb2);
+
+				compBB.push_back(pair);
+			}
 
-		renderComponentsWithBoxes(SWTImage, components, compBB, connectedComponentsImg);
-		cvSaveImage("component-all.png", connectedComponentsImg);
-		cvReleaseImage(&connectedComponentsImg);
-		compBB.clear();
+			renderComponentsWithBoxes(SWTImage, components, compBB, connectedComponentsImg);
+			cvSaveImage("component-all.png", connectedComponentsImg);
+			cvReleaseImage(&connectedComponentsImg);
+			compBB.clear();
+		}
 
 		// Filter the components
 		std::vector<std::vector<Point2d> > validComponents;
 		std::vector<Point2dFloat> compCenters;
 		std::vector<float> compMedians;
 		std::vector<Point2d> compDimensions;
+		stageTicks = cv::getTickCount();
 		filterComponents(SWTImage, components, validComponents, compCenters,
 			compMedians, compDimensions, compBB, params, edgeSmoothedImage);
+		metrics::lap(metrics::STAGE_FILTERING, stageTicks);
+
+		if ((deadline != NULL) && deadline->checkpoint()) {
+			LOGL(LOG_COMPONENTS, "Deadline expired after component filtering");
+			releaseDetectionImages(&grayImage, &edgeSmoothedImage, &edgeImage,
+				&gradientX, &gradientY, &SWTImage);
+			finishDetectionStats(stats, startTicks);
+			return;
+		}
 
-		IplImage * output3 = cvCreateImage(cvGetSize(input), 8U, 3);
-		renderComponentsWithBoxes(SWTImage, validComponents, compBB, output3);
-		cvSaveImage("components.png", output3);
-		cvReleaseImage(&output3);
+		if (LOG_MASK & LOG_IMAGES) {
+			IplImage * output3 = cvCreateImage(cvGetSize(input), 8U, 3);
+			renderComponentsWithBoxes(SWTImage, validComponents, compBB, output3);
+			cvSaveImage("components.png", output3);
+			cvReleaseImage(&output3);
+		}
 
 		// Make chains of components
+		stageTicks = cv::getTickCount();
 		chains = makeChains(input, validComponents, compCenters, compMedians,
 			compDimensions, params);
+		metrics::lap(metrics::STAGE_CHAINING, stageTicks);
+		metrics::observe(metrics::SIZE_CHAINS, chains.size());
 
 		IplImage * output = cvCreateImage(cvGetSize(grayImage), IPL_DEPTH_8U, 3);
 		renderChainsWithBoxes(SWTImage, validComponents, chains, compBB, chainBB, output);
-		cvSaveImage("text-boxes.png", output);
+		if (LOG_MASK & LOG_IMAGES) {
+			cvSaveImage("text-boxes.png", output);
+		}
 
 
 
 		cvReleaseImage(&output);
-		cvReleaseImage(&gradientX);
-		cvReleaseImage(&gradientY);
-		cvReleaseImage(&SWTImage);
-		cvReleaseImage(&edgeImage);
-		cvReleaseImage(&grayImage);
+		releaseDetectionImages(&grayImage, &edgeSmoothedImage, &edgeImage,
+			&gradientX, &gradientY, &SWTImage);
 	}
 	
+	finishDetectionStats(stats, startTicks);
 	return;
 }
 
@@ -538,10 +653,14 @@ void swtDepthMatrix(IplImage * img, IplImage * swtImage)
 {
 	IplImage * threshold = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
 	cvAdaptiveThreshold(img, threshold, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, 11, 5);
-	cvSaveImage("threshold-adaptive.jpg", threshold);
+	if (LOG_MASK & LOG_IMAGES) {
+		cvSaveImage("threshold-adaptive.jpg", threshold);
+	}
 	IplImage * distances = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
 	cvDistTransform(threshold, distances);
-	cvSaveImage("distances.jpg", threshold);
+	if (LOG_MASK & LOG_IMAGES) {
+		cvSaveImage("distances.jpg", threshold);
+	}
 	
 	//TODO round distances
 
@@ -602,7 +721,9 @@ void ImageSegmentationFloodFill(cv::Mat img)
 		//}
 	}
 
-	cv::imwrite("floodfill-pre.bmp", outputMat);
+	if (LOG_MASK & LOG_IMAGES) {
+		cv::imwrite("floodfill-pre.bmp", outputMat);
+	}
 
 	int rows = lineSegments.size();
 	for (int row = 0; row < lineSegments.size(); row++)
@@ -679,18 +800,20 @@ void ImageSegmentationFloodFill(cv::Mat img)
 	}
 
 
-	for (int row = 0; row < lineSegments.size(); row++)
-	{
-		std::vector<LineSegment*> rowComponents = lineSegments[row];
-
-		for (int segmentIndex = 0; segmentIndex < rowComponents.size(); segmentIndex++)
+	if (LOG_MASK & LOG_IMAGES) {
+		for (int row = 0; row < lineSegments.size(); row++)
 		{
-			LineSegment* segment = rowComponents[segmentIndex];
-			cv::rectangle(outputMat, segment->Rect, segment->Color);
+			std::vector<LineSegment*> rowComponents = lineSegments[row];
+
+			for (int segmentIndex = 0; segmentIndex < rowComponents.size(); segmentIndex++)
+			{
+				LineSegment* segment = rowComponents[segmentIndex];
+				cv::rectangle(outputMat, segment->Rect, segment->Color);
+			}
 		}
-	}
 
-	cv::imwrite("floodfill.bmp", outputMat);
+		cv::imwrite("floodfill.bmp", outputMat);
+	}
 }
 
 int FloodRow(cv::Mat row, cv::Point startPoint, double toleratedDiff)
@@ -811,6 +934,7 @@ int FloodRow(cv::Mat row, cv::Point startPoint, double toleratedDiff)
 void strokeWidthTransform(IplImage * edgeImage, IplImage * gradientX,
 		IplImage * gradientY, const struct TextDetectionParams &params,
 		IplImage * SWTImage, std::vector<Ray> & rays) {
+	trace::Span span("strokeWidthTransform");
 	// First pass
 	float prec = .05;
 	for (int row = 0; row < edgeImage->height; row++) {
@@ -946,6 +1070,7 @@ bool Point2dSort(const Point2d &lhs, const Point2d &rhs) {
 std::vector<std::vector<Point2d> > findLegallyConnectedComponents(
 		IplImage * SWTImage, std::vector<Ray> &rays,
 		IplImage * gray) {
+	trace::Span span("findLegallyConnectedComponents");
 	boost::unordered_map<int, int> map;
 	boost::unordered_map<int, Point2d> revmap;
 
@@ -1414,6 +1539,7 @@ void filterComponents(IplImage * SWTImage,
 		std::vector<std::pair<Point2d, Point2d> > & compBB,
 		const struct TextDetectionParams &params,
 		IplImage * img) {
+	trace::Span span("filterComponents", "components", components.size());
 	validComponents.reserve(components.size());
 	compCenters.reserve(components.size());
 	compMedians.reserve(components.size());
@@ -1664,6 +1790,7 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 		std::vector<Point2dFloat> & compCenters,
 		std::vector<float> & compMedians, std::vector<Point2d> & compDimensions,
 		const struct TextDetectionParams &params) {
+	trace::Span span("makeChains", "components", components.size());
 	assert(compCenters.size() == components.size());
 	// make vector of color averages
 	std::vector<Point3dFloat> colorAverages;
@@ -23,6 +23,8 @@
 
 #include <tesseract/baseapi.h>
 
+#include "deadline.h"
+
 struct LineSegment {
 	cv::Rect Rect;
 	double MeanRed;
@@ -67,6 +69,15 @@ struct TextDetectionParams {
 	int modelVerifLenCrit;
 	int modelVerifMinHeight;
 	int minCCHeight;
+	float modelVerifThreshold;
+	unsigned int modelVerifTopK;
+	bool skipSmoothing;
+};
+
+struct DetectionStats {
+	double smoothingMs; /* edge preserving smoothing, 0 if skipped */
+	double totalMs;
+	size_t components; /* connected components before filtering */
 };
 
 struct Chain {
@@ -151,7 +162,9 @@ public:
 	                    const struct TextDetectionParams &params,
 	                    std::vector<Chain> &chains,
 	                    std::vector<std::pair<Point2d, Point2d> > &compBB,
-	                    std::vector<std::pair<CvPoint, CvPoint> > &chainBB);
+	                    std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
+	                    latency::Deadline *deadline = NULL,
+	                    struct DetectionStats *stats = NULL);
 };
 
 }
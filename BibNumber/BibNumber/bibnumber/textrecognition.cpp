@@ -8,13 +8,22 @@
 #include <opencv/highgui.h>
 #include <opencv2/ml/ml.hpp>
 
+#include <algorithm>
+
 #include "train.h"
 
 #include "textrecognition.h"
+#include "metrics.h"
+#include "trace.h"
 #include "log.h"
 #include "stdio.h"
 
 #define PI 3.14159265
+/* components a chain may lack or have in excess of the registered bib lengths:
+   touching digits merge into one component, broken strokes and sponsor marks
+   add components which are trimmed after OCR */
+#define REGISTRY_MERGED_COMPONENTS (1)
+#define REGISTRY_EXTRA_COMPONENTS (2)
 
 /// <summary>
 /// Fixes wrongly recognized numbers. If the recognized character is similiar to a digit, character is replaced by the digit.
@@ -263,6 +272,10 @@ TextRecognizer::TextRecognizer() {
 	/* initialize sequence ids */
 	bsid = 0;
 	dsid = 0;
+
+	cache = NULL;
+	registry = NULL;
+	ocrMsPerChain = 0;
 }
 
 TextRecognizer::~TextRecognizer(void) {
@@ -270,6 +283,24 @@ TextRecognizer::~TextRecognizer(void) {
 	tess.End();
 }
 
+void TextRecognizer::setCache(ocrcache::OcrCache *cache) {
+	this->cache = cache;
+}
+
+void TextRecognizer::setRegistry(const registry::BibRegistry *registry) {
+	this->registry = registry;
+	/* constrain OCR to the digits of registered bibs */
+	if ((registry != NULL) && (!registry->empty())) {
+		tess.SetVariable("tessedit_char_whitelist", registry->digits().c_str());
+	} else {
+		tess.SetVariable("tessedit_char_whitelist", "");
+	}
+}
+
+int TextRecognizer::loadModel(const std::string &svmModel) {
+	return verifier.load(svmModel);
+}
+
 /// <summary>
 /// Checks the height of the chain. 
 /// </summary>
@@ -427,9 +458,94 @@ void GetAndBinarizeOnlySelectedComponents(cv::Mat& componentsImg, cv::Mat& grayM
 	}
 }
 
+/// <summary>
+/// Renders the components of a chain, deskews them and crops them with a border,
+/// the image passed to Tesseract before upscaling.
+/// </summary>
+/// <param name="grayMat">The grayscale image the chain was found in.</param>
+/// <param name="i">Index of the chain, whose direction is turned into the 1st/2nd quadrants.</param>
+/// <param name="mat">Receives the crop.</param>
+/// <returns>false if the chain is outside of the image</returns>
+bool prepareChainCrop(const cv::Mat& grayMat, unsigned int i,
+	const struct TextDetectionParams &params,
+	std::vector<Chain> &chains,
+	std::vector<std::pair<Point2d, Point2d> > &compBB,
+	std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
+	cv::Mat& mat)
+{
+	/* the binarization takes a non-const header of the image */
+	cv::Mat gray = grayMat;
+	cv::Point center = cv::Point(
+		(chainBB[i].first.x + chainBB[i].second.x) / 2,
+		(chainBB[i].first.y + chainBB[i].second.y) / 2);
+
+	/* invert direction if angle is in 3rd/4th quadrants */
+	if (chains[i].direction.x < 0) {
+		chains[i].direction.x = -chains[i].direction.x;
+		chains[i].direction.y = -chains[i].direction.y;
+	}
+
+	/* work out chain angle */
+	double theta_deg = 180
+		* atan2(chains[i].direction.y, chains[i].direction.x) / PI;
+
+	//if (absd(theta_deg) > params.maxAngle) {
+	//	LOGL(LOG_TXT_ORIENT,
+	//		"Chain angle " << theta_deg << " exceeds max " << params.maxAngle);
+	//	continue;
+	//}
+
+	LOGL(LOG_TXT_ORIENT,
+		"Chain #" << i << " Angle: " << theta_deg << " degrees");
+
+	/* create copy of input image including only the selected components
+	first image is thresholded with Otsu and then the largest connected components is found. 
+	This connected components will be passed to Tesseract OCR library to recognize numbers.
+	*/
+	cv::Mat componentsImg = cv::Mat::zeros(grayMat.rows, grayMat.cols,
+		grayMat.type());
+	std::vector<cv::Point> compCoords;
+	GetAndBinarizeOnlySelectedComponents(componentsImg, gray, compCoords, i, params, chains, compBB, chainBB);
+	if (LOG_MASK & LOG_IMAGES) {
+		cv::imwrite("bib-components.png", componentsImg);
+	}
+
+	cv::Mat rotMatrix = cv::getRotationMatrix2D(center, theta_deg, 1.0);
+
+	cv::Mat rotatedMat = cv::Mat::zeros(grayMat.rows, grayMat.cols,
+		grayMat.type());
+	cv::warpAffine(componentsImg, rotatedMat, rotMatrix, rotatedMat.size());
+	if (LOG_MASK & LOG_IMAGES) {
+		cv::imwrite("bib-rotated.png", rotatedMat);
+	}
+
+	/* rotate each component coordinates */
+	const int border = 3;
+	cv::transform(compCoords, compCoords, rotMatrix);
+	/* find bounding box of rotated components */
+	cv::Rect roi = getBoundingBox(compCoords, grayMat.size());
+	/* ROI area can be null if outside of clipping area */
+	if ((roi.width == 0) || (roi.height == 0))
+		return false;
+	LOGL(LOG_TEXTREC, "ROI = " << roi);
+	mat = cv::Mat::zeros(roi.height + 2 * border,
+		roi.width + 2 * border, grayMat.type());
+	cv::Mat tmp = rotatedMat(roi);
+	/* copy bounded box from rotated mat to new mat with borders - borders are needed
+	 * to improve OCR success rate
+	 */
+	tmp.copyTo(
+		mat(
+		cv::Rect(cv::Point(border, border),
+		cv::Point(roi.width + border,
+		roi.height + border))));
+	return true;
+}
+
 void CheckRecognizedString(char* out,
 	int chainIndex,
 	const struct TextDetectionParams &params,
+	const registry::BibRegistry *registry,
 	std::vector<Chain> &chains,
 	std::vector<std::pair<Point2d, Point2d> > &compBB,
 	std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
@@ -469,6 +585,13 @@ void CheckRecognizedString(char* out,
 		}
 	}
 
+	/* verify against the registered bib numbers */
+	if ((registry != NULL) && (!registry->empty()) && (!registry->contains(s_out)))
+	{
+		LOGL(LOG_TEXTREC, "Text is not a registered bib number ('" << s_out << "')");
+		return;
+	}
+
 	/* all fine, add this bib number */
 bibnumber_succ:
 	text.push_back(s_out);
@@ -476,6 +599,14 @@ bibnumber_succ:
 }
 
 
+/// <summary>
+/// Orders chains by descending SVM score.
+/// </summary>
+static bool candidateSortScore(const std::pair<float, unsigned int> &lhs,
+		const std::pair<float, unsigned int> &rhs) {
+	return lhs.first > rhs.first;
+}
+
 /// <summary>
 /// This is the main method used to recognize numbers on the input image.
 /// </summary>
@@ -487,6 +618,8 @@ bibnumber_succ:
 /// <param name="compBB">Areas of connected components. Every item in compBB represents area of one connected component.</param>
 /// <param name="chainBB">Areas of chains. Every item in chainBB represents area of one chain.  Area of a chain is computed by union of all areas of connected components that are part of the chain</param>
 /// <param name="text">collection which will be filled by found numbers</param>
+/// <param name="deadline">latency budget of the image, NULL if unlimited.</param>
+/// <param name="boxes">filled with the area of the chain of every found number if not NULL.</param>
 /// <returns>
 /// 0 if no error occured
 /// </returns>
@@ -495,7 +628,10 @@ int TextRecognizer::recognize(IplImage *input,
 		std::vector<Chain> &chains,
 		std::vector<std::pair<Point2d, Point2d> > &compBB,
 		std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
-		std::vector<std::string>& text) {
+		std::vector<std::string>& text,
+		latency::Deadline *deadline,
+		std::vector<cv::Rect> *boxes) {
+	trace::Span span("TextRecognizer::recognize", "chains", chains.size());
 	CvSize size = cvGetSize(input);
 	
 	//checks if image is not empty
@@ -506,12 +642,18 @@ int TextRecognizer::recognize(IplImage *input,
 		IplImage * grayImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
 		cvCvtColor(input, grayImage, CV_RGB2GRAY);
 
+		/* load the bib model once, it is used to rank and filter chains before OCR */
+		verifier.load(svmModel);
+
+		/* Tesseract debug images follow the image log mask */
+		tess.SetVariable("tessedit_write_images",
+			(LOG_MASK & LOG_IMAGES) ? "true" : "false");
+		cv::Mat inputMat = cv::Mat(input);
+
+		/* select chains which are worth passing to OCR */
+		std::vector<std::pair<float, unsigned int> > candidates;
 		for (unsigned int i = 0; i < chainBB.size(); i++)
 		{
-			cv::Point center = cv::Point(
-				(chainBB[i].first.x + chainBB[i].second.x) / 2,
-				(chainBB[i].first.y + chainBB[i].second.y) / 2);
-
 			//checks if the width of the chain is not too big
 			if (chainBB[i].second.x - chainBB[i].first.x
 				< input->width / params.maxImgWidthToTextRatio)
@@ -524,65 +666,115 @@ int TextRecognizer::recognize(IplImage *input,
 			/* eliminates chains with components of lower height than required minimum */
 			CheckChainHeight(i, params, chains, compBB, chainBB);
 
-			/* invert direction if angle is in 3rd/4th quadrants */
-			if (chains[i].direction.x < 0) {
-				chains[i].direction.x = -chains[i].direction.x;
-				chains[i].direction.y = -chains[i].direction.y;
+			/* eliminates chains far too short or long for any registered bib, the exact
+			   length is only checked on the OCR output */
+			size_t nComponents = chains[i].components.size();
+			if ((registry != NULL) && (!registry->empty())
+				&& ((nComponents + REGISTRY_MERGED_COMPONENTS < registry->minLength())
+					|| (nComponents > registry->maxLength() + REGISTRY_EXTRA_COMPONENTS)))
+			{
+				LOGL(LOG_TEXTREC,
+					"Reject chain #" << i << " length=" << chains[i].components.size() << " matches no registered bib");
+				continue;
+			}
+
+			/* score the chain with the HOG+SVM bib model */
+			float score = 0;
+			if (verifier.loaded())
+			{
+				cv::Rect chainRect(cv::Point(chainBB[i].first.x, chainBB[i].first.y),
+					cv::Point(chainBB[i].second.x + 1, chainBB[i].second.y + 1));
+				score = verifier.score(inputMat, chainRect);
+				LOGL(LOG_SVM, "Chain #" << i << " SVM score=" << score);
+
+				/* short chains are only accepted if the model confirms them */
+				if (chains[i].components.size() <= (unsigned int)params.modelVerifLenCrit)
+				{
+					if (chainRect.height < params.modelVerifMinHeight)
+					{
+						LOGL(LOG_SVM,
+							"Reject chain #" << i << " height=" << chainRect.height << "<" << params.modelVerifMinHeight);
+						continue;
+					}
+					if (score < params.modelVerifThreshold)
+					{
+						LOGL(LOG_SVM,
+							"Reject chain #" << i << " score=" << score << "<" << params.modelVerifThreshold);
+						continue;
+					}
+				}
 			}
 
-			/* work out chain angle */
-			double theta_deg = 180
-				* atan2(chains[i].direction.y, chains[i].direction.x) / PI;
+			candidates.push_back(std::make_pair(score, i));
+		}
 
-			//if (absd(theta_deg) > params.maxAngle) {
-			//	LOGL(LOG_TXT_ORIENT,
-			//		"Chain angle " << theta_deg << " exceeds max " << params.maxAngle);
-			//	continue;
-			//}
+		/* OCR most bib-like chains first, up to the configured count */
+		if (verifier.loaded())
+		{
+			std::stable_sort(candidates.begin(), candidates.end(), candidateSortScore);
+			if ((params.modelVerifTopK > 0) && (candidates.size() > params.modelVerifTopK))
+			{
+				LOGL(LOG_SVM,
+					"Keep " << params.modelVerifTopK << " of " << candidates.size() << " chains for OCR");
+				candidates.resize(params.modelVerifTopK);
+			}
+		}
 
-			LOGL(LOG_TXT_ORIENT,
-				"Chain #" << i << " Angle: " << theta_deg << " degrees");
+		/* under a latency budget only OCR as many chains as the remaining time allows */
+		if ((deadline != NULL) && deadline->limited() && (ocrMsPerChain > 0))
+		{
+			double affordable = deadline->remainingMs() / ocrMsPerChain;
+			unsigned int maxChains = (affordable < 1) ? 1 : (unsigned int)affordable;
+			if (candidates.size() > maxChains)
+			{
+				LOGL(LOG_TEXTREC,
+					"Keep " << maxChains << " of " << candidates.size() << " chains for OCR, " << deadline->remainingMs() << " ms left");
+				candidates.resize(maxChains);
+				deadline->degrade(latency::DEGRADE_CAP_CHAINS);
+			}
+		}
 
-			/* create copy of input image including only the selected components
-			first image is thresholded with Otsu and then the largest connected components is found. 
-			This connected components will be passed to Tesseract OCR library to recognize numbers.
-			*/
-			cv::Mat inputMat = cv::Mat(input);
+		for (unsigned int k = 0; k < candidates.size(); k++)
+		{
+			if ((deadline != NULL) && deadline->checkpoint())
+			{
+				LOGL(LOG_TEXTREC,
+					"Deadline expired, " << (candidates.size() - k) << " chains not recognized");
+				break;
+			}
+			int64 chainTicks = cv::getTickCount();
+			unsigned int i = candidates[k].second;
+			trace::Span chainSpan("chain", "chain", i);
+			biblog::Scope chainScope(biblog::FIELD_CHAIN, i);
+			cv::Rect chainRect(cv::Point(chainBB[i].first.x, chainBB[i].first.y),
+				cv::Point(chainBB[i].second.x + 1, chainBB[i].second.y + 1));
 			cv::Mat grayMat = cv::Mat(grayImage);
-			cv::Mat componentsImg = cv::Mat::zeros(grayMat.rows, grayMat.cols,
-				grayMat.type());
-			std::vector<cv::Point> compCoords;
-			GetAndBinarizeOnlySelectedComponents(componentsImg, grayMat, compCoords, i, params, chains, compBB, chainBB);
-			cv::imwrite("bib-components.png", componentsImg);
-
-			cv::Mat rotMatrix = cv::getRotationMatrix2D(center, theta_deg, 1.0);
-
-			cv::Mat rotatedMat = cv::Mat::zeros(grayMat.rows, grayMat.cols,
-				grayMat.type());
-			cv::warpAffine(componentsImg, rotatedMat, rotMatrix, rotatedMat.size());
-			cv::imwrite("bib-rotated.png", rotatedMat);
-
-			/* rotate each component coordinates */
-			const int border = 3;
-			cv::transform(compCoords, compCoords, rotMatrix);
-			/* find bounding box of rotated components */
-			cv::Rect roi = getBoundingBox(compCoords,
-				cv::Size(input->width, input->height));
-			/* ROI area can be null if outside of clipping area */
-			if ((roi.width == 0) || (roi.height == 0))
+			cv::Mat mat;
+			if (!prepareChainCrop(grayMat, i, params, chains, compBB, chainBB, mat))
 				continue;
-			LOGL(LOG_TEXTREC, "ROI = " << roi);
-			cv::Mat mat = cv::Mat::zeros(roi.height + 2 * border,
-				roi.width + 2 * border, grayMat.type());
-			cv::Mat tmp = rotatedMat(roi);
-			/* copy bounded box from rotated mat to new mat with borders - borders are needed
-			 * to improve OCR success rate
-			 */
-			tmp.copyTo(
-				mat(
-				cv::Rect(cv::Point(border, border),
-				cv::Point(roi.width + border,
-				roi.height + border))));
+
+			/* skip Tesseract if the same crop was already recognized
+			   against the same registry, which sets the whitelist and verifies the text */
+			boost::uint64_t cacheKey = 0;
+			if (cache != NULL) {
+				bool accepted;
+				std::string cachedText;
+				cacheKey = ocrcache::hashCrop(mat);
+				if (registry != NULL)
+					cacheKey ^= registry->key();
+				if (cache->lookup(cacheKey, accepted, cachedText)) {
+					metrics::increment(metrics::COUNTER_OCR_CACHE_HITS);
+					LOGL(LOG_TEXTREC, "OCR cache hit for chain #" << i);
+					if (accepted) {
+						text.push_back(cachedText);
+						if (boxes != NULL)
+							boxes->push_back(chainRect);
+						LOGL(LOG_TEXTREC, "Bib number: '" << cachedText << "'");
+					}
+					continue;
+				}
+				metrics::increment(metrics::COUNTER_OCR_CACHE_MISSES);
+			}
 
 			/* resize image to improve OCR success rate */
 			float upscale = 3.0;
@@ -592,18 +784,41 @@ int TextRecognizer::recognize(IplImage *input,
 			cv::Mat elem = cv::getStructuringElement(cv::MORPH_ELLIPSE,
 				cv::Size(2 * s + 1, 2 * s + 1), cv::Point(s, s));
 			//cv::erode(mat, mat, elem);
-			cv::imwrite("bib-tess-input.png", mat);
+			if (LOG_MASK & LOG_IMAGES) {
+				cv::imwrite("bib-tess-input.png", mat);
+			}
 
 			// Pass it to Tesseract API
-			tess.SetImage((uchar*)mat.data, mat.cols, mat.rows, 1, mat.step1());
-			// Get the text
-			char* out = tess.GetUTF8Text();
-			CheckRecognizedString(out, i, params, chains, compBB, chainBB, text);	
+			int64 ocrTicks = cv::getTickCount();
+			char* out;
+			{
+				trace::Span ocrSpan("tesseract", "chain", i);
+				tess.SetImage((uchar*)mat.data, mat.cols, mat.rows, 1, mat.step1());
+				// Get the text
+				out = tess.GetUTF8Text();
+			}
+			metrics::lap(metrics::STAGE_OCR, ocrTicks);
+			metrics::increment(metrics::COUNTER_OCR_CALLS);
+			size_t nText = text.size();
+			CheckRecognizedString(out, i, params, registry, chains, compBB, chainBB, text);	
 			free(out);
+			if ((boxes != NULL) && (text.size() > nText))
+				boxes->push_back(chainRect);
+
+			/* track the OCR cost of a chain for the latency budget */
+			double chainMs = latency::elapsedMs(chainTicks);
+			ocrMsPerChain = (ocrMsPerChain > 0) ? (0.8 * ocrMsPerChain + 0.2 * chainMs) : chainMs;
+
+			if (cache != NULL) {
+				if (text.size() > nText)
+					cache->insert(cacheKey, true, text.back());
+				else
+					cache->insert(cacheKey, false, "");
+			}
 		}
 
 		cvReleaseImage(&grayImage);
-		std::cout << "recognize END--- " << std::endl;
+		LOGL(LOG_TEXTREC, "recognize END--- ");
 	}
 
 	return 0;
@@ -6,9 +6,25 @@
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "textdetection.h"
+#include "ocrcache.h"
+#include "registry.h"
+#include "verifier.h"
+#include "deadline.h"
 
 namespace textrecognition
 {
+	/// <summary>
+	/// Renders the components of a chain, deskews them and crops them with a border,
+	/// the image passed to Tesseract before upscaling.
+	/// </summary>
+	/// <returns>false if the chain is outside of the image</returns>
+	bool prepareChainCrop(const cv::Mat& grayMat, unsigned int i,
+	                      const struct TextDetectionParams &params,
+	                      std::vector<Chain> &chains,
+	                      std::vector<std::pair<Point2d, Point2d> > &compBB,
+	                      std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
+	                      cv::Mat& mat);
+
 	class TextRecognizer {
 	public:
 		TextRecognizer(void);
@@ -19,9 +35,30 @@ namespace textrecognition
 		               std::vector<Chain> &chains,
 			           std::vector<std::pair<Point2d, Point2d> > &compBB,
 			           std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
-			           std::vector<std::string>& text);
+			           std::vector<std::string>& text,
+			           latency::Deadline *deadline = NULL,
+			           std::vector<cv::Rect> *boxes = NULL);
+		/// <summary>
+		/// Sets the OCR result cache shared by recognizers, NULL disables caching.
+		/// </summary>
+		void setCache(ocrcache::OcrCache *cache);
+		/// <summary>
+		/// Sets the registry of valid bib numbers, NULL accepts any number.
+		/// Chains that cannot match a registered bib length are rejected before OCR
+		/// and OCR is restricted to the registered digits.
+		/// </summary>
+		void setRegistry(const registry::BibRegistry *registry);
+		/// <summary>
+		/// Loads the SVM model ahead of the first recognition.
+		/// </summary>
+		/// <returns>0 if the model was loaded</returns>
+		int loadModel(const std::string &svmModel);
 	private:
 		tesseract::TessBaseAPI tess;
+		ocrcache::OcrCache *cache;
+		const registry::BibRegistry *registry;
+		verifier::ChainVerifier verifier;
+		double ocrMsPerChain; /* moving average of OCR time per chain, 0 if unknown */
 		int dsid; /* digit sequence id */
 		int bsid; /* bib sequence id */
 	};
@@ -0,0 +1,169 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
+/// <summary>
+/// Completed span.
+/// </summary>
+struct Event {
+	const char *name;
+	const char *argName;
+	long arg;
+	int64 start;
+	int64 end;
+};
+
+/// <summary>
+/// Spans of one thread. Only its thread writes it, the mutex is taken by the writer
+/// and by the export, so it is not contended while tracing.
+/// </summary>
+struct Ring {
+	Ring(int tid) :
+			events(TRACE_RING_EVENTS), next(0), count(0), tid(tid) {
+	}
+	std::vector<Event> events;
+	size_t next; /* slot of the next span */
+	size_t count; /* spans held, at most TRACE_RING_EVENTS */
+	int tid;
+	boost::mutex mutex;
+};
+
+static boost::mutex ringsMutex; /* guards rings and freeRings */
+static boost::ptr_vector<Ring> rings;
+static std::vector<Ring *> freeRings; /* rings of exited threads, reused by new threads */
+static int64 origin; /* ticks when the session was opened */
+
+/// <summary>
+/// Returns the ring of an exiting thread to the pool, so threads started per album
+/// or per connection do not add a ring each.
+/// </summary>
+static void releaseRing(Ring *ring) {
+	boost::lock_guard<boost::mutex> lock(ringsMutex);
+	freeRings.push_back(ring);
+}
+
+static boost::thread_specific_ptr<Ring> threadRing(releaseRing);
+
+static Ring *currentRing() {
+	Ring *ring = threadRing.get();
+	if (ring != NULL)
+		return ring;
+
+	{
+		boost::lock_guard<boost::mutex> lock(ringsMutex);
+		if (!freeRings.empty()) {
+			ring = freeRings.back();
+			freeRings.pop_back();
+		} else {
+			ring = new Ring(rings.size() + 1);
+			rings.push_back(ring);
+		}
+	}
+	threadRing.reset(ring);
+	return ring;
+}
+
+namespace trace {
+
+/** public variables */
+bool enabled = false;
+
+/** public functions */
+void record(const char *name, const char *argName, long arg, int64 start,
+		int64 end) {
+	/* the session was opened while the span was in progress */
+	if (start == 0)
+		return;
+
+	Ring *ring = currentRing();
+	boost::lock_guard<boost::mutex> lock(ring->mutex);
+	Event &event = ring->events[ring->next];
+	event.name = name;
+	event.argName = argName;
+	event.arg = arg;
+	event.start = start;
+	event.end = end;
+	ring->next = (ring->next + 1) % TRACE_RING_EVENTS;
+	if (ring->count < TRACE_RING_EVENTS)
+		ring->count++;
+}
+
+int writeFile(const std::string &fileName) {
+	std::ofstream file(fileName.c_str(), std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "ERROR: Could not write " << fileName << std::endl;
+		return -1;
+	}
+
+	/* timestamps and durations are in microseconds */
+	double usPerTick = 1000000. / cv::getTickFrequency();
+	int pid = getpid();
+	file.setf(std::ios::fixed);
+	file.precision(1);
+	file << "{\"traceEvents\":[";
+	bool first = true;
+	boost::lock_guard<boost::mutex> lock(ringsMutex);
+	for (size_t r = 0; r < rings.size(); r++) {
+		Ring &ring = rings[r];
+		boost::lock_guard<boost::mutex> ringLock(ring.mutex);
+		file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"
+				<< pid << ",\"tid\":" << ring.tid
+				<< ",\"args\":{\"name\":\"thread " << ring.tid << "\"}}";
+		first = false;
+
+		size_t oldest = (ring.next + TRACE_RING_EVENTS - ring.count)
+				% TRACE_RING_EVENTS;
+		for (size_t e = 0; e < ring.count; e++) {
+			const Event &event = ring.events[(oldest + e) % TRACE_RING_EVENTS];
+			file << ",\n{\"name\":\"" << event.name
+					<< "\",\"cat\":\"bibnumber\",\"ph\":\"X\",\"ts\":"
+					<< (event.start - origin) * usPerTick << ",\"dur\":"
+					<< (event.end - event.start) * usPerTick << ",\"pid\":"
+					<< pid << ",\"tid\":" << ring.tid;
+			if (event.argName != NULL)
+				file << ",\"args\":{\"" << event.argName << "\":" << event.arg
+						<< "}";
+			file << "}";
+		}
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	file.close();
+	if (file.fail()) {
+		std::cerr << "ERROR: Could not write " << fileName << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+Session::Session(const std::string &fileName) :
+		fileName(fileName) {
+	if (fileName.empty())
+		return;
+	origin = cv::getTickCount();
+	enabled = true;
+}
+
+Session::~Session() {
+	if (fileName.empty())
+		return;
+	enabled = false;
+	if (writeFile(fileName) == 0)
+		std::cout << "Trace written to " << fileName << std::endl;
+}
+
+} /* namespace trace */
@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+#include "opencv2/core/core.hpp"
+
+/* spans kept per thread, the oldest are overwritten */
+#define TRACE_RING_EVENTS (16384)
+
+namespace trace
+{
+	/** public variables */
+	/* set while a session is open, spans do nothing otherwise */
+	extern bool enabled;
+
+	/** public functions */
+	/// <summary>
+	/// Records a completed span in the ring buffer of the calling thread.
+	/// </summary>
+	/// <param name="name">Name of the span, a string literal.</param>
+	/// <param name="argName">Name of the argument, a string literal or NULL if none.</param>
+	void record(const char *name, const char *argName, long arg, int64 start,
+			int64 end);
+
+	/// <summary>
+	/// Writes the spans of all threads as a Chrome trace-event JSON file, which can be
+	/// opened in chrome://tracing or Perfetto.
+	/// </summary>
+	/// <returns>0 if no error occured</returns>
+	int writeFile(const std::string &fileName);
+
+	/// <summary>
+	/// Times the enclosing scope, e.g.
+	/// trace::Span span("chain", "index", i);
+	/// Without an open session, the constructor and destructor are a single test of
+	/// trace::enabled each.
+	/// </summary>
+	class Span {
+	public:
+		Span(const char *name, const char *argName = NULL, long arg = 0) :
+				name(name), argName(argName), arg(arg), start(0) {
+			if (enabled)
+				start = cv::getTickCount();
+		}
+
+		~Span() {
+			if (enabled)
+				record(name, argName, arg, start, cv::getTickCount());
+		}
+
+	private:
+		const char *name;
+		const char *argName;
+		long arg;
+		int64 start;
+	};
+
+	/// <summary>
+	/// Enables the spans while it exists and writes them to a file when destroyed.
+	/// It must be created before the threads it traces, and only one may exist.
+	/// </summary>
+	class Session {
+	public:
+		/// <param name="fileName">The trace file, nothing is traced if empty.</param>
+		Session(const std::string &fileName);
+		~Session();
+
+	private:
+		std::string fileName;
+	};
+}
+
+#endif /* #ifndef TRACE_H */
@@ -15,11 +15,6 @@
 
 namespace fs = boost::filesystem;
 
-class LinearSVM: public CvSVM {
-public:
-	void getSupportVector(std::vector<float>& support_vector) const;
-};
-
 void LinearSVM::getSupportVector(std::vector<float>& support_vector) const {
 
 	int sv_count = get_support_vector_count();
@@ -61,6 +56,15 @@ static inline double square(double x) {
 
 namespace train {
 
+cv::HOGDescriptor createHOGDescriptor() {
+	return cv::HOGDescriptor(cv::Size(128, 64), /* windows size */
+	cv::Size(16, 16), /* block size */
+	cv::Size(8, 8), /* block stride */
+	cv::Size(8, 8), /* cell size */
+	9 /* nbins */
+	);
+}
+
 // HOGDescriptor visual_imagealizer
 // adapted for arbitrary size of feature sets and training images
 cv::Mat hogVisualizeStdBlkSize(cv::Mat& origImg,
@@ -296,12 +300,7 @@ int process(std::string trainDir, std::string inputDir) {
 		return -1;
 	}
 
-	cv::HOGDescriptor hog(cv::Size(128, 64), /* windows size */
-	cv::Size(16, 16), /* block size */
-	cv::Size(8, 8), /* block stride */
-	cv::Size(8, 8), /* cell size */
-	9 /* nbins */
-	);
+	cv::HOGDescriptor hog = createHOGDescriptor();
 
 	/* find positive image files names */
 	std::cout << "Training from positives in " << trainDir << " image data in "
@@ -4,9 +4,27 @@
 #include <string>
 
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+#include "opencv2/ml/ml.hpp"
+
+/// <summary>
+/// Linear SVM that exposes its primal weight vector.
+/// </summary>
+class LinearSVM: public CvSVM {
+public:
+	/// <summary>
+	/// Gets the primal weight vector of a linear SVM trained on HOG descriptors.
+	/// The bias is appended as the last element, so that a positive w.x + b is a bib.
+	/// </summary>
+	void getSupportVector(std::vector<float>& support_vector) const;
+};
 
 namespace train
 {
+	/// <summary>
+	/// Creates the HOG descriptor used to train and evaluate the bib detector.
+	/// </summary>
+	cv::HOGDescriptor createHOGDescriptor();
 	cv::Mat hogVisualizeSingleBlock(cv::Mat& origImg,
 		std::vector<float>& descriptorValues, cv::Size winSize,
 		cv::Size cellSize, int scaleFactor, double viz_factor);
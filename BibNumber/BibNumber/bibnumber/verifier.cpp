@@ -0,0 +1,74 @@
+#include <iostream>
+#include <cfloat>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "verifier.h"
+#include "train.h"
+#include "log.h"
+
+namespace verifier {
+
+ChainVerifier::ChainVerifier(void) :
+		hog(train::createHOGDescriptor()), bias(0) {
+}
+
+int ChainVerifier::load(const std::string &svmModel) {
+	if (svmModel == modelName)
+		return 0;
+
+	modelName = svmModel;
+	weights.release();
+	if (svmModel.empty())
+		return 0;
+
+	/* reduce the linear SVM to its primal weight vector */
+	std::vector<float> supportVector;
+	try {
+		LinearSVM svm;
+		svm.load(svmModel.c_str());
+		svm.getSupportVector(supportVector);
+	} catch (cv::Exception &e) {
+		std::cerr << "ERROR: Could not load SVM model " << svmModel << ": "
+				<< e.what() << std::endl;
+		return -1;
+	}
+
+	if (supportVector.size() != hog.getDescriptorSize() + 1) {
+		std::cerr << "ERROR: SVM model " << svmModel
+				<< " does not match the HOG descriptor size" << std::endl;
+		return -1;
+	}
+
+	bias = supportVector.back();
+	supportVector.pop_back();
+	cv::Mat(supportVector).copyTo(weights);
+
+	LOGL(LOG_SVM, "Loaded SVM model " << svmModel << " (" << weights.rows << " weights, bias=" << bias << ")");
+	return 0;
+}
+
+bool ChainVerifier::loaded() const {
+	return !weights.empty();
+}
+
+float ChainVerifier::score(const cv::Mat &image, const cv::Rect &chainRect) {
+	if (!loaded())
+		return 0;
+
+	/* bibs were trained with some background around the digits */
+	int margin = chainRect.height / 4;
+	cv::Rect roi(chainRect.x - margin, chainRect.y - margin,
+			chainRect.width + 2 * margin, chainRect.height + 2 * margin);
+	roi = roi & cv::Rect(0, 0, image.cols, image.rows);
+	if (roi.area() == 0)
+		return -FLT_MAX;
+
+	cv::resize(image(roi), window, hog.winSize, 0, 0, cv::INTER_LINEAR);
+	hog.compute(window, descriptor);
+
+	/* w.x + b, cv::Mat::dot() is SIMD optimized */
+	return (float) (weights.dot(cv::Mat(descriptor)) + bias);
+}
+
+} /* namespace verifier */
@@ -0,0 +1,51 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+
+namespace verifier
+{
+	/// <summary>
+	/// Scores text chains with the linear HOG+SVM bib model before they are passed to OCR.
+	/// The model is reduced to its primal weight vector, so scoring a chain is one HOG
+	/// computation and one dot product.
+	/// </summary>
+	class ChainVerifier {
+	public:
+		ChainVerifier(void);
+
+		/// <summary>
+		/// Loads the SVM model. Nothing is done if the model is already loaded.
+		/// </summary>
+		/// <param name="svmModel">The SVM model file, empty unloads the model.</param>
+		/// <returns>0 if no error occured</returns>
+		int load(const std::string &svmModel);
+
+		/// <summary>
+		/// Checks if a model is loaded.
+		/// </summary>
+		bool loaded() const;
+
+		/// <summary>
+		/// Scores the area of a chain. Positive scores are classified as bibs.
+		/// </summary>
+		/// <param name="image">The image the chain was detected in.</param>
+		/// <param name="chainRect">Bounding box of the chain.</param>
+		/// <returns>SVM decision value w.x + b</returns>
+		float score(const cv::Mat &image, const cv::Rect &chainRect);
+
+	private:
+		std::string modelName;
+		cv::HOGDescriptor hog;
+		cv::Mat weights; /* primal weights as a column vector */
+		float bias;
+		std::vector<float> descriptor;
+		cv::Mat window;
+	};
+}
+
+#endif /* #ifndef VERIFIER_H */
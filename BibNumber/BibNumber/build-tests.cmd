@@ -0,0 +1,4 @@
+g++ -o resultsinktest tests/resultsinktest.cpp bibnumber/resultsink.cpp bibnumber/deadline.cpp -lopencv_core -I/home/greg/ws/boost_1_57_0 -Ibibnumber
+g++ -o decodetest tests/decodetest.cpp bibnumber/decode.cpp -lopencv_core -lopencv_highgui -lopencv_imgproc -Ibibnumber
+g++ -o schedulertest tests/schedulertest.cpp bibnumber/scheduler.cpp bibnumber/metrics.cpp bibnumber/deadline.cpp -lopencv_core -lboost_thread -lboost_system -lboost_filesystem -I/home/greg/ws/boost_1_57_0 -Ibibnumber
+g++ -o boundedqueuetest tests/boundedqueuetest.cpp bibnumber/deadline.cpp -lopencv_core -lboost_thread -lboost_system -I/home/greg/ws/boost_1_57_0 -Ibibnumber
@@ -0,0 +1 @@
+./resultsinktest && ./decodetest && ./schedulertest && ./boundedqueuetest
@@ -0,0 +1,88 @@
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "boundedqueue.h"
+#include "check.h"
+
+/* time a blocked call is given to return before it is considered blocked */
+#define BLOCKED_MS (50)
+/* longest wait for a woken call to return before the check fails */
+#define TIMEOUT_MS (2000)
+
+static void push(batch::BoundedQueue<int> *queue, int item, bool *pushed) {
+	*pushed = queue->push(item);
+}
+
+static void pop(batch::BoundedQueue<int> *queue, int *item, bool *popped) {
+	*popped = queue->pop(*item);
+}
+
+static bool returns(boost::thread &thread, int ms) {
+	return thread.timed_join(boost::posix_time::milliseconds(ms));
+}
+
+static void testClose() {
+	batch::BoundedQueue<int> queue(3);
+	CHECK(queue.push(1));
+	CHECK(queue.push(2));
+	CHECK(queue.push(3));
+	queue.close();
+
+	/* nothing is queued once closed, what was queued is still popped in order */
+	CHECK(!queue.push(4));
+	int item = 0;
+	CHECK(queue.pop(item) && (item == 1));
+	CHECK(queue.pop(item) && (item == 2));
+	CHECK(queue.pop(item) && (item == 3));
+	CHECK(!queue.pop(item));
+	CHECK(!queue.pop(item));
+	CHECK(queue.size() == 0);
+	CHECK(queue.maxDepth() == 3);
+}
+
+static void testBlockedPop() {
+	batch::BoundedQueue<int> queue(1);
+	int item = 0;
+	bool popped = true;
+	boost::thread consumer(boost::bind(pop, &queue, &item, &popped));
+	CHECK(!returns(consumer, BLOCKED_MS));
+
+	/* a consumer waiting on an empty queue ends when the queue is closed */
+	queue.close();
+	CHECK(returns(consumer, TIMEOUT_MS));
+	CHECK(!popped);
+	CHECK(queue.popStallMs() > 0);
+}
+
+static void testBlockedPush() {
+	batch::BoundedQueue<int> queue(0);
+	CHECK(queue.capacity() == 1);
+	CHECK(queue.push(1));
+
+	/* a producer waiting on a full queue goes on once an item is popped */
+	bool pushed = false;
+	boost::thread producer(boost::bind(push, &queue, 2, &pushed));
+	CHECK(!returns(producer, BLOCKED_MS));
+	int item = 0;
+	CHECK(queue.pop(item) && (item == 1));
+	CHECK(returns(producer, TIMEOUT_MS));
+	CHECK(pushed);
+	CHECK(queue.pushStallMs() > 0);
+
+	/* and is refused when the queue is closed instead */
+	pushed = true;
+	boost::thread refused(boost::bind(push, &queue, 3, &pushed));
+	CHECK(!returns(refused, BLOCKED_MS));
+	queue.close();
+	CHECK(returns(refused, TIMEOUT_MS));
+	CHECK(!pushed);
+	CHECK(queue.pop(item) && (item == 2));
+	CHECK(!queue.pop(item));
+}
+
+int main(int argc, char **argv) {
+	testClose();
+	testBlockedPop();
+	testBlockedPush();
+	return checkResult("boundedqueuetest");
+}
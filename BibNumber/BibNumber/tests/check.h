@@ -0,0 +1,36 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+
+/* count of failed checks of the test program */
+static int checkFailures = 0;
+
+/// <summary>
+/// Prints the failed condition with its location and counts the failure,
+/// the test goes on with the next check.
+/// </summary>
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << "FAILED: " << __FILE__ << ":" << __LINE__ << ": " \
+					<< #condition << std::endl; \
+			checkFailures++; \
+		} \
+	} while (0)
+
+/// <summary>
+/// Prints the outcome of the test program.
+/// </summary>
+/// <returns>the exit status of the test program, 0 if all checks passed</returns>
+static int checkResult(const char *name) {
+	if (checkFailures) {
+		std::cerr << name << ": " << checkFailures << " check(s) failed"
+				<< std::endl;
+		return 1;
+	}
+	std::cout << name << ": OK" << std::endl;
+	return 0;
+}
+
+#endif /* #ifndef CHECK_H */
@@ -0,0 +1,133 @@
+#include <vector>
+#include <string>
+
+#include "opencv2/core/version.hpp"
+
+#include "decode.h"
+#include "check.h"
+
+static void appendWord(std::vector<unsigned char> &data, unsigned int value,
+		int bytes, bool bigEndian) {
+	for (int i = 0; i < bytes; i++) {
+		int shift = 8 * (bigEndian ? (bytes - 1 - i) : i);
+		data.push_back((unsigned char) (value >> shift));
+	}
+}
+
+/// <summary>
+/// Builds the headers of a JPEG file up to its frame header: an APP1 segment with
+/// the EXIF orientation if orientation is not 0, then the frame header.
+/// </summary>
+static std::vector<unsigned char> jpegHeaders(int width, int height,
+		int orientation, bool bigEndian) {
+	std::vector<unsigned char> data;
+	appendWord(data, 0xFFD8, 2, true);
+
+	/* a JFIF segment and fill bytes before the next marker */
+	appendWord(data, 0xFFE0, 2, true);
+	appendWord(data, 16, 2, true);
+	const char jfif[] = "JFIF\0\1\1\0\0\1\0\1\0\0";
+	data.insert(data.end(), jfif, jfif + 14);
+	data.push_back(0xFF);
+
+	if (orientation != 0) {
+		std::vector<unsigned char> exif;
+		const char header[] = "Exif\0\0";
+		exif.insert(exif.end(), header, header + 6);
+		exif.push_back(bigEndian ? 'M' : 'I');
+		exif.push_back(bigEndian ? 'M' : 'I');
+		appendWord(exif, 42, 2, bigEndian);
+		appendWord(exif, 8, 4, bigEndian);
+		/* two entries, the orientation second */
+		appendWord(exif, 2, 2, bigEndian);
+		appendWord(exif, 0x010F, 2, bigEndian); /* make */
+		appendWord(exif, 2, 2, bigEndian);
+		appendWord(exif, 4, 4, bigEndian);
+		appendWord(exif, 0x00435A59, 4, true);
+		appendWord(exif, 0x0112, 2, bigEndian); /* orientation */
+		appendWord(exif, 3, 2, bigEndian);
+		appendWord(exif, 1, 4, bigEndian);
+		appendWord(exif, orientation, 2, bigEndian);
+		appendWord(exif, 0, 2, bigEndian);
+		appendWord(exif, 0, 4, bigEndian);
+
+		appendWord(data, 0xFFE1, 2, true);
+		appendWord(data, exif.size() + 2, 2, true);
+		data.insert(data.end(), exif.begin(), exif.end());
+	}
+
+	/* baseline frame header: precision, height, width, components */
+	appendWord(data, 0xFFC0, 2, true);
+	appendWord(data, 11, 2, true);
+	data.push_back(8);
+	appendWord(data, height, 2, true);
+	appendWord(data, width, 2, true);
+	data.push_back(1);
+	data.push_back(1);
+	data.push_back(0x11);
+	data.push_back(0);
+	return data;
+}
+
+static void testJpegSize() {
+	int width = 0, height = 0, orientation = 0;
+	std::vector<unsigned char> data = jpegHeaders(6000, 4000, 0, true);
+	CHECK(decode::jpegSize(&data[0], data.size(), width, height, &orientation));
+	CHECK((width == 6000) && (height == 4000));
+	CHECK(orientation == 1);
+
+	for (int bigEndian = 0; bigEndian < 2; bigEndian++) {
+		data = jpegHeaders(6000, 4000, 6, bigEndian != 0);
+		CHECK(decode::jpegSize(&data[0], data.size(), width, height,
+				&orientation));
+		CHECK((width == 6000) && (height == 4000));
+		CHECK(orientation == 6);
+		CHECK(decode::jpegSize(&data[0], data.size(), width, height));
+	}
+
+	/* invalid orientations are ignored */
+	data = jpegHeaders(6000, 4000, 9, false);
+	CHECK(decode::jpegSize(&data[0], data.size(), width, height, &orientation));
+	CHECK(orientation == 1);
+
+	/* truncated before the frame header, or not a JPEG stream */
+	data = jpegHeaders(6000, 4000, 6, false);
+	CHECK(!decode::jpegSize(&data[0], data.size() - 12, width, height,
+			&orientation));
+	const unsigned char png[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	CHECK(!decode::jpegSize(png, sizeof(png), width, height, &orientation));
+}
+
+static void testDecodedWidth() {
+	for (int orientation = 1; orientation <= 4; orientation++)
+		CHECK(decode::decodedWidth(6000, 4000, orientation) == 6000);
+#if (CV_MAJOR_VERSION > 3) || ((CV_MAJOR_VERSION == 3) && (CV_MINOR_VERSION >= 1))
+	/* the decoder rotates a portrait photo stored sideways */
+	for (int orientation = 5; orientation <= 8; orientation++)
+		CHECK(decode::decodedWidth(6000, 4000, orientation) == 4000);
+#else
+	for (int orientation = 5; orientation <= 8; orientation++)
+		CHECK(decode::decodedWidth(6000, 4000, orientation) == 6000);
+#endif
+}
+
+static void testReductionFactor() {
+	CHECK(decode::reductionFactor(9600, 1200) == 8);
+	CHECK(decode::reductionFactor(9593, 1200) == 8);
+	CHECK(decode::reductionFactor(9592, 1200) == 4);
+	CHECK(decode::reductionFactor(6000, 1200) == 4);
+	CHECK(decode::reductionFactor(2400, 1200) == 2);
+	CHECK(decode::reductionFactor(2399, 1200) == 2);
+	CHECK(decode::reductionFactor(2398, 1200) == 1);
+	CHECK(decode::reductionFactor(1200, 1200) == 1);
+	CHECK(decode::reductionFactor(800, 1200) == 1);
+	CHECK(decode::reductionFactor(6000, 0) == 1);
+	CHECK(decode::reductionFactor(6000, -1) == 1);
+}
+
+int main(int argc, char **argv) {
+	testJpegSize();
+	testDecodedWidth();
+	testReductionFactor();
+	return checkResult("decodetest");
+}
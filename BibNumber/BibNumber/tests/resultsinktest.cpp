@@ -0,0 +1,177 @@
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdio>
+
+#include "resultsink.h"
+#include "check.h"
+
+/* name of the result stream written by the tests, in the working directory */
+#define STREAM_FILE "resultsinktest.jsonl"
+#define INDEX_FILE "resultsinktest.csv"
+
+static std::vector<std::string> parseList(const std::string &text, bool &ok) {
+	std::vector<std::string> values;
+	ok = results::parseStringList(text, values);
+	return values;
+}
+
+static bool rejected(const std::string &text) {
+	std::vector<std::string> values;
+	return !results::parseStringList(text, values);
+}
+
+static void testRoundTrip() {
+	results::ImageRecord record;
+	record.index = 42;
+	record.image = "album \"2015\"\\IMG_0035\t\xC3\xA9.JPG";
+	record.bibNumbers.push_back(164);
+	record.bibNumbers.push_back(773);
+	record.degradation = 5;
+	record.hash = "9f3c4e1a2b7d6e05";
+	record.version = "1/5a0e3c9d12f4b877";
+
+	std::string line = results::formatRecord(record);
+	CHECK(line.find('\n') == std::string::npos);
+	results::ImageRecord parsed;
+	CHECK(results::parseRecord(line, parsed));
+	CHECK(parsed.index == record.index);
+	CHECK(parsed.image == record.image);
+	CHECK(parsed.bibNumbers == record.bibNumbers);
+	CHECK(parsed.degradation == record.degradation);
+	CHECK(parsed.hash == record.hash);
+	CHECK(parsed.version == record.version);
+
+	/* records of runs without content hashes leave hash and version empty */
+	results::ImageRecord plain;
+	plain.index = 0;
+	plain.image = "IMG_0001.JPG";
+	CHECK(results::parseRecord(results::formatRecord(plain), parsed));
+	CHECK(parsed.image == "IMG_0001.JPG");
+	CHECK(parsed.bibNumbers.empty());
+	CHECK(parsed.hash.empty());
+	CHECK(parsed.version.empty());
+
+	/* the last line of a crashed run is cut anywhere */
+	for (size_t length = 0; length < line.size(); length++)
+		CHECK(!results::parseRecord(line.substr(0, length), parsed));
+}
+
+static void testStringList() {
+	bool ok;
+	std::vector<std::string> values = parseList(
+			" [ \"album/IMG_0035.JPG\" , \"a\\\"b\\\\c\\/d\" ] ", ok);
+	CHECK(ok);
+	CHECK(values.size() == 2);
+	CHECK((values.size() == 2) && (values[0] == "album/IMG_0035.JPG"));
+	CHECK((values.size() == 2) && (values[1] == "a\"b\\c/d"));
+
+	values = parseList("[]", ok);
+	CHECK(ok && values.empty());
+
+	/* \u escapes are decoded to UTF-8, surrogate pairs to one code point */
+	values = parseList("[\"caf\\u00e9\",\"\\u20AC\",\"\\ud83d\\ude00\"]", ok);
+	CHECK(ok);
+	CHECK(values.size() == 3);
+	CHECK((values.size() == 3) && (values[0] == "caf\xC3\xA9"));
+	CHECK((values.size() == 3) && (values[1] == "\xE2\x82\xAC"));
+	CHECK((values.size() == 3) && (values[2] == "\xF0\x9F\x98\x80"));
+
+	values = parseList("[\"a\\tb\\nc\"]", ok);
+	CHECK(ok && (values.size() == 1) && (values[0] == "a\tb\nc"));
+
+	/* invalid escapes reject the whole list instead of producing a wrong path */
+	CHECK(rejected("[\"\\u00zz\"]"));
+	CHECK(rejected("[\"\\u12\"]"));
+	CHECK(rejected("[\"\\u12"));
+	CHECK(rejected("[\"\\ud83d\"]"));
+	CHECK(rejected("[\"\\ud83dx\"]"));
+	CHECK(rejected("[\"\\ud83d\\u0041\"]"));
+	CHECK(rejected("[\"\\ude00\"]"));
+	CHECK(rejected("[\"\\x41\"]"));
+	CHECK(rejected("[\"\\a\"]"));
+
+	/* malformed arrays */
+	CHECK(rejected(""));
+	CHECK(rejected("\"a\""));
+	CHECK(rejected("[\"a\""));
+	CHECK(rejected("[\"a\",]"));
+	CHECK(rejected("[\"a\" \"b\"]"));
+	CHECK(rejected("[1]"));
+	CHECK(rejected("[\"a\"] x"));
+}
+
+static std::string readFile(const std::string &fileName) {
+	std::ifstream file(fileName.c_str());
+	std::ostringstream text;
+	text << file.rdbuf();
+	return text.str();
+}
+
+static bool fileExists(const std::string &fileName) {
+	std::ifstream file(fileName.c_str());
+	return file.is_open();
+}
+
+static void testBibIndex() {
+	/* records out of processing order, as merged from several shards */
+	results::ResultSink sink(0);
+	CHECK(sink.open(STREAM_FILE) == 0);
+	std::map<int, std::map<size_t, std::string> > expected;
+	for (size_t i = 0; i < 60; i++) {
+		results::ImageRecord record;
+		record.index = (i * 37) % 60;
+		std::ostringstream image;
+		image << "IMG_" << record.index << ".JPG";
+		record.image = image.str();
+		record.bibNumbers.push_back((int) (record.index % 7) + 100);
+		if (record.index % 3 == 0)
+			record.bibNumbers.push_back(5);
+		for (size_t b = 0; b < record.bibNumbers.size(); b++)
+			expected[record.bibNumbers[b]][record.index] = record.image;
+		CHECK(sink.append(record) == 0);
+	}
+	sink.close();
+
+	/* the last line of a crashed run is skipped */
+	{
+		std::ofstream stream(STREAM_FILE, std::ios::app);
+		stream << "{\"index\":60,\"image\":\"IMG_60.JPG\",\"bi";
+	}
+
+	std::ostringstream index;
+	for (std::map<int, std::map<size_t, std::string> >::iterator bib =
+			expected.begin(); bib != expected.end(); ++bib) {
+		index << std::endl << bib->first << ",";
+		for (std::map<size_t, std::string>::iterator image =
+				bib->second.begin(); image != bib->second.end(); ++image)
+			index << image->second << ",";
+	}
+
+	/* one run per pair, more runs than merged at once, needs several passes */
+	CHECK(results::writeBibIndex(STREAM_FILE, INDEX_FILE, 1) == 0);
+	CHECK(readFile(INDEX_FILE) == index.str());
+	for (int r = 0; r < 100; r++) {
+		std::ostringstream run;
+		run << INDEX_FILE << ".run" << r;
+		CHECK(!fileExists(run.str()));
+	}
+
+	/* a single run sorted in memory gives the same index */
+	CHECK(results::writeBibIndex(STREAM_FILE, INDEX_FILE) == 0);
+	CHECK(readFile(INDEX_FILE) == index.str());
+
+	CHECK(results::writeBibIndex("resultsinktest.missing", INDEX_FILE) < 0);
+
+	remove(STREAM_FILE);
+	remove(INDEX_FILE);
+}
+
+int main(int argc, char **argv) {
+	testRoundTrip();
+	testStringList();
+	testBibIndex();
+	return checkResult("resultsinktest");
+}
@@ -0,0 +1,220 @@
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "scheduler.h"
+#include "check.h"
+
+using server::Scheduler;
+using server::PRIORITY_INTERACTIVE;
+using server::PRIORITY_BULK;
+
+/* longest wait for a request to be queued or granted before the check fails */
+#define TIMEOUT_MS (2000)
+/* aging time of the aging test, the releases of the test take much less */
+#define AGING_MS (100)
+
+/// <summary>
+/// Order in which the requests of the test threads were granted a pipeline.
+/// </summary>
+struct Grants {
+	boost::mutex mutex;
+	std::vector<int> requests;
+	std::vector<pipeline::Pipeline *> pipelines;
+};
+
+static void request(Scheduler *scheduler, server::Priority priority, int id,
+		Grants *grants) {
+	double waitMs;
+	pipeline::Pipeline *pipeline = scheduler->acquire(priority, waitMs);
+	boost::lock_guard<boost::mutex> lock(grants->mutex);
+	grants->requests.push_back(id);
+	grants->pipelines.push_back(pipeline);
+}
+
+/// <summary>
+/// Waits until count requests were granted.
+/// </summary>
+/// <returns>false on timeout</returns>
+static bool waitGrants(Grants &grants, size_t count) {
+	for (int ms = 0; ms < TIMEOUT_MS; ms++) {
+		{
+			boost::lock_guard<boost::mutex> lock(grants.mutex);
+			if (grants.requests.size() >= count)
+				return true;
+		}
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+	return false;
+}
+
+static pipeline::Pipeline *grantedPipeline(Grants &grants, size_t n) {
+	boost::lock_guard<boost::mutex> lock(grants.mutex);
+	return (n < grants.pipelines.size()) ? grants.pipelines[n] : NULL;
+}
+
+/// <summary>
+/// Gets a counter of a class from the statistics of the scheduler.
+/// </summary>
+static int stat(Scheduler &scheduler, const char *className, const char *name) {
+	std::string stats = scheduler.formatStats();
+	size_t pos = stats.find(std::string("\"") + className + "\":{");
+	if (pos == std::string::npos)
+		return -1;
+	pos = stats.find(std::string("\"") + name + "\":", pos);
+	if (pos == std::string::npos)
+		return -1;
+	return atoi(stats.c_str() + pos + strlen(name) + 3);
+}
+
+/// <summary>
+/// Waits until the given count of requests of a class are queued.
+/// </summary>
+/// <returns>false on timeout</returns>
+static bool waitQueued(Scheduler &scheduler, const char *className, int count) {
+	for (int ms = 0; ms < TIMEOUT_MS; ms++) {
+		if (stat(scheduler, className, "waiting") == count)
+			return true;
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+	return false;
+}
+
+/// <summary>
+/// Makes distinct pipeline pointers, the scheduler only lends them.
+/// </summary>
+static std::vector<pipeline::Pipeline *> fakePipelines(char *slots, int count) {
+	std::vector<pipeline::Pipeline *> pipelines;
+	for (int i = 0; i < count; i++)
+		pipelines.push_back((pipeline::Pipeline *) &slots[i]);
+	return pipelines;
+}
+
+static void testAdmission() {
+	char slots[1];
+	size_t limits[] = { 1, 1 };
+	Scheduler scheduler(fakePipelines(slots, 1), limits, 1e6);
+	Grants grants;
+	double waitMs;
+
+	pipeline::Pipeline *busy = scheduler.acquire(PRIORITY_INTERACTIVE, waitMs);
+	CHECK(busy == (pipeline::Pipeline *) &slots[0]);
+
+	/* one request of each class may wait, further ones are rejected */
+	boost::thread interactive(boost::bind(request, &scheduler,
+			PRIORITY_INTERACTIVE, 1, &grants));
+	CHECK(waitQueued(scheduler, "interactive", 1));
+	boost::thread bulk(boost::bind(request, &scheduler, PRIORITY_BULK, 2,
+			&grants));
+	CHECK(waitQueued(scheduler, "bulk", 1));
+	CHECK(scheduler.acquire(PRIORITY_INTERACTIVE, waitMs) == NULL);
+	CHECK(scheduler.acquire(PRIORITY_BULK, waitMs) == NULL);
+	CHECK(scheduler.acquire(PRIORITY_BULK, waitMs) == NULL);
+	CHECK(stat(scheduler, "interactive", "rejected") == 1);
+	CHECK(stat(scheduler, "bulk", "rejected") == 2);
+
+	/* the released pipeline goes to the interactive request */
+	scheduler.release(busy, PRIORITY_INTERACTIVE, 1);
+	CHECK(waitGrants(grants, 1));
+	CHECK((grants.requests.size() == 1) && (grants.requests[0] == 1));
+	scheduler.release(grantedPipeline(grants, 0), PRIORITY_INTERACTIVE, 1);
+	CHECK(waitGrants(grants, 2));
+	CHECK((grants.requests.size() == 2) && (grants.requests[1] == 2));
+	scheduler.release(grantedPipeline(grants, 1), PRIORITY_BULK, 1);
+	interactive.join();
+	bulk.join();
+}
+
+static void testReservedPipeline() {
+	char slots[2];
+	size_t limits[] = { 0, 0 };
+	Scheduler scheduler(fakePipelines(slots, 2), limits, 1e6);
+	Grants grants;
+	double waitMs;
+
+	/* bulk requests may not take the last idle pipeline */
+	pipeline::Pipeline *first = scheduler.acquire(PRIORITY_BULK, waitMs);
+	CHECK(first != NULL);
+	boost::thread bulk(boost::bind(request, &scheduler, PRIORITY_BULK, 1,
+			&grants));
+	CHECK(waitQueued(scheduler, "bulk", 1));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	CHECK(grantedPipeline(grants, 0) == NULL);
+
+	/* which stays free for a runner */
+	pipeline::Pipeline *reserved = scheduler.acquire(PRIORITY_INTERACTIVE,
+			waitMs);
+	CHECK((reserved != NULL) && (reserved != first));
+	scheduler.release(reserved, PRIORITY_INTERACTIVE, 1);
+	CHECK(stat(scheduler, "bulk", "waiting") == 1);
+
+	scheduler.release(first, PRIORITY_BULK, 1);
+	CHECK(waitGrants(grants, 1));
+	bulk.join();
+	scheduler.release(grantedPipeline(grants, 0), PRIORITY_BULK, 1);
+
+	/* a daemon with one pipeline lends it to bulk requests too */
+	Scheduler single(fakePipelines(slots, 1), limits, 1e6);
+	Grants singleGrants;
+	boost::thread alone(boost::bind(request, &single, PRIORITY_BULK, 1,
+			&singleGrants));
+	CHECK(waitGrants(singleGrants, 1));
+	alone.join();
+}
+
+static void testAging() {
+	char slots[1];
+	size_t limits[] = { 0, 0 };
+	Scheduler scheduler(fakePipelines(slots, 1), limits, AGING_MS);
+	Grants grants;
+	double waitMs;
+
+	pipeline::Pipeline *busy = scheduler.acquire(PRIORITY_INTERACTIVE, waitMs);
+	boost::thread bulk1(boost::bind(request, &scheduler, PRIORITY_BULK, 1,
+			&grants));
+	CHECK(waitQueued(scheduler, "bulk", 1));
+	boost::thread bulk2(boost::bind(request, &scheduler, PRIORITY_BULK, 2,
+			&grants));
+	CHECK(waitQueued(scheduler, "bulk", 2));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(AGING_MS * 3 / 2));
+	boost::thread interactive3(boost::bind(request, &scheduler,
+			PRIORITY_INTERACTIVE, 3, &grants));
+	CHECK(waitQueued(scheduler, "interactive", 1));
+
+	/* the aged bulk request goes first, but only one per aging time */
+	scheduler.release(busy, PRIORITY_INTERACTIVE, 1);
+	CHECK(waitGrants(grants, 1));
+	scheduler.release(grantedPipeline(grants, 0), PRIORITY_BULK, 1);
+	CHECK(waitGrants(grants, 2));
+
+	/* once the aging time passed again, the next aged bulk request goes first */
+	boost::thread interactive4(boost::bind(request, &scheduler,
+			PRIORITY_INTERACTIVE, 4, &grants));
+	CHECK(waitQueued(scheduler, "interactive", 1));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(AGING_MS * 3 / 2));
+	scheduler.release(grantedPipeline(grants, 1), PRIORITY_INTERACTIVE, 1);
+	CHECK(waitGrants(grants, 3));
+	scheduler.release(grantedPipeline(grants, 2), PRIORITY_BULK, 1);
+	CHECK(waitGrants(grants, 4));
+	scheduler.release(grantedPipeline(grants, 3), PRIORITY_INTERACTIVE, 1);
+
+	bulk1.join();
+	bulk2.join();
+	interactive3.join();
+	interactive4.join();
+	int expected[] = { 1, 3, 2, 4 };
+	CHECK(grants.requests == std::vector<int>(expected, expected + 4));
+}
+
+int main(int argc, char **argv) {
+	testAdmission();
+	testReservedPipeline();
+	testAging();
+	return checkResult("schedulertest");
+}
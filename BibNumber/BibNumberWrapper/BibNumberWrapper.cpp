@@ -5,6 +5,7 @@
 #include "BibNumberWrapper.h"
 
 #include <vector>
+#include <vcclr.h>
 #include <msclr\marshal_cppstd.h>
 
 //#include <cliext/adapter>
@@ -12,6 +13,8 @@
 
 #include "pipeline.h"
 #include "batch.h"
+#include "album.h"
+#include "log.h"
 
 //#include "opencv2/objdetect/objdetect.hpp"
 //#include "opencv2/highgui/highgui.hpp"
@@ -19,20 +22,18 @@
 
 
 
-MyList^ BibNumberWrapper::Class1::DetectNumbers(System::String^ filename)
+static BibNumberWrapper::Class1::Class1()
 {
-	
-	std::string unmanagedFileName = msclr::interop::marshal_as<std::string>(filename);
-	pipeline::Pipeline pipeline;
-	std::vector<int> bibNumbers;
-
-	//cv::Mat matc = cv::imread(unmanagedFileName, 1);
-	int res = batch::processSingleImage(unmanagedFileName, "", pipeline, bibNumbers);
+	/* no console output nor debug images from the library */
+	biblog::set_log_mask(LOG_NONE);
+}
 
+MyList^ BibNumberWrapper::Class1::ToList(const MyVector &bibNumbers)
+{
 	MyList^ result = gcnew MyList();
 	if (result != nullptr) 
 	{
-		for (MyVector::iterator i = bibNumbers.begin(); i != bibNumbers.end(); ++i) 
+		for (MyVector::const_iterator i = bibNumbers.begin(); i != bibNumbers.end(); ++i) 
 		{
 			int nativeValue = *i;
 			result->Add(nativeValue);
@@ -41,7 +42,95 @@ MyList^ BibNumberWrapper::Class1::DetectNumbers(System::String^ filename)
 	return result;
 }
 
+MyList^ BibNumberWrapper::Class1::DetectNumbers(System::String^ filename)
+{
+	
+	std::string unmanagedFileName = msclr::interop::marshal_as<std::string>(filename);
+	pipeline::Pipeline pipeline;
+	batch::Options options;
+	std::vector<int> bibNumbers;
 
+	//cv::Mat matc = cv::imread(unmanagedFileName, 1);
+	int res = batch::processSingleImage(unmanagedFileName, options, pipeline, bibNumbers);
 
+	return ToList(bibNumbers);
+}
 
+MyList^ BibNumberWrapper::Class1::DetectNumbersFromBytes(array<System::Byte>^ data)
+{
+	std::vector<int> bibNumbers;
+	if ((data == nullptr) || (data->Length == 0))
+		return ToList(bibNumbers);
+
+	pipeline::Pipeline pipeline;
+	/* the managed array is pinned and read in place */
+	pin_ptr<System::Byte> pinned = &data[0];
+	int res = pipeline.processEncodedImage((const unsigned char *) pinned, data->Length, "", bibNumbers);
+
+	return ToList(bibNumbers);
+}
 
+MyList^ BibNumberWrapper::Class1::DetectNumbersFromPixels(System::IntPtr scan0, int width, int height, int stride, int channels)
+{
+	std::vector<int> bibNumbers;
+	if (stride < 0)
+		return ToList(bibNumbers);
+
+	pipeline::Pipeline pipeline;
+	int res = pipeline.processPixels((const unsigned char *) scan0.ToPointer(), width, height, channels, stride, "", bibNumbers);
+
+	return ToList(bibNumbers);
+}
+
+/// <summary>
+/// Keeps the bib numbers of an album and forwards the completed images to the managed handler.
+/// </summary>
+class AlbumCollector : public batch::AlbumCallback
+{
+public:
+	AlbumCollector(BibNumberWrapper::ImageDetectedHandler^ handler, size_t count)
+		: handler(handler), bibNumbers(count)
+	{
+	}
+
+	virtual void imageDone(const batch::AlbumProgress &progress, batch::ImageResult &result)
+	{
+		bibNumbers[progress.index] = result.bibNumbers;
+		BibNumberWrapper::ImageDetectedHandler^ imageDetected = handler;
+		if (imageDetected != nullptr)
+			imageDetected((int) progress.index, (int) progress.done, (int) progress.total,
+				BibNumberWrapper::Class1::ToList(result.bibNumbers));
+	}
+
+	std::vector<MyVector> bibNumbers;
+
+private:
+	gcroot<BibNumberWrapper::ImageDetectedHandler^> handler;
+};
+
+MyAlbumList^ BibNumberWrapper::Class1::DetectNumbersInAlbum(System::Collections::Generic::List<System::String^>^ filenames, int threads, ImageDetectedHandler^ imageDetected)
+{
+	MyAlbumList^ result = gcnew MyAlbumList();
+	if ((filenames == nullptr) || (filenames->Count == 0) || (threads < 0))
+		return result;
+
+	std::vector<boost::filesystem::path> paths;
+	for each (System::String^ filename in filenames)
+		paths.push_back(msclr::interop::marshal_as<std::string>(filename));
+
+	/* the pipelines are initialized once for the album */
+	batch::Options options;
+	options.jobs = threads;
+	batch::AlbumProcessor processor(options);
+	AlbumCollector collector(imageDetected, paths.size());
+	if (processor.initialize() == 0)
+	{
+		batch::AlbumRun run;
+		run.callback = &collector;
+		processor.process(paths, run);
+	}
+
+	for (size_t i = 0; i < collector.bibNumbers.size(); i++)
+		result->Add(ToList(collector.bibNumbers[i]));
+	return result;
+}
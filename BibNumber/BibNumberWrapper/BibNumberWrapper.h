@@ -6,13 +6,31 @@
 
 typedef System::Collections::Generic::List<int> MyList;
 typedef std::vector<int> MyVector;
+typedef System::Collections::Generic::List<MyList^> MyAlbumList;
 
 namespace BibNumberWrapper {
 
+	/// <summary>
+	/// Called as the images of an album complete, in album order, from the thread
+	/// which called DetectNumbersInAlbum.
+	/// </summary>
+	public delegate void ImageDetectedHandler(int index, int done, int total, MyList^ bibNumbers);
+
 	public ref class Class1
 	{
 		// TODO: Add your methods for this class here.
 	public:
+		static Class1();
 		MyList^ DetectNumbers(System::String^ filename);
+		MyList^ DetectNumbersFromBytes(array<System::Byte>^ data);
+		MyList^ DetectNumbersFromPixels(System::IntPtr scan0, int width, int height, int stride, int channels);
+
+		/// <summary>
+		/// Detects the bib numbers of the images of an album on threads threads (one
+		/// per core for 0) and returns them in album order. imageDetected may be null.
+		/// </summary>
+		MyAlbumList^ DetectNumbersInAlbum(System::Collections::Generic::List<System::String^>^ filenames, int threads, ImageDetectedHandler^ imageDetected);
+	internal:
+		static MyList^ ToList(const MyVector &bibNumbers);
 	};
 }
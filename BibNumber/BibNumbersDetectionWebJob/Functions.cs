@@ -74,13 +74,13 @@ namespace BibNumbersDetectionWebJob
 
         public static void ProcessPhoto(Photo photo, BibNumbersMysqlContext db)
         {
-            var tempFile = Path.GetTempFileName();
             using (WebClient webClient = new WebClient())
             {
-                webClient.DownloadFile(photo.Url, tempFile);
+                // decoded from memory, no temporary file
+                var photoData = webClient.DownloadData(photo.Url);
                 Console.Write("photo url: " + photo.Url);
                 Class1 c = new Class1();
-                var foundBibNumbers = c.DetectNumbers(tempFile);
+                var foundBibNumbers = c.DetectNumbersFromBytes(photoData);
 
                 if (foundBibNumbers != null
                     && foundBibNumbers.Count > 0)